@@ -0,0 +1,538 @@
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "FastInflate.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FASTINFLATE_HAS_BMI2
+#include <cpuid.h>
+#endif
+
+#ifdef _MSC_VER
+#define FASTINFLATE_INLINE __forceinline
+#else
+#define FASTINFLATE_INLINE inline __attribute__((always_inline))
+#endif
+
+// Decode table entries pack: bits 0-4 code bits to consume, bits 5-7 kind, bits 8-11 extra bits (or subtable index bits), bits 16-31 value
+enum eEntryKind
+{
+    kLiteral    = 0,
+    kLength     = 1,        // value is the base length
+    kEndOfBlock = 2,
+    kDistance   = 3,        // value is the base distance
+    kSubtable   = 4,        // value is the subtable's offset in the table
+    kInvalid    = 5
+};
+
+static inline uint32_t MakeEntry(uint32_t nBits, uint32_t nKind, uint32_t nExtra, uint32_t nValue) { return nBits | (nKind << 5) | (nExtra << 8) | (nValue << 16); }
+static inline uint32_t EntryBits(uint32_t nEntry)   { return nEntry & 0x1f; }
+static inline uint32_t EntryKind(uint32_t nEntry)   { return (nEntry >> 5) & 0x7; }
+static inline uint32_t EntryExtra(uint32_t nEntry)  { return (nEntry >> 8) & 0xf; }
+static inline uint32_t EntryValue(uint32_t nEntry)  { return nEntry >> 16; }
+
+const uint32_t kMaxCodeBits = 15;
+const uint32_t kNumLitLenSymbols = 288;
+const uint32_t kNumDistSymbols = 32;
+const uint32_t kNumPrecodeSymbols = 19;
+
+// First level lookups cover most codes. Longer codes go through a second level subtable sized for the longest code under that prefix.
+// The subtable allowances are the worst case for complete codes (6 codes filling a 2^5 or 2^7 entry subtable) with some slack.
+const uint32_t kLitLenTableBits = 10;
+const uint32_t kLitLenTableSize = (1 << kLitLenTableBits) + 1600;
+const uint32_t kDistTableBits = 8;
+const uint32_t kDistTableSize = (1 << kDistTableBits) + 700;
+const uint32_t kPrecodeTableBits = 7;
+const uint32_t kPrecodeTableSize = 1 << kPrecodeTableBits;
+
+static const uint16_t kLengthBase[29]   = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t  kLengthExtra[29]  = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t kDistBase[30]     = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t  kDistExtra[30]    = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const uint8_t  kPrecodeOrder[kNumPrecodeSymbols] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static inline uint32_t LitLenTemplate(uint32_t nSymbol)
+{
+    if (nSymbol < 256)
+        return MakeEntry(0, kLiteral, 0, nSymbol);
+    if (nSymbol == 256)
+        return MakeEntry(0, kEndOfBlock, 0, 0);
+    if (nSymbol < 286)
+        return MakeEntry(0, kLength, kLengthExtra[nSymbol - 257], kLengthBase[nSymbol - 257]);
+    return MakeEntry(0, kInvalid, 0, 0);      // 286 and 287 only exist to complete the fixed code
+}
+
+static inline uint32_t DistTemplate(uint32_t nSymbol)
+{
+    if (nSymbol < 30)
+        return MakeEntry(0, kDistance, kDistExtra[nSymbol], kDistBase[nSymbol]);
+    return MakeEntry(0, kInvalid, 0, 0);
+}
+
+static inline uint32_t ReverseBits(uint32_t nCode, uint32_t nBits)
+{
+    uint32_t nReversed = 0;
+    for (uint32_t i = 0; i < nBits; i++)
+    {
+        nReversed = (nReversed << 1) | (nCode & 1);
+        nCode >>= 1;
+    }
+    return nReversed;
+}
+
+// Builds the decode table for a canonical code. Deflate sends codes most significant bit first into an LSB first bit stream so
+// table indices are the bit reversed codes. Over-subscribed and incomplete codes are rejected the way zlib rejects them
+// (a lone one bit code is the only incomplete code allowed, and only for literal/length and distance codes).
+static bool BuildTable(const uint8_t* pLengths, uint32_t nSymbols, uint32_t (*pTemplate)(uint32_t), uint32_t nTableBits, uint32_t* pTable, uint32_t nTableSize, bool bAllowSingle)
+{
+    uint32_t nCount[kMaxCodeBits + 1] = { 0 };
+    for (uint32_t nSymbol = 0; nSymbol < nSymbols; nSymbol++)
+        nCount[pLengths[nSymbol]]++;
+    nCount[0] = 0;
+
+    uint32_t nMainSize = 1 << nTableBits;
+    uint32_t nInvalid = MakeEntry(0, kInvalid, 0, 0);
+    for (uint32_t i = 0; i < nMainSize; i++)
+        pTable[i] = nInvalid;
+
+    uint32_t nMaxBits = kMaxCodeBits;
+    while (nMaxBits > 0 && nCount[nMaxBits] == 0)
+        nMaxBits--;
+    if (nMaxBits == 0)
+        return true;        // no codes at all. Any use of the table fails.
+
+    int32_t nLeft = 1;
+    for (uint32_t nBits = 1; nBits <= kMaxCodeBits; nBits++)
+    {
+        nLeft <<= 1;
+        nLeft -= nCount[nBits];
+        if (nLeft < 0)
+            return false;   // over-subscribed
+    }
+    if (nLeft > 0 && !(bAllowSingle && nMaxBits == 1))
+        return false;       // incomplete
+
+    uint32_t nNextCode[kMaxCodeBits + 1];
+    uint32_t nCode = 0;
+    nNextCode[0] = 0;
+    for (uint32_t nBits = 1; nBits <= kMaxCodeBits; nBits++)
+    {
+        nCode = (nCode + nCount[nBits - 1]) << 1;
+        nNextCode[nBits] = nCode;
+    }
+
+    uint16_t nCodes[kNumLitLenSymbols];
+    uint8_t nSubtableBits[1 << kLitLenTableBits];
+    memset(nSubtableBits, 0, nMainSize);
+    for (uint32_t nSymbol = 0; nSymbol < nSymbols; nSymbol++)
+    {
+        uint32_t nBits = pLengths[nSymbol];
+        if (nBits == 0)
+            continue;
+        nCodes[nSymbol] = (uint16_t)ReverseBits(nNextCode[nBits]++, nBits);
+        if (nBits > nTableBits)
+        {
+            uint32_t nPrefix = nCodes[nSymbol] & (nMainSize - 1);
+            if (nBits - nTableBits > nSubtableBits[nPrefix])
+                nSubtableBits[nPrefix] = (uint8_t)(nBits - nTableBits);
+        }
+    }
+
+    // Lay out subtables after the main table
+    uint32_t nUsed = nMainSize;
+    if (nMaxBits > nTableBits)
+    {
+        for (uint32_t nPrefix = 0; nPrefix < nMainSize; nPrefix++)
+        {
+            if (nSubtableBits[nPrefix] == 0)
+                continue;
+
+            uint32_t nSubSize = 1 << nSubtableBits[nPrefix];
+            if (nUsed + nSubSize > nTableSize)
+                return false;
+            for (uint32_t i = 0; i < nSubSize; i++)
+                pTable[nUsed + i] = nInvalid;
+            pTable[nPrefix] = MakeEntry(nTableBits, kSubtable, nSubtableBits[nPrefix], nUsed);
+            nUsed += nSubSize;
+        }
+    }
+
+    for (uint32_t nSymbol = 0; nSymbol < nSymbols; nSymbol++)
+    {
+        uint32_t nBits = pLengths[nSymbol];
+        if (nBits == 0)
+            continue;
+
+        uint32_t nTemplate = pTemplate(nSymbol);
+        uint32_t nReversed = nCodes[nSymbol];
+        if (nBits <= nTableBits)
+        {
+            for (uint32_t i = nReversed; i < nMainSize; i += 1 << nBits)
+                pTable[i] = nTemplate | nBits;
+        }
+        else
+        {
+            uint32_t nSubtable = pTable[nReversed & (nMainSize - 1)];
+            uint32_t nSubSize = 1 << EntryExtra(nSubtable);
+            uint32_t nSubBits = nBits - nTableBits;
+            for (uint32_t i = nReversed >> nTableBits; i < nSubSize; i += 1 << nSubBits)
+                pTable[EntryValue(nSubtable) + i] = nTemplate | nSubBits;
+        }
+    }
+
+    return true;
+}
+
+static uint32_t PrecodeTemplate(uint32_t nSymbol) { return MakeEntry(0, kLiteral, 0, nSymbol); }
+
+class cInflateTables
+{
+public:
+    uint32_t    mLitLen[kLitLenTableSize];
+    uint32_t    mDist[kDistTableSize];
+};
+
+static cInflateTables BuildFixedTables()
+{
+    cInflateTables tables;
+    uint8_t nLengths[kNumLitLenSymbols];
+    memset(nLengths, 8, 144);
+    memset(nLengths + 144, 9, 256 - 144);
+    memset(nLengths + 256, 7, 280 - 256);
+    memset(nLengths + 280, 8, kNumLitLenSymbols - 280);
+    BuildTable(nLengths, kNumLitLenSymbols, LitLenTemplate, kLitLenTableBits, tables.mLitLen, kLitLenTableSize, false);
+
+    memset(nLengths, 5, kNumDistSymbols);
+    BuildTable(nLengths, kNumDistSymbols, DistTemplate, kDistTableBits, tables.mDist, kDistTableSize, false);
+    return tables;
+}
+
+static const cInflateTables& GetFixedTables()
+{
+    static const cInflateTables tables = BuildFixedTables();
+    return tables;
+}
+
+static inline uint64_t LoadLE64(const uint8_t* p)
+{
+    uint64_t n;
+    memcpy(&n, p, sizeof(n));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    n = __builtin_bswap64(n);
+#endif
+    return n;
+}
+
+static inline void Copy8(uint8_t* pDst, const uint8_t* pSrc)
+{
+    uint64_t n;
+    memcpy(&n, pSrc, sizeof(n));
+    memcpy(pDst, &n, sizeof(n));
+}
+
+// The bit buffer holds at least 56 valid bits after a refill, enough for a length code, its extra bits, a distance code and its
+// extra bits. With 8 or more input bytes left a refill is one unaligned load. Bits above nBitCount may already hold the next
+// input byte, which is harmless since the next refill ORs in the same bits. Near the end it goes a byte at a time and feeds
+// zeros past the end. Those are only legal if they never get consumed, which is checked once the stream ends.
+#define REFILL()                                                                                    \
+    if (pInEnd - pInNext >= 8)                                                                      \
+    {                                                                                               \
+        nBitBuf |= LoadLE64(pInNext) << nBitCount;                                                  \
+        pInNext += (63 - nBitCount) >> 3;                                                           \
+        nBitCount |= 56;                                                                            \
+    }                                                                                               \
+    else                                                                                            \
+    {                                                                                               \
+        while (nBitCount <= 56)                                                                     \
+        {                                                                                           \
+            if (pInNext < pInEnd)                                                                   \
+                nBitBuf |= (uint64_t)*pInNext++ << nBitCount;                                       \
+            else if (++nOverrun > 8)                                                                \
+                return false;                                                                       \
+            nBitCount += 8;                                                                         \
+        }                                                                                           \
+    }
+
+#define BITS(n)     ((uint32_t)(nBitBuf & ((1ull << (n)) - 1)))
+#define CONSUME(n)  { nBitBuf >>= (n); nBitCount -= (n); }
+
+#define DECODE(nEntry, pTable, nTableBits)                                                          \
+    nEntry = pTable[BITS(nTableBits)];                                                              \
+    if (EntryKind(nEntry) == kSubtable)                                                             \
+    {                                                                                               \
+        CONSUME(nTableBits);                                                                        \
+        nEntry = pTable[EntryValue(nEntry) + BITS(EntryExtra(nEntry))];                             \
+    }                                                                                               \
+    CONSUME(EntryBits(nEntry));
+
+static FASTINFLATE_INLINE bool InflateImpl(const uint8_t* pIn, size_t nInSize, uint8_t* pOut, size_t nOutSize)
+{
+    const uint8_t* pInNext = pIn;
+    const uint8_t* pInEnd = pIn + nInSize;
+    uint8_t* pOutNext = pOut;
+    uint8_t* pOutEnd = pOut + nOutSize;
+
+    uint64_t nBitBuf = 0;
+    uint32_t nBitCount = 0;
+    size_t nOverrun = 0;            // zero bytes fed in past the end of the input
+
+    cInflateTables dynamicTables;
+    uint32_t precodeTable[kPrecodeTableSize];
+
+    bool bFinal = false;
+    while (!bFinal)
+    {
+        REFILL();
+        bFinal = BITS(1) != 0;
+        CONSUME(1);
+        uint32_t nType = BITS(2);
+        CONSUME(2);
+
+        const uint32_t* pLitLen = nullptr;
+        const uint32_t* pDist = nullptr;
+
+        if (nType == 0)
+        {
+            // Stored. Drop to a byte boundary and hand the whole bytes still in the bit buffer back to the input.
+            CONSUME(nBitCount & 7);
+            size_t nBuffered = nBitCount / 8;
+            if (nOverrun > nBuffered)
+                return false;
+            pInNext -= nBuffered - nOverrun;
+            nOverrun = 0;
+            nBitBuf = 0;
+            nBitCount = 0;
+
+            if (pInEnd - pInNext < 4)
+                return false;
+            uint32_t nLen = pInNext[0] | (pInNext[1] << 8);
+            uint32_t nNLen = pInNext[2] | (pInNext[3] << 8);
+            pInNext += 4;
+            if (nLen != (~nNLen & 0xffff))
+                return false;
+            if ((size_t)(pInEnd - pInNext) < nLen || (size_t)(pOutEnd - pOutNext) < nLen)
+                return false;
+
+            memcpy(pOutNext, pInNext, nLen);
+            pInNext += nLen;
+            pOutNext += nLen;
+            continue;
+        }
+        else if (nType == 1)
+        {
+            const cInflateTables& fixedTables = GetFixedTables();
+            pLitLen = fixedTables.mLitLen;
+            pDist = fixedTables.mDist;
+        }
+        else if (nType == 2)
+        {
+            uint32_t nLitLenCodes = BITS(5) + 257;
+            CONSUME(5);
+            uint32_t nDistCodes = BITS(5) + 1;
+            CONSUME(5);
+            uint32_t nPrecodeCodes = BITS(4) + 4;
+            CONSUME(4);
+            if (nLitLenCodes > 286 || nDistCodes > 30)
+                return false;
+
+            uint8_t nPrecodeLengths[kNumPrecodeSymbols] = { 0 };
+            for (uint32_t i = 0; i < nPrecodeCodes; i++)
+            {
+                if (nBitCount < 3)
+                {
+                    REFILL();
+                }
+                nPrecodeLengths[kPrecodeOrder[i]] = (uint8_t)BITS(3);
+                CONSUME(3);
+            }
+            if (!BuildTable(nPrecodeLengths, kNumPrecodeSymbols, PrecodeTemplate, kPrecodeTableBits, precodeTable, kPrecodeTableSize, false))
+                return false;
+
+            uint8_t nLengths[kNumLitLenSymbols + kNumDistSymbols];
+            uint32_t nTotalCodes = nLitLenCodes + nDistCodes;
+            uint32_t nCodesRead = 0;
+            while (nCodesRead < nTotalCodes)
+            {
+                REFILL();
+                uint32_t nEntry = precodeTable[BITS(kPrecodeTableBits)];
+                if (EntryKind(nEntry) != kLiteral)
+                    return false;
+                CONSUME(EntryBits(nEntry));
+
+                uint32_t nSymbol = EntryValue(nEntry);
+                if (nSymbol < 16)
+                {
+                    nLengths[nCodesRead++] = (uint8_t)nSymbol;
+                    continue;
+                }
+
+                uint8_t nRepeatValue = 0;
+                uint32_t nRepeat = 0;
+                if (nSymbol == 16)
+                {
+                    if (nCodesRead == 0)
+                        return false;
+                    nRepeatValue = nLengths[nCodesRead - 1];
+                    nRepeat = 3 + BITS(2);
+                    CONSUME(2);
+                }
+                else if (nSymbol == 17)
+                {
+                    nRepeat = 3 + BITS(3);
+                    CONSUME(3);
+                }
+                else
+                {
+                    nRepeat = 11 + BITS(7);
+                    CONSUME(7);
+                }
+
+                if (nCodesRead + nRepeat > nTotalCodes)
+                    return false;
+                memset(nLengths + nCodesRead, nRepeatValue, nRepeat);
+                nCodesRead += nRepeat;
+            }
+
+            if (nLengths[256] == 0)
+                return false;       // no end of block code
+
+            if (!BuildTable(nLengths, nLitLenCodes, LitLenTemplate, kLitLenTableBits, dynamicTables.mLitLen, kLitLenTableSize, true) ||
+                !BuildTable(nLengths + nLitLenCodes, nDistCodes, DistTemplate, kDistTableBits, dynamicTables.mDist, kDistTableSize, true))
+                return false;
+
+            pLitLen = dynamicTables.mLitLen;
+            pDist = dynamicTables.mDist;
+        }
+        else
+        {
+            return false;
+        }
+
+        for (;;)
+        {
+            REFILL();
+
+            uint32_t nEntry;
+            DECODE(nEntry, pLitLen, kLitLenTableBits);
+
+            uint32_t nKind = EntryKind(nEntry);
+            if (nKind == kLiteral)
+            {
+                if (pOutNext == pOutEnd)
+                    return false;
+                *pOutNext++ = (uint8_t)EntryValue(nEntry);
+                continue;
+            }
+            if (nKind != kLength)
+            {
+                if (nKind == kEndOfBlock)
+                    break;
+                return false;
+            }
+
+            uint32_t nLength = EntryValue(nEntry) + BITS(EntryExtra(nEntry));
+            CONSUME(EntryExtra(nEntry));
+
+            DECODE(nEntry, pDist, kDistTableBits);
+            if (EntryKind(nEntry) != kDistance)
+                return false;
+            uint32_t nDistance = EntryValue(nEntry) + BITS(EntryExtra(nEntry));
+            CONSUME(EntryExtra(nEntry));
+
+            if (nDistance > (size_t)(pOutNext - pOut) || nLength > (size_t)(pOutEnd - pOutNext))
+                return false;
+
+            uint8_t* pDst = pOutNext;
+            const uint8_t* pSrc = pOutNext - nDistance;
+            pOutNext += nLength;
+            if (nDistance >= 8 && pOutEnd - pOutNext >= 8)
+            {
+                // Whole words. Each one reads bytes that are already written and may spill up to 7 bytes past the match.
+                do
+                {
+                    Copy8(pDst, pSrc);
+                    pSrc += 8;
+                    pDst += 8;
+                } while (pDst < pOutNext);
+            }
+            else if (nDistance == 1)
+            {
+                memset(pDst, *pSrc, nLength);
+            }
+            else
+            {
+                while (pDst < pOutNext)
+                    *pDst++ = *pSrc++;
+            }
+        }
+    }
+
+    // Everything decoded has to have come from real input
+    if (nOverrun > nBitCount / 8)
+        return false;
+
+    return pOutNext == pOutEnd;
+}
+
+static bool InflateDefault(const uint8_t* pIn, size_t nInSize, uint8_t* pOut, size_t nOutSize)
+{
+    return InflateImpl(pIn, nInSize, pOut, nOutSize);
+}
+
+#ifdef FASTINFLATE_HAS_BMI2
+// Same decoder compiled for BMI2 so the variable shifts and masks become SHRX/BZHI
+__attribute__((target("bmi2"))) static bool InflateBMI2(const uint8_t* pIn, size_t nInSize, uint8_t* pOut, size_t nOutSize)
+{
+    return InflateImpl(pIn, nInSize, pOut, nOutSize);
+}
+
+static bool CPUHasBMI2()
+{
+    // CPUID leaf 7: EBX bit 8 = BMI2
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return false;
+    return (ebx & (1 << 8)) != 0;
+}
+#endif
+
+typedef bool (*InflateFunction)(const uint8_t* pIn, size_t nInSize, uint8_t* pOut, size_t nOutSize);
+
+static const char* gFastInflateKernelName = "default";
+
+static InflateFunction SelectInflate()
+{
+#ifdef FASTINFLATE_HAS_BMI2
+    if (CPUHasBMI2())
+    {
+        gFastInflateKernelName = "bmi2";
+        return InflateBMI2;
+    }
+#endif
+    gFastInflateKernelName = "default";
+    return InflateDefault;
+}
+
+static InflateFunction GetInflate()
+{
+    static const InflateFunction function = SelectInflate();
+    return function;
+}
+
+bool FastInflate(const uint8_t* pIn, size_t nInSize, uint8_t* pOut, size_t nOutSize)
+{
+    return GetInflate()(pIn, nInSize, pOut, nOutSize);
+}
+
+const char* FastInflateKernel()
+{
+    GetInflate();
+    return gFastInflateKernelName;
+}
@@ -0,0 +1,27 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// FastInflate
+// Purpose: Single shot raw deflate decoder for streams whose uncompressed size is known up front.
+//          Decodes straight into the destination with a 64 bit bit buffer, two level lookup tables and
+//          word at a time match copies. Anything it doesn't like makes it return false so that callers can
+//          fall back to zlib, which is the authority on what's valid and reports the error.
+// 
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Inflates the raw deflate stream pIn into exactly nOutSize bytes at pOut.
+// Returns false if the stream is malformed, ends early or doesn't produce exactly nOutSize bytes. pOut contents are then undefined.
+bool FastInflate(const uint8_t* pIn, size_t nInSize, uint8_t* pOut, size_t nOutSize);
+
+// name of the decoder variant FastInflate dispatches to
+const char* FastInflateKernel();
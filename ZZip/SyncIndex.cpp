@@ -0,0 +1,208 @@
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "SyncIndex.h"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+const char* cSyncIndex::kIndexFilename = ".zzsync";
+
+const char* kSyncIndexHeader = "ZZSYNC1";
+
+// Files modified within this long before the index was written may have been changed again within the same timestamp tick so they're re-verified
+const int64_t kRacyWindowTicks = std::chrono::duration_cast<std::filesystem::file_time_type::duration>(std::chrono::seconds(2)).count();
+
+bool cSyncIndex::StatFile(const string& sPath, uint64_t& nSize, int64_t& nModificationTime, uint64_t& nInode)
+{
+    std::error_code ec;
+    nSize = std::filesystem::file_size(sPath, ec);
+    if (ec)
+        return false;
+
+    nModificationTime = std::filesystem::last_write_time(sPath, ec).time_since_epoch().count();
+    if (ec)
+        return false;
+
+    nInode = 0;
+#ifdef _WIN32
+    HANDLE hFile = CreateFileA(sPath.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        BY_HANDLE_FILE_INFORMATION info;
+        if (GetFileInformationByHandle(hFile, &info))
+            nInode = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+        CloseHandle(hFile);
+    }
+#else
+    struct stat st;
+    if (stat(sPath.c_str(), &st) == 0)
+        nInode = (uint64_t)st.st_ino;
+#endif
+
+    return true;
+}
+
+bool cSyncIndex::Load(const string& sBaseFolder)
+{
+    std::filesystem::path indexPath(sBaseFolder);
+    indexPath.append(kIndexFilename);
+    msIndexPath = indexPath.string();
+
+    mEntries.clear();
+    mnSavedTime = 0;
+    mbDirty = false;
+
+    ifstream inFile(msIndexPath, ios::binary);
+    if (!inFile)
+        return false;
+
+    string sLine;
+    if (!getline(inFile, sLine) || sLine.compare(0, strlen(kSyncIndexHeader), kSyncIndexHeader) != 0)
+    {
+        cerr << "Ignoring unrecognized sync index \"" << msIndexPath << "\"\n";
+        return false;
+    }
+    mnSavedTime = strtoll(sLine.c_str() + strlen(kSyncIndexHeader), nullptr, 10);
+
+    // Each line: CRC \t size \t mtime \t inode \t relative path
+    while (getline(inFile, sLine))
+    {
+        const char* pLine = sLine.c_str();
+        char* pEnd = nullptr;
+
+        cEntry entry;
+        entry.mnCRC32 = (uint32_t)strtoul(pLine, &pEnd, 16);
+        if (*pEnd != '\t')
+            continue;
+        entry.mnSize = strtoull(pEnd + 1, &pEnd, 10);
+        if (*pEnd != '\t')
+            continue;
+        entry.mnModificationTime = strtoll(pEnd + 1, &pEnd, 10);
+        if (*pEnd != '\t')
+            continue;
+        entry.mnInode = strtoull(pEnd + 1, &pEnd, 10);
+        if (*pEnd != '\t' || *(pEnd + 1) == 0)
+            continue;
+
+        mEntries[string(pEnd + 1)] = entry;
+    }
+
+    return true;
+}
+
+bool cSyncIndex::Save()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mbDirty || msIndexPath.empty())
+        return true;
+
+    int64_t nNow = std::filesystem::file_time_type::clock::now().time_since_epoch().count();
+
+    // Write to a temp file and swap it in so that an interrupted save never leaves a partial index
+    string sTempPath(msIndexPath + ".tmp");
+    {
+        ofstream outFile(sTempPath, ios::binary | ios::trunc);
+        if (!outFile)
+        {
+            cerr << "Failed to write sync index \"" << sTempPath << "\"\n";
+            return false;
+        }
+
+        outFile << kSyncIndexHeader << " " << nNow << "\n";
+        for (auto& it : mEntries)
+        {
+            const cEntry& entry = it.second;
+            outFile << std::hex << entry.mnCRC32 << std::dec << "\t" << entry.mnSize << "\t" << entry.mnModificationTime << "\t" << entry.mnInode << "\t" << it.first << "\n";
+        }
+
+        if (!outFile)
+        {
+            cerr << "Failed to write sync index \"" << sTempPath << "\"\n";
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(sTempPath, msIndexPath, ec);
+    if (ec)
+    {
+        cerr << "Failed to replace sync index \"" << msIndexPath << "\". Reason: " << ec.message() << "\n";
+        std::filesystem::remove(sTempPath, ec);
+        return false;
+    }
+
+    mnSavedTime = nNow;
+    mbDirty = false;
+    return true;
+}
+
+bool cSyncIndex::Lookup(const string& sRelativePath, const string& sFullPath, uint32_t& nCRC32)
+{
+    cEntry entry;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mEntries.find(sRelativePath);
+        if (it == mEntries.end())
+            return false;
+        entry = it->second;
+    }
+
+    if (entry.mnModificationTime + kRacyWindowTicks >= mnSavedTime)
+        return false;
+
+    uint64_t nSize = 0;
+    int64_t nModificationTime = 0;
+    uint64_t nInode = 0;
+    if (!StatFile(sFullPath, nSize, nModificationTime, nInode))
+        return false;
+
+    if (nSize != entry.mnSize || nModificationTime != entry.mnModificationTime || nInode != entry.mnInode)
+        return false;
+
+    nCRC32 = entry.mnCRC32;
+    return true;
+}
+
+void cSyncIndex::Record(const string& sRelativePath, const VerifiedFileInfo& verified)
+{
+    if (!verified.mbVerified)
+        return;
+
+    cEntry entry;
+    if (!StatFile(verified.msPath, entry.mnSize, entry.mnModificationTime, entry.mnInode) ||
+        entry.mnSize != verified.mnSize || entry.mnModificationTime != verified.mnModificationTime)
+    {
+        Remove(sRelativePath);
+        return;
+    }
+    entry.mnCRC32 = verified.mnCRC32;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mEntries[sRelativePath] = entry;
+    mbDirty = true;
+}
+
+void cSyncIndex::Remove(const string& sRelativePath)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mEntries.erase(sRelativePath) > 0)
+        mbDirty = true;
+}
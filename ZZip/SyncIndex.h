@@ -0,0 +1,55 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// SyncIndex
+// Purpose: Persistent record of files that were verified against a package so that a later update can
+//          trust a file's CRC from its stat data (size, mtime, inode) instead of re-reading it.
+// 
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include "ZZipTrackers.h"
+
+class cSyncIndex
+{
+public:
+    class cEntry
+    {
+    public:
+        cEntry() : mnSize(0), mnModificationTime(0), mnInode(0), mnCRC32(0) {}
+        uint64_t            mnSize;
+        int64_t             mnModificationTime;     // std::filesystem::file_time_type ticks
+        uint64_t            mnInode;                // file id where the platform has one, otherwise 0
+        uint32_t            mnCRC32;
+    };
+
+    cSyncIndex() : mnSavedTime(0), mbDirty(false) {}
+
+    bool    Load(const std::string& sBaseFolder);       // a missing or unreadable index just starts empty
+    bool    Save();                                     // writes the index if anything was recorded since Load
+
+    bool    Lookup(const std::string& sRelativePath, const std::string& sFullPath, uint32_t& nCRC32);   // true if the file's stat data still matches its verified entry
+    void    Record(const std::string& sRelativePath, const VerifiedFileInfo& verified);              // ignored if the file changed since it was verified
+    void    Remove(const std::string& sRelativePath);
+
+    static bool StatFile(const std::string& sPath, uint64_t& nSize, int64_t& nModificationTime, uint64_t& nInode);
+
+    static const char* kIndexFilename;
+
+private:
+    std::string         msIndexPath;
+    int64_t             mnSavedTime;                // when the loaded index was written. Entries modified too close to this are "racy" and not trusted.
+    bool                mbDirty;
+    std::mutex          mMutex;
+    std::unordered_map<std::string, cEntry> mEntries;
+};
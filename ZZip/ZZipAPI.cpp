@@ -10,6 +10,7 @@
 #include "ZZipAPI.h"
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 #include "zlibAPI.h"
 #include "common/FNMatch.h"
 #include <filesystem>
@@ -18,10 +19,29 @@
 #include <chrono>
 //#include <boost/lexical_cast.hpp>
 #include "common/CrC32Fast.h"
-
+#include "common/BoundedQueue.h"
+#include "common/BufferPool.h"
+#include "common/ZZFileOutput.h"
+#include "FastInflate.h"
+#include "common/work_stealing_pool.hpp"
+#include <thread>
+#include <atomic>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/sendfile.h>
+#endif
 
 using namespace std;
 
+const uint64_t kOverlappedDecompressThreshold = 8 * 1024 * 1024;    // compressed entries at least this large read, inflate and write on separate threads
+const uint64_t kDefaultFlushPointSpacing = 8 * 1024 * 1024;         // costs one 32KB dictionary reset per 8MB
+const uint32_t kMaxSegmentThreads = 4;                              // per entry. Extraction jobs already run several entries at once.
+const uint64_t kArenaBufferedEntry = 4 * 1024 * 1024;               // arena entries up to this (compressed) are fetched whole and inflated in one shot
+const uint64_t kKernelCopyChunk = 64 * 1024 * 1024;                 // per copy_file_range/sendfile call, so progress keeps moving
+
 
 /*template <typename TP>
 std::time_t to_time_t(TP tp)
@@ -65,9 +85,20 @@ uint16_t zip_time_from_std_time(time_t& tt)
     return nSecs | nMins << 5 | nHour << 11;
 }
 
-ZZipAPI::ZZipAPI() : mnCompressionLevel(0)
+// Flags for a copy of an entry whose sizes are known up front, so it needs no data descriptor. Encrypted entries written with
+// one keep it though: their password check byte comes from the modification time rather than the CRC when bit 3 is set.
+static uint16_t CopiedEntryFlags(const cCDFileHeader& cdFileHeader)
+{
+    if (cdFileHeader.mGeneralPurposeBitFlag & kGeneralPurposeFlagEncrypted)
+        return cdFileHeader.mGeneralPurposeBitFlag;
+
+    return cdFileHeader.mGeneralPurposeBitFlag & ~kGeneralPurposeFlagDataDescriptor;
+}
+
+ZZipAPI::ZZipAPI() : mnCompressionLevel(0), mnFlushPointSpacing(kDefaultFlushPointSpacing), mnArchiveValidator(0), mnOutputFlags(0), mnModifyStartSize(0), mnModifyCDOffset(0), mbCDChanged(false)
 {
     mbInitted = false;
+    mbVerifyCRC = true;
 }
 
 ZZipAPI::~ZZipAPI()
@@ -92,18 +123,67 @@ bool ZZipAPI::Init(const string& sZipURL, eOpenType type, int32_t nCompressionLe
 
     if (mOpenType == kZipOpen)
         mbInitted = OpenForReading();
+    else if (mOpenType == kZipModify)
+        mbInitted = OpenForModify();
     else
         mbInitted = CreateZipFile();
 
+    if (mbInitted)
+        ComputeArchiveValidator();
+
     return mbInitted;
 }
 
+bool ZZipAPI::Init(shared_ptr<cZZFile> pZipFile, const string& sLabel)
+{
+    if (mbInitted)
+    {
+        cout << "ZZipAPI already open!  Cannot Reinitialize.\n";
+        return false;
+    }
+
+    mOpenType = kZipOpen;
+    msZipURL = sLabel;
+    mpZZFile = pZipFile;
+
+    if (!mpZZFile || !mZipCD.Init(*mpZZFile))
+    {
+        cerr << "Couldn't read Central Directory from \"" << msZipURL << "\"!\n";
+        mpZZFile.reset();
+        return false;
+    }
+
+    mbInitted = true;
+    ComputeArchiveValidator();
+    return true;
+}
+
+void ZZipAPI::ComputeArchiveValidator()
+{
+    // Anything that changes when the archive is rewritten. Cached entries from an older copy then never match.
+    uint64_t nValidator = std::hash<string>()(msZipURL);
+    nValidator = nValidator * 0x100000001b3ULL ^ mpZZFile->GetFileSize();
+
+    std::error_code ec;
+    auto lastWriteTime = std::filesystem::last_write_time(msZipURL, ec);
+    if (!ec)
+        nValidator = nValidator * 0x100000001b3ULL ^ (uint64_t)lastWriteTime.time_since_epoch().count();
+
+    mnArchiveValidator = nValidator;
+}
+
+cZipEntryCache::cKey ZZipAPI::GetCacheKey(const cCDFileHeader& cdFileHeader) const
+{
+    return cZipEntryCache::cKey(mnArchiveValidator, cdFileHeader.mLocalFileHeaderOffset, cdFileHeader.mUncompressedSize, cdFileHeader.mCRC32);
+}
+
 bool ZZipAPI::Shutdown()
 {
     if (mbInitted)
     {
-        // If we're creating a new archive then write out the CD
-        if (mOpenType == ZZipAPI::kZipCreate)
+        // If we're creating or modifying an archive then write out the CD. An unmodified archive's CD is already on disk.
+        bool bRestoreOriginal = false;
+        if (IsOpenForWriting() && (mOpenType != kZipModify || mbCDChanged))
         {
             std::streampos nStartOfCDOffset = mpZZFile->GetFileSize();
 
@@ -113,10 +193,23 @@ bool ZZipAPI::Shutdown()
             if (!bSuccess)
             {
                 cerr << "ZZipAPI::Shutdown - Failure to write Central Directory Headers!\n";
+                bRestoreOriginal = (mOpenType == kZipModify);
             }
         }
 
         mpZZFile->Close();
+
+        if (bRestoreOriginal)
+        {
+            // Everything appended since opening goes. What's left ends with the original CD.
+            std::error_code ec;
+            std::filesystem::resize_file(msZipURL, mnModifyStartSize, ec);
+            if (ec)
+                cerr << "Couldn't restore \"" << msZipURL << "\" to its original size " << mnModifyStartSize << ". Reason: " << ec.message() << "\n";
+            else
+                cerr << "\"" << msZipURL << "\" restored to its original contents.\n";
+        }
+
         msZipURL.clear();
 
         mbInitted = false;
@@ -144,7 +237,8 @@ bool ZZipAPI::OpenForReading()
 
 bool ZZipAPI::CreateZipFile()
 {
-    if (!cZZFile::Open(msZipURL, cZZFile::ZZFILE_WRITE, mpZZFile))
+    uint32_t nOpenMode = (mOpenType == kZipCreateStream) ? cZZFile::ZZFILE_WRITE_STREAM : cZZFile::ZZFILE_WRITE;
+    if (!cZZFile::Open(msZipURL, nOpenMode, mpZZFile))
     {
         cerr << "Couldn't open file for writing \"" << msZipURL << "\"!\n";
         return false;
@@ -153,6 +247,322 @@ bool ZZipAPI::CreateZipFile()
     return true;
 }
 
+bool ZZipAPI::OpenForModify()
+{
+    if (!std::filesystem::exists(msZipURL))
+    {
+        mOpenType = kZipCreate;     // nothing to modify so this is a new archive
+        return CreateZipFile();
+    }
+
+    if (!cZZFile::Open(msZipURL, cZZFile::ZZFILE_MODIFY, mpZZFile))
+    {
+        cerr << "Couldn't open file for modification \"" << msZipURL << "\"!\n";
+        return false;
+    }
+
+    if (!mZipCD.Init(*mpZZFile))
+    {
+        cerr << "Couldn't read Central Directory from \"" << msZipURL << "\"!\n";
+        return false;
+    }
+
+    // The trailer records are recomputed when the fresh CD is written so drop any extensible data carried over
+    delete[] mZipCD.mZip64EndOfCDRecord.mpZip64ExtensibleDataSector;
+    mZipCD.mZip64EndOfCDRecord.mpZip64ExtensibleDataSector = NULL;
+    mZipCD.mZip64EndOfCDRecord.mnDerivedSizeOfExtensibleDataSector = 0;
+
+    // New entries are appended after the old CD, which stays valid on disk until Shutdown writes the fresh one after them.
+    // A crash or failure before then leaves the original archive intact in the first mnModifyStartSize bytes. The old CD
+    // becomes waste once superseded (Compact reclaims it).
+    mnModifyStartSize = mpZZFile->GetFileSize();
+    mnModifyCDOffset = mZipCD.mbIsZip64 ? mZipCD.mZip64EndOfCDRecord.mCDStartOffset : mZipCD.mEndOfCDRecord.mCDStartOffset;
+    mbCDChanged = false;
+
+    return true;
+}
+
+uint64_t ZZipAPI::GetWastedBytes()
+{
+    if (!mbInitted || mOpenType == kZipCreateStream)     // a stream can't be read back and never has waste
+        return 0;
+
+    // Everything before the CD that isn't a live entry (local header + stream) is waste
+    const uint64_t kOffsetToFilenameLength = 26;
+
+    uint64_t nLiveBytes = 0;
+    for (tCDFileHeaderList::iterator it = mZipCD.mCDFileHeaderList.begin(); it != mZipCD.mCDFileHeaderList.end(); it++)
+    {
+        cCDFileHeader& cdFileHeader = *it;
+
+        uint16_t nLengths[2] = { 0, 0 };      // filename length, extra field length
+        uint32_t nNumRead = 0;
+        if (!mpZZFile->Read(cdFileHeader.mLocalFileHeaderOffset + kOffsetToFilenameLength, sizeof(nLengths), (uint8_t*)nLengths, nNumRead))
+            continue;
+
+        nLiveBytes += cLocalFileHeader::kStaticDataSize + nLengths[0] + nLengths[1] + cdFileHeader.mCompressedSize;
+        if (cdFileHeader.mGeneralPurposeBitFlag & kGeneralPurposeFlagDataDescriptor)
+            nLiveBytes += cZip64DataDescriptor::kStaticDataSize;
+    }
+
+    uint64_t nFileSize = mpZZFile->GetFileSize();
+    if (mOpenType == kZipModify && !mbCDChanged && mnModifyCDOffset < nFileSize)
+        nFileSize = mnModifyCDOffset;      // the CD on disk is still the live one
+    if (nLiveBytes > nFileSize)
+        return 0;
+
+    return nFileSize - nLiveBytes;
+}
+
+bool ZZipAPI::Compact()
+{
+    if (!mbInitted || mOpenType != kZipModify)
+    {
+        cout << "Compact - ZZipAPI not open for modification!\n";
+        return false;
+    }
+
+    string sCompactURL(msZipURL + ".compact");
+
+    shared_ptr<cZZFile> pCompactFile;
+    if (!cZZFile::Open(sCompactURL, cZZFile::ZZFILE_WRITE, pCompactFile))
+    {
+        cerr << "Couldn't open file for compaction \"" << sCompactURL << "\"!\n";
+        return false;
+    }
+
+    // Entries keep their relative order so any intended layout is preserved
+    mZipCD.mCDFileHeaderList.sort([](const cCDFileHeader& a, const cCDFileHeader& b) { return a.mLocalFileHeaderOffset < b.mLocalFileHeaderOffset; });
+
+    // The CD keeps pointing into the current archive until the compacted copy has replaced it
+    vector<uint64_t> newOffsets;
+    newOffsets.reserve(mZipCD.mCDFileHeaderList.size());
+
+    uint64_t nDestOffset = 0;
+    for (tCDFileHeaderList::iterator it = mZipCD.mCDFileHeaderList.begin(); it != mZipCD.mCDFileHeaderList.end(); it++)
+    {
+        uint64_t nBytesWritten = 0;
+        if (!CopyEntryRaw(*it, *pCompactFile, nDestOffset, nBytesWritten))
+        {
+            pCompactFile->Close();
+            std::filesystem::remove(sCompactURL);
+            cerr << "Compact - Failed to copy \"" << (*it).mFileName << "\". Archive left unchanged.\n";
+            return false;
+        }
+
+        newOffsets.push_back(nDestOffset);
+        nDestOffset += nBytesWritten;
+    }
+
+    // Swaps between the current and compacted offsets (and flags)
+    vector<uint16_t> otherFlags;
+    otherFlags.reserve(newOffsets.size());
+    for (tCDFileHeaderList::iterator it = mZipCD.mCDFileHeaderList.begin(); it != mZipCD.mCDFileHeaderList.end(); it++)
+        otherFlags.push_back(CopiedEntryFlags(*it));
+    auto swapOffsets = [&]()
+    {
+        size_t nIndex = 0;
+        for (tCDFileHeaderList::iterator it = mZipCD.mCDFileHeaderList.begin(); it != mZipCD.mCDFileHeaderList.end(); it++, nIndex++)
+        {
+            std::swap((*it).mLocalFileHeaderOffset, newOffsets[nIndex]);
+            std::swap((*it).mGeneralPurposeBitFlag, otherFlags[nIndex]);
+        }
+    };
+
+    // The copy gets its own CD so that it's a complete archive by the time it replaces the original
+    swapOffsets();
+    mZipCD.ComputeCDRecords(nDestOffset);
+    bool bWritten = mZipCD.Write(*pCompactFile);
+    bWritten &= pCompactFile->Close();
+    if (!bWritten)
+    {
+        swapOffsets();
+        std::filesystem::remove(sCompactURL);
+        cerr << "Compact - Failed to write the Central Directory to \"" << sCompactURL << "\". Archive left unchanged.\n";
+        return false;
+    }
+
+    mpZZFile->Close();
+
+    std::error_code ec;
+    std::filesystem::rename(sCompactURL, msZipURL, ec);
+    if (ec)
+    {
+        swapOffsets();
+        std::filesystem::remove(sCompactURL);
+        cerr << "Compact - Couldn't replace \"" << msZipURL << "\". Reason: " << ec.message() << ". Archive left unchanged.\n";
+
+        if (!cZZFile::Open(msZipURL, cZZFile::ZZFILE_MODIFY, mpZZFile))
+        {
+            cerr << "Couldn't reopen file for modification \"" << msZipURL << "\"!\n";
+            mbInitted = false;      // nothing more can be written. The archive on disk is still whole.
+        }
+        return false;
+    }
+
+    if (!cZZFile::Open(msZipURL, cZZFile::ZZFILE_MODIFY, mpZZFile))
+    {
+        cerr << "Couldn't reopen file for modification \"" << msZipURL << "\"!\n";
+        mbInitted = false;          // the compacted archive on disk is complete
+        return false;
+    }
+
+    // The compacted archive's own CD is current until something else changes
+    mnModifyStartSize = mpZZFile->GetFileSize();
+    mnModifyCDOffset = nDestOffset;
+    mbCDChanged = false;
+    return true;
+}
+
+bool ZZipAPI::CopyEntryRaw(const cCDFileHeader& cdFileHeader, cZZFile& destFile, uint64_t nDestOffset, uint64_t& nBytesWritten)
+{
+    cLocalFileHeader localFileHeader;
+
+    uint32_t nHeaderBytesProcessed = 0;
+    if (!localFileHeader.Read(*mpZZFile, cdFileHeader.mLocalFileHeaderOffset, nHeaderBytesProcessed))
+        return false;
+
+    uint64_t nSourceStreamOffset = cdFileHeader.mLocalFileHeaderOffset + nHeaderBytesProcessed;
+
+    // Sizes are known from the CD so the new local header always carries them. Everything else is kept.
+    cLocalFileHeader newLocalHeader;
+    newLocalHeader.mMinVersionToExtract = std::max<uint16_t>(localFileHeader.mMinVersionToExtract, kDefaultMinVersionToExtract);
+    newLocalHeader.mGeneralPurposeBitFlag = CopiedEntryFlags(cdFileHeader);
+    newLocalHeader.mCompressionMethod = cdFileHeader.mCompressionMethod;
+    newLocalHeader.mLastModificationTime = cdFileHeader.mLastModificationTime;
+    newLocalHeader.mLastModificationDate = cdFileHeader.mLastModificationDate;
+    newLocalHeader.mCRC32 = cdFileHeader.mCRC32;
+    newLocalHeader.mCompressedSize = cdFileHeader.mCompressedSize;
+    newLocalHeader.mUncompressedSize = cdFileHeader.mUncompressedSize;
+    newLocalHeader.mFilename = cdFileHeader.mFileName;
+    newLocalHeader.mFilenameLength = cdFileHeader.mFilenameLength;
+    newLocalHeader.mExtensibleFieldList = localFileHeader.mExtensibleFieldList;
+
+    if (!newLocalHeader.Write(destFile, nDestOffset))
+        return false;
+
+    uint64_t nDestStreamOffset = nDestOffset + newLocalHeader.Size();
+
+    const uint32_t kCopyBlockSize = 1024 * 1024;
+    cPooledBuffer buffer(kCopyBlockSize);
+    uint8_t* pBuffer = buffer.Get();
+
+    uint64_t nCopied = 0;
+    while (nCopied < cdFileHeader.mCompressedSize)
+    {
+        uint32_t nBytesToCopy = kCopyBlockSize;
+        if (nCopied + nBytesToCopy > cdFileHeader.mCompressedSize)
+            nBytesToCopy = (uint32_t)(cdFileHeader.mCompressedSize - nCopied);
+
+        uint32_t nNumRead = 0;
+        uint32_t nNumWritten = 0;
+        if (!mpZZFile->Read(nSourceStreamOffset + nCopied, nBytesToCopy, pBuffer, nNumRead) || nNumRead != nBytesToCopy ||
+            !destFile.Write(nDestStreamOffset + nCopied, nBytesToCopy, pBuffer, nNumWritten))
+        {
+            return false;
+        }
+
+        nCopied += nBytesToCopy;
+    }
+
+    nBytesWritten = newLocalHeader.Size() + cdFileHeader.mCompressedSize;
+
+    if (newLocalHeader.mGeneralPurposeBitFlag & kGeneralPurposeFlagDataDescriptor)
+    {
+        cZip64DataDescriptor dataDescriptor;
+        dataDescriptor.mCRC32 = cdFileHeader.mCRC32;
+        dataDescriptor.mCompressedSize = cdFileHeader.mCompressedSize;
+        dataDescriptor.mUncompressedSize = cdFileHeader.mUncompressedSize;
+
+        if (!dataDescriptor.Write(destFile, nDestOffset + nBytesWritten))
+            return false;
+        nBytesWritten += dataDescriptor.Size();
+    }
+
+    return true;
+}
+
+bool ZZipAPI::BeginEntry(cLocalFileHeader& localHeader, uint64_t nOffsetToLocalFileHeader)
+{
+    if (mOpenType != kZipCreateStream)
+        return true;    // header is written once the stream is done and the sizes are known
+
+    // Can't come back to fill in the CRC and sizes so they go in a data descriptor after the stream
+    localHeader.mGeneralPurposeBitFlag |= kGeneralPurposeFlagDataDescriptor;
+
+    cLocalFileHeader streamHeader(localHeader);
+    streamHeader.mCRC32 = 0;
+    streamHeader.mCompressedSize = 0;
+    streamHeader.mUncompressedSize = 0;
+
+    return streamHeader.Write(*mpZZFile, nOffsetToLocalFileHeader);
+}
+
+bool ZZipAPI::FinishEntry(cLocalFileHeader& localHeader, uint64_t nOffsetToLocalFileHeader, const tFlushPointList* pFlushPoints, const cCDFileHeader* pSourceCDHeader)
+{
+    if (mOpenType == kZipCreateStream)
+    {
+        cZip64DataDescriptor dataDescriptor;
+        dataDescriptor.mCRC32 = localHeader.mCRC32;
+        dataDescriptor.mCompressedSize = localHeader.mCompressedSize;
+        dataDescriptor.mUncompressedSize = localHeader.mUncompressedSize;
+
+        if (!dataDescriptor.Write(*mpZZFile))
+            return false;
+    }
+    else
+    {
+        // Only copied encrypted entries keep a data descriptor outside of streaming (see CopiedEntryFlags)
+        if (localHeader.mGeneralPurposeBitFlag & kGeneralPurposeFlagDataDescriptor)
+        {
+            cZip64DataDescriptor dataDescriptor;
+            dataDescriptor.mCRC32 = localHeader.mCRC32;
+            dataDescriptor.mCompressedSize = localHeader.mCompressedSize;
+            dataDescriptor.mUncompressedSize = localHeader.mUncompressedSize;
+
+            if (!dataDescriptor.Write(*mpZZFile, nOffsetToLocalFileHeader + localHeader.Size() + localHeader.mCompressedSize))
+                return false;
+        }
+
+        if (!localHeader.Write(*mpZZFile, nOffsetToLocalFileHeader))     // seek back to ahead of the compression stream data
+            return false;
+    }
+
+    AddCDEntry(localHeader, nOffsetToLocalFileHeader, pFlushPoints, pSourceCDHeader);
+    return true;
+}
+
+void ZZipAPI::AddCDEntry(const cLocalFileHeader& localHeader, uint64_t nOffsetToLocalFileHeader, const tFlushPointList* pFlushPoints, const cCDFileHeader* pSourceCDHeader)
+{
+    // When modifying, a new entry supersedes any existing one of the same name. Its old data stays in place as waste until compacted.
+    if (mOpenType == kZipModify)
+        mZipCD.mCDFileHeaderList.remove_if([&](const cCDFileHeader& existing) { return existing.mFileName == localHeader.mFilename; });
+    mbCDChanged = true;
+
+    // A copied entry keeps the source's version made by, attributes, extra fields and comment
+    cCDFileHeader newCDFileHeader;
+    if (pSourceCDHeader)
+    {
+        newCDFileHeader = *pSourceCDHeader;
+        newCDFileHeader.mDiskNumFileStart = 0;
+    }
+    newCDFileHeader.mMinVersionToExtract = localHeader.mMinVersionToExtract;
+    newCDFileHeader.mGeneralPurposeBitFlag = localHeader.mGeneralPurposeBitFlag;
+    newCDFileHeader.mLastModificationTime = localHeader.mLastModificationTime;
+    newCDFileHeader.mLastModificationDate = localHeader.mLastModificationDate;
+    newCDFileHeader.mCRC32 = localHeader.mCRC32;
+    newCDFileHeader.mCompressionMethod = localHeader.mCompressionMethod;
+    newCDFileHeader.mCompressedSize = localHeader.mCompressedSize;
+    newCDFileHeader.mUncompressedSize = localHeader.mUncompressedSize;
+    newCDFileHeader.mLocalFileHeaderOffset = nOffsetToLocalFileHeader;
+    newCDFileHeader.mFileName = localHeader.mFilename;
+    newCDFileHeader.mFilenameLength = localHeader.mFilenameLength;
+    if (pFlushPoints)
+        newCDFileHeader.SetFlushPoints(*pFlushPoints);
+
+    mZipCD.mCDFileHeaderList.push_back(newCDFileHeader);
+}
+
 
 void ZZipAPI::DumpReport(const string& sOutputFilename)
 {
@@ -217,6 +627,99 @@ void ZZipAPI::DumpReport(const string& sOutputFilename)
 
 
 
+bool ZZipAPI::DecompressToArena(const string& sPattern, cZipArena& arena, Progress* pProgress)
+{
+    if (!mbInitted)
+        return false;
+
+    // Lay out a slice for every matching file
+    vector<pair<const cCDFileHeader*, uint64_t> > entries;     // header, offset of its slice
+    uint64_t nArenaSize = 0;
+    for (const cCDFileHeader& cdFileHeader : mZipCD.mCDFileHeaderList)
+    {
+        if (cdFileHeader.mFileName.empty() || cdFileHeader.mFileName[cdFileHeader.mFileName.length() - 1] == '/' || !FNMatch(sPattern, cdFileHeader.mFileName))
+            continue;
+
+        entries.push_back(make_pair(&cdFileHeader, nArenaSize));
+        nArenaSize += (cdFileHeader.mUncompressedSize + cZipArena::kSliceAlignment - 1) & ~(cZipArena::kSliceAlignment - 1);
+    }
+
+    uint8_t* pArena = arena.Allocate(nArenaSize);
+
+    // Largest first so that a big entry doesn't start last and hold everything up
+    std::sort(entries.begin(), entries.end(), [](const pair<const cCDFileHeader*, uint64_t>& a, const pair<const cCDFileHeader*, uint64_t>& b) { return a.first->mCompressedSize > b.first->mCompressedSize; });
+
+    vector<uint8_t> succeeded(entries.size(), 0);
+    WorkStealingPool pool(std::thread::hardware_concurrency());
+    pool.parallel_for(entries.size(), 1, [&](size_t nIndex)
+    {
+        const cCDFileHeader& cdFileHeader = *entries[nIndex].first;
+        uint8_t* pSlice = pArena + entries[nIndex].second;
+
+        if (cdFileHeader.mUncompressedSize == 0)
+        {
+            succeeded[nIndex] = true;
+            return;
+        }
+
+        uint32_t nCRC = 0;
+        if (cdFileHeader.mCompressionMethod == 0)
+        {
+            // stored data is read straight into its slice
+            if (!ExtractRawStreamToBuffer(cdFileHeader, pSlice))
+                return;
+            if (mbVerifyCRC)
+                nCRC = crc32_fast(pSlice, (size_t)cdFileHeader.mUncompressedSize, 0);
+            if (pProgress)
+                pProgress->AddBytesProcessed(cdFileHeader.mUncompressedSize);
+        }
+        else if (cdFileHeader.mCompressedSize <= kArenaBufferedEntry)
+        {
+            cPooledBuffer stream((size_t)cdFileHeader.mCompressedSize);
+            if (!ExtractRawStreamToBuffer(cdFileHeader, stream.Get()) || !InflateRawStream(cdFileHeader, stream.Get(), pSlice, &nCRC, pProgress))
+                return;
+        }
+        else
+        {
+            // big entries stream through a bounded buffer rather than holding the whole compressed stream
+            uint64_t nOffset = 0;
+            succeeded[nIndex] = DecompressToSink(cdFileHeader, [&](const uint8_t* pData, size_t nBytes)
+            {
+                if (nOffset + nBytes > cdFileHeader.mUncompressedSize)
+                    return false;
+                memcpy(pSlice + nOffset, pData, nBytes);
+                nOffset += nBytes;
+                return true;
+            }, pProgress);
+            return;
+        }
+
+        if (mbVerifyCRC && nCRC != cdFileHeader.mCRC32)
+        {
+            cerr << "CRC mismatch extracting \"" << cdFileHeader.mFileName.c_str() << "\". Expected:" << int_to_hex_string(cdFileHeader.mCRC32) << " Got:" << int_to_hex_string(nCRC) << "\n";
+            return;
+        }
+
+        succeeded[nIndex] = true;
+    });
+
+    bool bAllSucceeded = true;
+    for (size_t nIndex = 0; nIndex < entries.size(); nIndex++)
+    {
+        const cCDFileHeader& cdFileHeader = *entries[nIndex].first;
+        if (!succeeded[nIndex])
+        {
+            cerr << "Failed to decompress \"" << cdFileHeader.mFileName.c_str() << "\" into the arena.\n";
+            bAllSucceeded = false;
+            continue;
+        }
+
+        arena.mSlices[cdFileHeader.mFileName] = cZipArena::cSlice(pArena + entries[nIndex].second, cdFileHeader.mUncompressedSize);
+    }
+
+    return bAllSucceeded;
+}
+
 bool ZZipAPI::ExtractRawStream(const string& sFilename, const string& sOutputFilename, Progress* pProgress)
 {
     if (!mbInitted)
@@ -235,41 +738,233 @@ bool ZZipAPI::ExtractRawStream(const string& sFilename, const string& sOutputFil
         return false;
     }
 
-    const uint32_t kSize = 16*1024 * 1024;  
-    uint8_t* pStream = new uint8_t[kSize];
+    return CopyStreamToFile(cdFileHeader, cdFileHeader.mLocalFileHeaderOffset + nHeaderBytesProcessed, sOutputFilename, pProgress, nullptr);
+}
+
+bool ZZipAPI::GetStreamOffset(const cCDFileHeader& cdFileHeader, uint64_t& nStreamOffset)
+{
+    cLocalFileHeader localFileHeader;
+
+    uint32_t nHeaderBytesProcessed = 0;
+    if (!localFileHeader.Read(*mpZZFile, cdFileHeader.mLocalFileHeaderOffset, nHeaderBytesProcessed))
+    {
+        cerr << "Failed to read localFileHeader.\n";
+        return false;
+    }
+
+    nStreamOffset = cdFileHeader.mLocalFileHeaderOffset + nHeaderBytesProcessed;
+    return true;
+}
+
+bool ZZipAPI::SameRawStream(const cCDFileHeader& cdFileHeaderA, const cCDFileHeader& cdFileHeaderB)
+{
+    if (!mbInitted || cdFileHeaderA.mCompressionMethod != cdFileHeaderB.mCompressionMethod || cdFileHeaderA.mCompressedSize != cdFileHeaderB.mCompressedSize)
+        return false;
+
+    uint64_t nStreamOffsetA = 0;
+    uint64_t nStreamOffsetB = 0;
+    if (!GetStreamOffset(cdFileHeaderA, nStreamOffsetA) || !GetStreamOffset(cdFileHeaderB, nStreamOffsetB))
+        return false;
+
+    if (nStreamOffsetA == nStreamOffsetB)
+        return true;
+
+    const uint64_t kCompareBlockSize = 1024 * 1024;
+    cPooledBuffer bufferA((size_t)std::min<uint64_t>(kCompareBlockSize, cdFileHeaderA.mCompressedSize));
+    cPooledBuffer bufferB((size_t)std::min<uint64_t>(kCompareBlockSize, cdFileHeaderA.mCompressedSize));
+
+    uint64_t nCompared = 0;
+    while (nCompared < cdFileHeaderA.mCompressedSize)
+    {
+        uint32_t nBytesToCompare = (uint32_t)std::min<uint64_t>(kCompareBlockSize, cdFileHeaderA.mCompressedSize - nCompared);
+        uint32_t nBytesReadA = 0;
+        uint32_t nBytesReadB = 0;
+        if (!mpZZFile->Read(nStreamOffsetA + nCompared, nBytesToCompare, bufferA.Get(), nBytesReadA) || nBytesReadA != nBytesToCompare ||
+            !mpZZFile->Read(nStreamOffsetB + nCompared, nBytesToCompare, bufferB.Get(), nBytesReadB) || nBytesReadB != nBytesToCompare)
+            return false;
+
+        if (memcmp(bufferA.Get(), bufferB.Get(), nBytesToCompare) != 0)
+            return false;
+
+        nCompared += nBytesToCompare;
+    }
+
+    return true;
+}
+
+bool ZZipAPI::OpenEntryStream(const string& sFilename, cZipEntryStream& entryStream, uint64_t nCheckpointSpacing)
+{
+    if (!mbInitted)
+        return false;
+
+    cCDFileHeader cdFileHeader;
+    if (!mZipCD.GetFileHeader(sFilename, cdFileHeader))
+        return false;
+
+    return entryStream.Open(mpZZFile, cdFileHeader, nCheckpointSpacing);
+}
+
+bool ZZipAPI::OpenEntryAsFile(const string& sFilename, shared_ptr<cZZFile>& pFile)
+{
+    if (!mbInitted)
+        return false;
+
+    cCDFileHeader cdFileHeader;
+    if (!mZipCD.GetFileHeader(sFilename, cdFileHeader))
+        return false;
+
+    return cZipEntryFile::Open(mpZZFile, cdFileHeader, pFile);
+}
+
+// Copies nBytes at nOffset of sSourcePath to a new sDestPath without the data passing through user space.
+// copy_file_range first (server side copies and reflinks where the filesystem supports them), then sendfile.
+// pCRC (if given) receives the CRC of what landed in sDestPath, read back a chunk at a time while it's still in the page cache.
+// nBytesCopied tells a caller whose copy failed whether anything made it across. On failure errno says why.
+static bool KernelCopyToFile(const string& sSourcePath, uint64_t nOffset, uint64_t nBytes, const string& sDestPath, Progress* pProgress, uint64_t& nBytesCopied, uint32_t* pCRC)
+{
+    nBytesCopied = 0;
+#ifdef __linux__
+    int nInFD = open(sSourcePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (nInFD < 0)
+        return false;
+
+    int nOutFD = open(sDestPath.c_str(), (pCRC ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (nOutFD < 0)
+    {
+        int nError = errno;
+        close(nInFD);
+        errno = nError;
+        return false;
+    }
+
+    const size_t kCRCBlockSize = 1024 * 1024;
+    cPooledBuffer crcBuffer;
+    if (pCRC)
+        crcBuffer.Acquire(kCRCBlockSize);
+    uint32_t nCRC = 0;
+
+    int nError = 0;
+    bool bCopyFileRange = true;
+    loff_t nInOffset = (loff_t)nOffset;
+    while (nBytesCopied < nBytes)
+    {
+        size_t nChunk = (size_t)std::min<uint64_t>(kKernelCopyChunk, nBytes - nBytesCopied);
+        ssize_t nCopied = -1;
+        if (bCopyFileRange)
+        {
+            nCopied = copy_file_range(nInFD, &nInOffset, nOutFD, nullptr, nChunk, 0);
+            if (nCopied < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+            {
+                bCopyFileRange = false;     // not on this kernel or between these filesystems. sendfile picks up where it left off.
+                continue;
+            }
+        }
+        else
+        {
+            off_t nSendOffset = (off_t)nInOffset;
+            nCopied = sendfile(nOutFD, nInFD, &nSendOffset, nChunk);
+            nInOffset = (loff_t)nSendOffset;
+        }
+
+        if (nCopied <= 0)
+        {
+            nError = (nCopied == 0) ? EIO : errno;     // 0 means the archive ended early
+            break;
+        }
+
+        for (uint64_t nRead = 0; pCRC && nRead < (uint64_t)nCopied; )
+        {
+            ssize_t nBytesRead = pread(nOutFD, crcBuffer.Get(), (size_t)std::min<uint64_t>(kCRCBlockSize, (uint64_t)nCopied - nRead), (off_t)(nBytesCopied + nRead));
+            if (nBytesRead <= 0)
+            {
+                nError = (nBytesRead == 0) ? EIO : errno;
+                break;
+            }
+            nCRC = crc32_fast(crcBuffer.Get(), (size_t)nBytesRead, nCRC);
+            nRead += (uint64_t)nBytesRead;
+        }
+        if (nError != 0)
+            break;
+
+        nBytesCopied += (uint64_t)nCopied;
+        if (pProgress)
+            pProgress->AddBytesProcessed((uint64_t)nCopied);
+    }
+
+    close(nInFD);
+    if (close(nOutFD) != 0 && nError == 0)
+        nError = errno;
+
+    if (nError != 0 || nBytesCopied != nBytes)
+    {
+        errno = nError;
+        return false;
+    }
+
+    if (pCRC)
+        *pCRC = nCRC;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool ZZipAPI::CopyStreamToFile(const cCDFileHeader& cdFileHeader, uint64_t nStreamOffset, const string& sOutputFilename, Progress* pProgress, uint32_t* pCRC)
+{
+    // A local archive's stream is copied by the kernel. The CRC (if wanted) is taken from the copy while it's still cached.
+    // Archives open for writing may still have entries sitting in the stream's buffer so those take the buffered path.
+    // So does sparse output, which needs to see the zeros to skip them.
+    cZZFileLocal* pLocalFile = dynamic_cast<cZZFileLocal*>(mpZZFile.get());
+    if (pLocalFile && mOpenType == kZipOpen && !(mnOutputFlags & cZZFileOutput::kOutputSparse))
+    {
+        uint64_t nBytesCopied = 0;
+        if (KernelCopyToFile(pLocalFile->GetPath(), nStreamOffset, cdFileHeader.mCompressedSize, sOutputFilename, pProgress, nBytesCopied, pCRC))
+            return true;
+
+        if (nBytesCopied > 0)
+        {
+            cerr << "Failed to copy stream for file " << cdFileHeader.mFileName.c_str() << " to file " << sOutputFilename.c_str() << " after " << nBytesCopied << " bytes. Reason: " << errno << "\n";
+            return false;
+        }
+    }
+
+    const uint32_t kSize = 4*1024 * 1024;     // stays within what the extraction job budgets for a streamed entry
+    cPooledBuffer stream((size_t)std::min<uint64_t>(kSize, cdFileHeader.mCompressedSize));     // small files don't need the full block
+    uint8_t* pStream = stream.Get();
+    uint64_t nBlockSize = std::min<uint64_t>(kSize, stream.Size());
 
     shared_ptr<cZZFile> pOutFile;
-    if (!cZZFile::Open(sOutputFilename, cZZFile::ZZFILE_WRITE, pOutFile))
+    if (!cZZFileOutput::Open(sOutputFilename, cdFileHeader.mCompressedSize, pOutFile, mnOutputFlags))
     {
-        delete[] pStream;
         cout << "Failed to open " << sOutputFilename.c_str() << " for extraction. Reason: " << pOutFile->GetLastError() << "\n";
         return false;
     }
 
+    uint32_t nCRC = 0;
     uint64_t nBytesProcessed = 0;
     while (nBytesProcessed < cdFileHeader.mCompressedSize)
     {
-        uint64_t nReadOffset = cdFileHeader.mLocalFileHeaderOffset + nHeaderBytesProcessed + nBytesProcessed;
+        uint64_t nReadOffset = nStreamOffset + nBytesProcessed;
 
         // Either grab another full block of compressed data or adjust down to the remainder of the compressed stream
-        uint64_t nBytesToProcess = kSize;
+        uint64_t nBytesToProcess = nBlockSize;
         if (nBytesProcessed + nBytesToProcess > cdFileHeader.mCompressedSize)
             nBytesToProcess = cdFileHeader.mCompressedSize - nBytesProcessed;
 
-
         uint32_t nBytesRead = 0;
         if (!mpZZFile->Read(nReadOffset, (uint32_t)nBytesToProcess, pStream, nBytesRead))
         {
-            delete[] pStream;
-            cerr << "Failed to read stream for file " << sFilename.c_str() << " at offset " << cdFileHeader.mLocalFileHeaderOffset + nHeaderBytesProcessed + nBytesProcessed << ". Tried to read " << nBytesToProcess << " bytes. Total compressed stream size: " << cdFileHeader.mCompressedSize << "\n";
+            cerr << "Failed to read stream for file " << cdFileHeader.mFileName.c_str() << " at offset " << nReadOffset << ". Tried to read " << nBytesToProcess << " bytes. Total compressed stream size: " << cdFileHeader.mCompressedSize << "\n";
             return false;
         }
 
+        if (pCRC)
+            nCRC = crc32_fast(pStream, (size_t)nBytesToProcess, nCRC);
+
         uint32_t nBytesWritten = 0;
         if (!pOutFile->Write(cZZFile::ZZFILE_NO_SEEK, (uint32_t) nBytesToProcess, pStream, nBytesWritten))
         {
-            delete[] pStream;
-            cerr << "Failed to seek to write stream for file " << sFilename.c_str() << " to file " << sOutputFilename.c_str() << ".  Reason: " << errno << "\n";
+            cerr << "Failed to seek to write stream for file " << cdFileHeader.mFileName.c_str() << " to file " << sOutputFilename.c_str() << ".  Reason: " << errno << "\n";
             return false;
         }
 
@@ -278,14 +973,59 @@ bool ZZipAPI::ExtractRawStream(const string& sFilename, const string& sOutputFil
             pProgress->AddBytesProcessed(nBytesToProcess);
     }
 
-    delete[] pStream;
+    if (!pOutFile->Close())
+    {
+        cerr << "Failed to finish writing " << sOutputFilename.c_str() << ".  Reason: " << pOutFile->GetLastError() << "\n";
+        return false;
+    }
+
+    if (pCRC)
+        *pCRC = nCRC;
 
     //cout << "Extracted \"" << sFilename.c_str() << "\" to \"" << sOutputFilename.c_str() << "\"\n";
 
     return true;
 }
 
-bool ZZipAPI::DecompressToFile(const string& sFilename, const string& sOutputFilename, Progress* pProgress)
+bool ZZipAPI::FinishVerifiedFile(const cCDFileHeader& cdFileHeader, const string& sOutputFilename, uint32_t nCRC, VerifiedFileInfo* pVerified)
+{
+    if (mbVerifyCRC && nCRC != cdFileHeader.mCRC32)
+    {
+        cerr << "CRC mismatch extracting \"" << cdFileHeader.mFileName.c_str() << "\". Expected:" << int_to_hex_string(cdFileHeader.mCRC32) << " Got:" << int_to_hex_string(nCRC) << "\n";
+
+        std::error_code ec;
+        std::filesystem::remove(sOutputFilename, ec);     // don't leave corrupt output looking like a finished file
+        return false;
+    }
+
+    if (pVerified)
+    {
+        std::error_code ec;
+        pVerified->msPath = sOutputFilename;
+        pVerified->mnSize = cdFileHeader.mUncompressedSize;
+        pVerified->mnModificationTime = std::filesystem::last_write_time(sOutputFilename, ec).time_since_epoch().count();
+        pVerified->mnCRC32 = cdFileHeader.mCRC32;
+        pVerified->mbVerified = mbVerifyCRC && !ec;
+    }
+
+    return true;
+}
+
+bool ZZipAPI::FinishOutputFile(cZZFile& outFile, const cCDFileHeader& cdFileHeader, const string& sOutputFilename, uint32_t nCRC, VerifiedFileInfo* pVerified)
+{
+    // Output is buffered so the last of it only reaches the file here
+    if (!outFile.Close())
+    {
+        cerr << "Failed to finish writing " << sOutputFilename.c_str() << ".  Reason: " << outFile.GetLastError() << "\n";
+        std::error_code ec;
+        std::filesystem::remove(sOutputFilename, ec);
+        return false;
+    }
+
+    return FinishVerifiedFile(cdFileHeader, sOutputFilename, nCRC, pVerified);
+}
+
+bool ZZipAPI::DecompressToFile(const string& sFilename, const string& sOutputFilename, Progress* pProgress, VerifiedFileInfo* pVerified)
 {
     if (!mbInitted)
         return false;
@@ -306,7 +1046,11 @@ bool ZZipAPI::DecompressToFile(const string& sFilename, const string& sOutputFil
     // If the file is uncompressed just extract it
     if (localFileHeader.mCompressionMethod == 0)
     {
-        return ExtractRawStream(sFilename, sOutputFilename);
+        uint32_t nCRC = 0;
+        if (!CopyStreamToFile(cdFileHeader, cdFileHeader.mLocalFileHeaderOffset + nHeaderBytesProcessed, sOutputFilename, pProgress, mbVerifyCRC ? &nCRC : nullptr))
+            return false;
+
+        return FinishVerifiedFile(cdFileHeader, sOutputFilename, nCRC, pVerified);
     }
     else if (localFileHeader.mCompressionMethod != 8)
     {
@@ -314,22 +1058,50 @@ bool ZZipAPI::DecompressToFile(const string& sFilename, const string& sOutputFil
         return false;
     }
 
-    const uint32_t kCompressStreamProcessSize = 1024 * 1024;  // one meg at a time
-
-    uint8_t* pCompStream = new uint8_t[kCompressStreamProcessSize];
-
-    ZDecompressor decompressor;
-    decompressor.Init();
-
     shared_ptr<cZZFile> pOutFile;
-    if (!cZZFile::Open(sOutputFilename, cZZFile::ZZFILE_WRITE, pOutFile))
+    if (!cZZFileOutput::Open(sOutputFilename, cdFileHeader.mUncompressedSize, pOutFile, mnOutputFlags))
     {
-        delete[] pCompStream;
         cout << "Failed to open " << sOutputFilename.c_str() << " for extraction. Reason: " << errno << "\n";
         return false;
     }
 
+    // Entries written with flush points inflate their segments in parallel
+    tFlushPointList flushPoints;
+    if (cdFileHeader.GetFlushPoints(flushPoints))
+    {
+        uint32_t nCRC = 0;
+        if (DecompressSegments(cdFileHeader, cdFileHeader.mLocalFileHeaderOffset + nHeaderBytesProcessed, flushPoints, *pOutFile, pProgress, nCRC))
+            return FinishOutputFile(*pOutFile, cdFileHeader, sOutputFilename, nCRC, pVerified);
+
+        // The field may not describe this stream (a tool that rewrote the stream but kept the field). Start over the normal way.
+        cerr << "Flush points for \"" << sFilename << "\" don't match its stream. Inflating sequentially.\n";
+        pOutFile->Close();
+        if (!cZZFileOutput::Open(sOutputFilename, cdFileHeader.mUncompressedSize, pOutFile, mnOutputFlags))
+        {
+            cout << "Failed to open " << sOutputFilename.c_str() << " for extraction. Reason: " << errno << "\n";
+            return false;
+        }
+    }
+
+    // Large entries overlap reading, inflating and writing on separate threads
+    if (cdFileHeader.mCompressedSize >= kOverlappedDecompressThreshold)
+    {
+        uint32_t nCRC = 0;
+        if (!DecompressStreamOverlapped(cdFileHeader, cdFileHeader.mLocalFileHeaderOffset + nHeaderBytesProcessed, *pOutFile, pProgress, nCRC))
+            return false;
+
+        return FinishOutputFile(*pOutFile, cdFileHeader, sOutputFilename, nCRC, pVerified);
+    }
+
+    const uint32_t kCompressStreamProcessSize = 1024 * 1024;  // one meg at a time
 
+    cPooledBuffer compStream(kCompressStreamProcessSize);
+    uint8_t* pCompStream = compStream.Get();
+
+    ZDecompressorPtr pDecompressor = cZCodecPool::AcquireDecompressor();
+    ZDecompressor& decompressor = *pDecompressor;
+
+    uint32_t nCRC = 0;
     uint64_t nCompressedBytesProcessed = 0;
     while (nCompressedBytesProcessed < cdFileHeader.mCompressedSize)
     {
@@ -344,7 +1116,6 @@ bool ZZipAPI::DecompressToFile(const string& sFilename, const string& sOutputFil
 
         if (!mpZZFile->Read(nReadOffset, (uint32_t)nBytesToProcess, pCompStream, nBytesRead))
         {
-            delete[] pCompStream;
             cerr << "Failed to read compression stream for file " << sFilename.c_str() << " at offset " << cdFileHeader.mLocalFileHeaderOffset + nHeaderBytesProcessed + nCompressedBytesProcessed << ". Tried to read " << nBytesToProcess << " bytes. Total compressed stream size: " << cdFileHeader.mCompressedSize << "\n";
             return false;
         }
@@ -358,10 +1129,14 @@ bool ZZipAPI::DecompressToFile(const string& sFilename, const string& sOutputFil
             {
                 nStatus = decompressor.Decompress();
                 uint32_t nDecompressedBytes = (uint32_t)decompressor.GetDecompressedBytes();
+
+                // CRC while the output is still in cache
+                if (mbVerifyCRC)
+                    nCRC = crc32_fast(decompressor.GetDecompressedBuffer(), nDecompressedBytes, nCRC);
+
                 uint32_t nBytesWritten = 0;
                 if (!pOutFile->Write(cZZFile::ZZFILE_NO_SEEK, (uint32_t) decompressor.GetDecompressedBytes(), decompressor.GetDecompressedBuffer(), nBytesWritten))
                 {
-                    delete[] pCompStream;
                     cerr << "Failed to seek to write decompressed stream for file " << sFilename.c_str() << " to file " << sOutputFilename.c_str() << ".  Reason: " << pOutFile->GetLastError() << "\n";
                     return false;
                 }
@@ -372,26 +1147,295 @@ bool ZZipAPI::DecompressToFile(const string& sFilename, const string& sOutputFil
                     pProgress->AddBytesProcessed(nDecompressedBytes);
             }
 
-            if (nStatus < 0)
+            if (nStatus < 0)
+            {
+                break;
+            }
+        }
+
+        if (!(nStatus == Z_STREAM_END || nStatus == Z_OK))
+        {
+            cerr << "Decompress Error #:" << to_string(nStatus) << "\n";
+            return false;
+        }
+
+        nCompressedBytesProcessed += nBytesToProcess;
+    }
+
+    //cout << "thread: " << this_thread::get_id() << " Extracted \"" << sFilename.c_str() << "\" to \"" << sOutputFilename.c_str() << "\"\n";
+
+    return FinishOutputFile(*pOutFile, cdFileHeader, sOutputFilename, nCRC, pVerified);
+}
+
+bool ZZipAPI::DecompressSegments(const cCDFileHeader& cdFileHeader, uint64_t nStreamOffset, const tFlushPointList& flushPoints, cZZFile& outFile, Progress* pProgress, uint32_t& nCRC)
+{
+    // Segment i runs from flush point i-1 (or the top of the stream) to flush point i (or the end). Each starts with an empty dictionary.
+    tFlushPointList bounds;
+    bounds.reserve(flushPoints.size() + 2);
+    bounds.push_back(cFlushPoint(0, 0));
+    bounds.insert(bounds.end(), flushPoints.begin(), flushPoints.end());
+    bounds.push_back(cFlushPoint(cdFileHeader.mUncompressedSize, cdFileHeader.mCompressedSize));
+    size_t nSegments = bounds.size() - 1;
+
+    vector<uint32_t> segmentCRCs(nSegments, 0);
+    atomic<size_t> nNextSegment(0);
+    atomic<bool> bFailed(false);
+    atomic<uint64_t> nBytesReported(0);     // taken back from pProgress on failure since the caller then inflates the whole entry again
+
+    auto inflateSegments = [&]()
+    {
+        const uint32_t kReadSize = 1024 * 1024;
+        cPooledBuffer input(kReadSize);
+        ZDecompressorPtr pDecompressor = cZCodecPool::AcquireDecompressor();
+        ZDecompressor& decompressor = *pDecompressor;
+
+        for (size_t nSegment = nNextSegment++; nSegment < nSegments && !bFailed; nSegment = nNextSegment++)
+        {
+            const cFlushPoint& start = bounds[nSegment];
+            const cFlushPoint& end = bounds[nSegment + 1];
+            bool bLastSegment = (nSegment == nSegments - 1);
+
+            decompressor.Init();
+            uint64_t nCompressedOffset = start.mnCompressedOffset;
+            uint64_t nOutputOffset = start.mnUncompressedOffset;
+            uint32_t nSegmentCRC = 0;
+            int32_t nStatus = Z_OK;
+
+            while (nCompressedOffset < end.mnCompressedOffset && nStatus != Z_STREAM_END && !bFailed)
+            {
+                uint32_t nBytesToRead = (uint32_t)std::min<uint64_t>(kReadSize, end.mnCompressedOffset - nCompressedOffset);
+                uint32_t nBytesRead = 0;
+                if (!mpZZFile->Read(nStreamOffset + nCompressedOffset, nBytesToRead, input.Get(), nBytesRead) || nBytesRead != nBytesToRead)
+                {
+                    cerr << "Failed to read compression stream for file " << cdFileHeader.mFileName << " at offset " << nStreamOffset + nCompressedOffset << "\n";
+                    bFailed = true;
+                    return;
+                }
+
+                decompressor.InitStream(input.Get(), (int32_t)nBytesToRead);
+                while (decompressor.HasMoreOutput())
+                {
+                    nStatus = decompressor.Decompress();
+                    if (nStatus < 0)
+                        break;
+
+                    uint32_t nDecompressedBytes = (uint32_t)decompressor.GetDecompressedBytes();
+                    if (nOutputOffset + nDecompressedBytes > end.mnUncompressedOffset)
+                    {
+                        bFailed = true;     // segment overruns its flush point
+                        return;
+                    }
+
+                    if (mbVerifyCRC)
+                        nSegmentCRC = crc32_fast(decompressor.GetDecompressedBuffer(), nDecompressedBytes, nSegmentCRC);
+
+                    uint32_t nBytesWritten = 0;
+                    if (nDecompressedBytes > 0 && !outFile.Write(nOutputOffset, nDecompressedBytes, decompressor.GetDecompressedBuffer(), nBytesWritten))
+                    {
+                        cerr << "Failed to write decompressed stream for file " << cdFileHeader.mFileName << ".  Reason: " << outFile.GetLastError() << "\n";
+                        bFailed = true;
+                        return;
+                    }
+
+                    nOutputOffset += nDecompressedBytes;
+                    if (pProgress)
+                    {
+                        pProgress->AddBytesProcessed(nDecompressedBytes);
+                        nBytesReported += nDecompressedBytes;
+                    }
+
+                    if (nStatus == Z_STREAM_END)
+                        break;
+                }
+
+                if (nStatus < 0)
+                {
+                    bFailed = true;
+                    return;
+                }
+
+                nCompressedOffset += nBytesToRead;
+            }
+
+            // only the last segment ends the deflate stream
+            if (nOutputOffset != end.mnUncompressedOffset || nCompressedOffset != end.mnCompressedOffset || (nStatus == Z_STREAM_END) != bLastSegment)
+            {
+                bFailed = true;
+                return;
+            }
+
+            segmentCRCs[nSegment] = nSegmentCRC;
+        }
+    };
+
+    size_t nThreads = std::min<size_t>(std::min<size_t>(kMaxSegmentThreads, std::thread::hardware_concurrency()), nSegments);
+    vector<thread> helpers;
+    for (size_t i = 1; i < nThreads; i++)
+        helpers.emplace_back(inflateSegments);
+    inflateSegments();
+    for (auto& helper : helpers)
+        helper.join();
+
+    if (bFailed)
+    {
+        if (pProgress)
+            pProgress->RemoveBytesProcessed(nBytesReported);
+        return false;
+    }
+
+    nCRC = segmentCRCs[0];
+    for (size_t nSegment = 1; nSegment < nSegments; nSegment++)
+        nCRC = (uint32_t)crc32_combine(nCRC, segmentCRCs[nSegment], (z_off_t)(bounds[nSegment + 1].mnUncompressedOffset - bounds[nSegment].mnUncompressedOffset));
+
+    return true;
+}
+
+// One buffer of a read-ahead or write-behind ring
+class cIOBlock
+{
+public:
+    cIOBlock() : mnSize(0) {}
+    cPooledBuffer   mBuffer;
+    uint32_t        mnSize;
+};
+
+bool ZZipAPI::DecompressStreamOverlapped(const cCDFileHeader& cdFileHeader, uint64_t nStreamOffset, cZZFile& outFile, Progress* pProgress, uint32_t& nCRC)
+{
+    // A reader thread keeps kInputBlocks of compressed data ahead of the inflater (this thread) and a writer thread
+    // drains a ring of kOutputBlocks of inflated data. Buffers circulate between "free" and "full" queues so nothing
+    // is allocated per block and each side blocks only when the other falls behind.
+    const uint32_t kInputBlockSize = 1024 * 1024;
+    const uint32_t kOutputBlockSize = 1024 * 1024;
+    const size_t kInputBlocks = 2;
+    const size_t kOutputBlocks = 4;
+
+    cBoundedQueue<cIOBlock> freeInput(kInputBlocks);
+    cBoundedQueue<cIOBlock> fullInput(kInputBlocks);
+    cBoundedQueue<cIOBlock> freeOutput(kOutputBlocks);
+    cBoundedQueue<cIOBlock> fullOutput(kOutputBlocks);
+    for (size_t i = 0; i < kInputBlocks; i++)
+    {
+        cIOBlock block;
+        block.mBuffer.Acquire(kInputBlockSize);
+        freeInput.Push(std::move(block));
+    }
+    for (size_t i = 0; i < kOutputBlocks; i++)
+    {
+        cIOBlock block;
+        block.mBuffer.Acquire(kOutputBlockSize);
+        freeOutput.Push(std::move(block));
+    }
+
+    std::atomic<bool> bFailed(false);
+
+    std::thread reader([&]()
+    {
+        uint64_t nBytesProcessed = 0;
+        cIOBlock block;
+        while (nBytesProcessed < cdFileHeader.mCompressedSize && freeInput.Pop(block))
+        {
+            uint32_t nBytesToRead = (uint32_t)std::min<uint64_t>(kInputBlockSize, cdFileHeader.mCompressedSize - nBytesProcessed);
+            uint32_t nBytesRead = 0;
+            if (!mpZZFile->Read(nStreamOffset + nBytesProcessed, nBytesToRead, block.mBuffer.Get(), nBytesRead) || nBytesRead != nBytesToRead)
+            {
+                cerr << "Failed to read compression stream for file " << cdFileHeader.mFileName.c_str() << " at offset " << nStreamOffset + nBytesProcessed << ". Tried to read " << nBytesToRead << " bytes. Total compressed stream size: " << cdFileHeader.mCompressedSize << "\n";
+                bFailed = true;
+                break;
+            }
+
+            block.mnSize = nBytesToRead;
+            nBytesProcessed += nBytesToRead;
+            if (!fullInput.Push(std::move(block)))
+                break;
+        }
+        fullInput.Close();
+    });
+
+    std::thread writer([&]()
+    {
+        cIOBlock block;
+        while (fullOutput.Pop(block))
+        {
+            uint32_t nBytesWritten = 0;
+            if (!bFailed && !outFile.Write(cZZFile::ZZFILE_NO_SEEK, block.mnSize, block.mBuffer.Get(), nBytesWritten))
             {
-                break;
+                cerr << "Failed to write decompressed stream for file " << cdFileHeader.mFileName.c_str() << ".  Reason: " << outFile.GetLastError() << "\n";
+                bFailed = true;
             }
+            freeOutput.Push(std::move(block));      // keep recycling after a failure so the inflater never waits forever
         }
+    });
 
-        if (!(nStatus == Z_STREAM_END || nStatus == Z_OK))
+    uint32_t nOutputCRC = 0;
+    cIOBlock output;
+    freeOutput.Pop(output);
+
+    auto flushOutput = [&]()
+    {
+        if (mbVerifyCRC)
+            nOutputCRC = crc32_fast(output.mBuffer.Get(), output.mnSize, nOutputCRC);     // CRC while the block is still in cache
+        if (pProgress)
+            pProgress->AddBytesProcessed(output.mnSize);
+
+        fullOutput.Push(std::move(output));
+        freeOutput.Pop(output);
+        output.mnSize = 0;
+    };
+
+    ZDecompressorPtr pDecompressor = cZCodecPool::AcquireDecompressor();
+    ZDecompressor& decompressor = *pDecompressor;
+
+    int32_t nStatus = Z_OK;
+    cIOBlock input;
+    while (!bFailed && nStatus != Z_STREAM_END && fullInput.Pop(input))
+    {
+        decompressor.InitStream(input.mBuffer.Get(), input.mnSize);
+        while (decompressor.HasMoreOutput())
         {
-            delete[] pCompStream;
-            cerr << "Decompress Error #:" << to_string(nStatus) << "\n";
-            return false;
+            nStatus = decompressor.Decompress();
+            if (nStatus < 0)
+                break;
+
+            uint8_t* pDecompressed = decompressor.GetDecompressedBuffer();
+            uint32_t nDecompressedBytes = (uint32_t)decompressor.GetDecompressedBytes();
+            while (nDecompressedBytes > 0)
+            {
+                uint32_t nBytesToCopy = std::min<uint32_t>(nDecompressedBytes, kOutputBlockSize - output.mnSize);
+                memcpy(output.mBuffer.Get() + output.mnSize, pDecompressed, nBytesToCopy);
+                output.mnSize += nBytesToCopy;
+                pDecompressed += nBytesToCopy;
+                nDecompressedBytes -= nBytesToCopy;
+
+                if (output.mnSize == kOutputBlockSize)
+                    flushOutput();
+            }
         }
+        freeInput.Push(std::move(input));
 
-        nCompressedBytesProcessed += nBytesToProcess;
+        if (nStatus < 0)
+            break;
     }
 
-    delete[] pCompStream;
+    if (output.mnSize > 0)
+        flushOutput();
 
-    //cout << "thread: " << this_thread::get_id() << " Extracted \"" << sFilename.c_str() << "\" to \"" << sOutputFilename.c_str() << "\"\n";
+    // Unblock the reader if we stopped early, then let the writer drain
+    freeInput.Close();
+    fullInput.Close();
+    fullOutput.Close();
+    reader.join();
+    writer.join();
+
+    if (bFailed)
+        return false;
+
+    if (!(nStatus == Z_STREAM_END || nStatus == Z_OK))
+    {
+        cerr << "Decompress Error #:" << to_string(nStatus) << "\n";
+        return false;
+    }
 
+    nCRC = nOutputCRC;
     return true;
 }
 
@@ -416,7 +1460,7 @@ bool ZZipAPI::AddToZipFile(const string& sFilename, const string& sBaseFolder, P
         return false;
     }
 
-    if (mOpenType != kZipCreate)
+    if (!IsOpenForWriting())
     {
         cout << "AddToZipFile - ZZipAPI not open for creation!\n";
         return false;
@@ -475,13 +1519,28 @@ bool ZZipAPI::AddToZipFile(const string& sFilename, const string& sBaseFolder, P
 
     uint64_t nOffsetOfStreamData = ((uint64_t)nOffsetToLocalFileHeader) + cLocalFileHeader::kStaticDataSize + newLocalHeader.mFilenameLength + cLocalFileHeader::kExtendedFieldLength;
 
+    if (!BeginEntry(newLocalHeader, (uint64_t)nOffsetToLocalFileHeader))
+        return false;
+
     if (bInputIsFile)
     {
         const uint32_t kStreamProcessSize = 1024 * 1024;  // one meg at a time
-        uint8_t* pStream = new uint8_t[kStreamProcessSize];
+        cPooledBuffer stream(kStreamProcessSize);
+        uint8_t* pStream = stream.Get();
+
+        ZCompressorPtr pCompressor = cZCodecPool::AcquireCompressor(mnCompressionLevel);
+        if (!pCompressor)
+        {
+            cerr << "Failed to initialize compressor for file " << sFileOrFolder.c_str() << "\n";
+            return false;
+        }
+        ZCompressor& compressor = *pCompressor;
 
-        ZCompressor compressor;
-        compressor.Init(mnCompressionLevel);
+        // Large files get a full flush every so often (recorded in the CD) so that extraction can inflate the pieces in parallel
+        uint64_t nFlushPointSpacing = 0;
+        if (mnFlushPointSpacing > 0 && pInFile->GetFileSize() > mnFlushPointSpacing)
+            nFlushPointSpacing = std::max<uint64_t>(mnFlushPointSpacing, pInFile->GetFileSize() / cCDFileHeader::kMaxFlushPoints + 1);
+        tFlushPointList flushPoints;
 
         uint32_t nCRC = 0;
         uint64_t nBytesProcessed = 0;
@@ -495,13 +1554,16 @@ bool ZZipAPI::AddToZipFile(const string& sFilename, const string& sBaseFolder, P
             uint32_t nBytesRead = 0;
             if (!pInFile->Read(cZZFile::ZZFILE_NO_SEEK, (uint32_t) nBytesToProcess, pStream, nBytesRead))
             {
-                delete[] pStream;
                 cerr << "Failed to read input stream for file " << sFileOrFolder.c_str() << " at offset " << nBytesProcessed << ". Tried to read " << nBytesToProcess << " bytes. Total file size: " << pInFile->GetFileSize() << "\n";
                 return false;
             }
 
             // Update our CRC calculation
-            nCRC = crc32_16bytes(pStream, (int32_t) nBytesToProcess, nCRC);
+            nCRC = crc32_fast(pStream, (int32_t) nBytesToProcess, nCRC);
+
+            bool bFinalBlock = (nBytesProcessed + nBytesToProcess == pInFile->GetFileSize());
+            uint64_t nLastFlushPoint = flushPoints.empty() ? 0 : flushPoints.back().mnUncompressedOffset;
+            bool bFullFlush = nFlushPointSpacing > 0 && !bFinalBlock && nBytesProcessed + nBytesToProcess - nLastFlushPoint >= nFlushPointSpacing;
 
             compressor.InitStream(pStream, (uint32_t)nBytesToProcess);
             int32_t nStatus = Z_OK;
@@ -510,14 +1572,12 @@ bool ZZipAPI::AddToZipFile(const string& sFilename, const string& sBaseFolder, P
             {
                 if (nStatus == Z_OK)
                 {
-                    bool bFinalBlock = (nBytesProcessed + nBytesToProcess == pInFile->GetFileSize());
-                    nStatus = compressor.Compress(bFinalBlock);
+                    nStatus = compressor.Compress(bFinalBlock, bFullFlush);
                     uint32_t nCompressedBytes = (uint32_t)compressor.GetCompressedBytes();
 
                     uint32_t nNumWritten = 0;
                     if (!mpZZFile->Write(nOffsetOfStreamData, (uint32_t)compressor.GetCompressedBytes(), compressor.GetCompressedBuffer(), nNumWritten))
                     {
-                        delete[] pStream;
                         cerr << "Failed to write compressed stream for file " << sFileOrFolder.c_str() << " to file " << msZipURL.c_str() << ".  Reason: " << errno << "\n";
                         return false;
                     }
@@ -535,43 +1595,32 @@ bool ZZipAPI::AddToZipFile(const string& sFilename, const string& sBaseFolder, P
 
             if (!(nStatus == Z_OK || nStatus == Z_STREAM_END))
             {
-                delete[] pStream;
                 cerr << "Compress Error #:" << to_string(nStatus) << "\n";
                 return false;
             }
 
             nBytesProcessed += nBytesToProcess;
 
+            if (bFullFlush)
+                flushPoints.push_back(cFlushPoint(nBytesProcessed, newLocalHeader.mCompressedSize));
+
             if (pProgress)
                 pProgress->AddBytesProcessed(nBytesToProcess);
         }
 
-        delete[] pStream;
-
         // Now write the localfile header
         newLocalHeader.mCRC32 = nCRC;
+
+        // Write the localfile header (or data descriptor) and add a new CD entry
+        return FinishEntry(newLocalHeader, (uint64_t)nOffsetToLocalFileHeader, &flushPoints);
     }
 
-    // seek to start of compression stream data
-    if (!newLocalHeader.Write(*mpZZFile, nOffsetToLocalFileHeader))
+    // Write the localfile header (or data descriptor) and add a new CD entry
+    if (!FinishEntry(newLocalHeader, (uint64_t)nOffsetToLocalFileHeader))
     {
         return false;
     }
 
-    // Add a new CD entry
-    cCDFileHeader newCDFileHeader;
-    newCDFileHeader.mLastModificationTime = newLocalHeader.mLastModificationTime;
-    newCDFileHeader.mLastModificationDate = newLocalHeader.mLastModificationDate;
-    newCDFileHeader.mCRC32 = newLocalHeader.mCRC32;
-    newCDFileHeader.mCompressionMethod = newLocalHeader.mCompressionMethod;
-    newCDFileHeader.mCompressedSize = newLocalHeader.mCompressedSize;
-    newCDFileHeader.mUncompressedSize = newLocalHeader.mUncompressedSize;
-    newCDFileHeader.mLocalFileHeaderOffset = nOffsetToLocalFileHeader;
-    newCDFileHeader.mFileName = newLocalHeader.mFilename;
-    newCDFileHeader.mFilenameLength = newLocalHeader.mFilenameLength;
-
-    mZipCD.mCDFileHeaderList.push_back(newCDFileHeader);
-
     //    cout << "thread: " << this_thread::get_id() << " Added \"" << sFileOrFolder.c_str() << "\"\n";
 
     return true;
@@ -587,7 +1636,7 @@ bool ZZipAPI::AddToZipFileFromBuffer(uint8_t* pInputBuffer, uint32_t nInputBuffe
         return false;
     }
 
-    if (mOpenType != kZipCreate)
+    if (!IsOpenForWriting())
     {
         cout << "AddToZipFile - ZZipAPI not open for creation!\n";
         return false;
@@ -620,8 +1669,16 @@ bool ZZipAPI::AddToZipFileFromBuffer(uint8_t* pInputBuffer, uint32_t nInputBuffe
 
     uint64_t nOffsetOfStreamData = ((uint64_t)nOffsetToLocalFileHeader) + cLocalFileHeader::kStaticDataSize + newLocalHeader.mFilenameLength + cLocalFileHeader::kExtendedFieldLength;
 
-    ZCompressor compressor;
-    compressor.Init(mnCompressionLevel);
+    if (!BeginEntry(newLocalHeader, (uint64_t)nOffsetToLocalFileHeader))
+        return false;
+
+    ZCompressorPtr pCompressor = cZCodecPool::AcquireCompressor(mnCompressionLevel);
+    if (!pCompressor)
+    {
+        cerr << "Failed to initialize compressor for memory buffer " << sFilename.c_str() << "\n";
+        return false;
+    }
+    ZCompressor& compressor = *pCompressor;
     compressor.InitStream(pInputBuffer, (uint32_t)nInputBufferSize);
     int32_t nStatus = Z_OK;
     int32_t nOutIndex = 0;
@@ -661,28 +1718,14 @@ bool ZZipAPI::AddToZipFileFromBuffer(uint8_t* pInputBuffer, uint32_t nInputBuffe
 
     // Now write the localfile header
     //newLocalHeader.mCRC32 = (uint32_t)crcCalc;
-    newLocalHeader.mCRC32 = crc32_16bytes(pInputBuffer, nInputBufferSize, 0);
+    newLocalHeader.mCRC32 = crc32_fast(pInputBuffer, nInputBufferSize, 0);
 
-    // seek to start of compression stream data
-    if (!newLocalHeader.Write(*mpZZFile, nOffsetToLocalFileHeader))
+    // Write the localfile header (or data descriptor) and add a new CD entry
+    if (!FinishEntry(newLocalHeader, (uint64_t)nOffsetToLocalFileHeader))
     {
         return false;
     }
 
-    // Add a new CD entry
-    cCDFileHeader newCDFileHeader;
-    newCDFileHeader.mLastModificationTime = newLocalHeader.mLastModificationTime;
-    newCDFileHeader.mLastModificationDate = newLocalHeader.mLastModificationDate;
-    newCDFileHeader.mCRC32 = newLocalHeader.mCRC32;
-    newCDFileHeader.mCompressionMethod = newLocalHeader.mCompressionMethod;
-    newCDFileHeader.mCompressedSize = newLocalHeader.mCompressedSize;
-    newCDFileHeader.mUncompressedSize = newLocalHeader.mUncompressedSize;
-    newCDFileHeader.mLocalFileHeaderOffset = nOffsetToLocalFileHeader;
-    newCDFileHeader.mFileName = newLocalHeader.mFilename;
-    newCDFileHeader.mFilenameLength = newLocalHeader.mFilenameLength;
-
-    mZipCD.mCDFileHeaderList.push_back(newCDFileHeader);
-
     //    wcout << "thread: " << this_thread::get_id() << " Added \"" << sFilename.c_str() << "\"\n";
 
     return true;
@@ -780,6 +1823,91 @@ bool ZZipAPI::DecompressToBuffer(const string& sFilename, uint8_t* pOutputBuffer
     if (!mZipCD.GetFileHeader(sFilename, cdFileHeader))
         return false;
 
+    return DecompressToBuffer(cdFileHeader, pOutputBuffer, pProgress);
+}
+
+bool ZZipAPI::DecompressToBuffer(const cCDFileHeader& cdFileHeader, uint8_t* pOutputBuffer, Progress* pProgress)
+{
+    if (!mbInitted)
+        return false;
+
+    if (!mpEntryCache)
+        return ReadAndInflate(cdFileHeader, pOutputBuffer, nullptr, pProgress);
+
+    cZipEntryCache::cKey key(GetCacheKey(cdFileHeader));
+    cZipEntryCache::cEntry entry;
+    if (mpEntryCache->Lookup(key, entry))
+    {
+        memcpy(pOutputBuffer, entry.Data(), (size_t)entry.Size());
+        if (pProgress)
+            pProgress->AddBytesProcessed(entry.Size());
+        return true;
+    }
+
+    // Only data that checks out is offered to the cache. It's copied in only if admitted.
+    uint32_t nCRC = 0;
+    if (!ReadAndInflate(cdFileHeader, pOutputBuffer, &nCRC, pProgress))
+        return false;
+
+    if (nCRC != cdFileHeader.mCRC32)
+    {
+        cerr << "CRC mismatch extracting \"" << cdFileHeader.mFileName.c_str() << "\". Expected:" << int_to_hex_string(cdFileHeader.mCRC32) << " Got:" << int_to_hex_string(nCRC) << "\n";
+        return !mbVerifyCRC;
+    }
+
+    mpEntryCache->Insert(key, pOutputBuffer, cdFileHeader.mUncompressedSize);
+    return true;
+}
+
+bool ZZipAPI::GetEntry(const string& sFilename, cZipEntryCache::cEntry& entry, Progress* pProgress)
+{
+    if (!mbInitted)
+        return false;
+
+    cCDFileHeader cdFileHeader;
+    if (!mZipCD.GetFileHeader(sFilename, cdFileHeader))
+        return false;
+
+    return GetEntry(cdFileHeader, entry, pProgress);
+}
+
+bool ZZipAPI::GetEntry(const cCDFileHeader& cdFileHeader, cZipEntryCache::cEntry& entry, Progress* pProgress)
+{
+    if (!mbInitted)
+        return false;
+
+    cZipEntryCache::cKey key(GetCacheKey(cdFileHeader));
+    if (mpEntryCache && mpEntryCache->Lookup(key, entry))
+    {
+        if (pProgress)
+            pProgress->AddBytesProcessed(entry.Size());
+        return true;
+    }
+
+    uint8_t* pData = new uint8_t[cdFileHeader.mUncompressedSize ? (size_t)cdFileHeader.mUncompressedSize : 1];
+    shared_ptr<const uint8_t> pShared(pData, std::default_delete<const uint8_t[]>());
+
+    uint32_t nCRC = 0;
+    if (!ReadAndInflate(cdFileHeader, pData, &nCRC, pProgress))
+        return false;
+
+    if (nCRC != cdFileHeader.mCRC32)
+    {
+        cerr << "CRC mismatch extracting \"" << cdFileHeader.mFileName.c_str() << "\". Expected:" << int_to_hex_string(cdFileHeader.mCRC32) << " Got:" << int_to_hex_string(nCRC) << "\n";
+        if (mbVerifyCRC)
+            return false;
+    }
+    else if (mpEntryCache)
+    {
+        mpEntryCache->Insert(key, pShared, cdFileHeader.mUncompressedSize);     // no copy. The cache and the caller share the buffer.
+    }
+
+    entry = cZipEntryCache::cEntry(pShared, cdFileHeader.mUncompressedSize);
+    return true;
+}
+
+bool ZZipAPI::ReadAndInflate(const cCDFileHeader& cdFileHeader, uint8_t* pOutputBuffer, uint32_t* pCRC, Progress* pProgress)
+{
     cLocalFileHeader localFileHeader;
 
     uint32_t nNumBytesProcessed = 0;
@@ -790,47 +1918,315 @@ bool ZZipAPI::DecompressToBuffer(const string& sFilename, uint8_t* pOutputBuffer
     }
 
     uint64_t nStreamOffset = cdFileHeader.mLocalFileHeaderOffset + nNumBytesProcessed;
-    uint8_t* pCompStream = new uint8_t[(uint32_t)cdFileHeader.mCompressedSize];
+    cPooledBuffer compStream((size_t)cdFileHeader.mCompressedSize);
+    uint8_t* pCompStream = compStream.Get();
 
     uint32_t nBytesRead = 0;
     if (!mpZZFile->Read(nStreamOffset, (uint32_t)cdFileHeader.mCompressedSize, pCompStream, nBytesRead))
     {
-        delete[] pCompStream;
         cerr << "Failed to seek to read compression stream\n";
         return false;
     }
 
-    ZDecompressor decompressor;
-    decompressor.Init();
+    bool bResult = InflateRawStream(cdFileHeader, pCompStream, pOutputBuffer, pCRC, pProgress);
+    return bResult;
+}
 
-    decompressor.InitStream(pCompStream, (int32_t)cdFileHeader.mCompressedSize);
-    int32_t nStatus = decompressor.Decompress();
-    int32_t nOutIndex = 0;
-    while (decompressor.HasMoreOutput())
+bool ZZipAPI::InflateRawStream(const cCDFileHeader& cdFileHeader, uint8_t* pStream, uint8_t* pOutputBuffer, uint32_t* pCRC, Progress* pProgress)
+{
+    uint32_t nCRC = 0;
+
+    if (cdFileHeader.mCompressionMethod == 0)
+    {
+        memcpy(pOutputBuffer, pStream, (size_t)cdFileHeader.mUncompressedSize);
+        if (pCRC)
+            *pCRC = crc32_fast(pOutputBuffer, (size_t)cdFileHeader.mUncompressedSize, 0);
+        if (pProgress)
+            pProgress->AddBytesProcessed(cdFileHeader.mUncompressedSize);
+        return true;
+    }
+    else if (cdFileHeader.mCompressionMethod != 8)
+    {
+        cerr << "Unsupported compression method:" << cdFileHeader.mCompressionMethod << " for \"" << cdFileHeader.mFileName.c_str() << "\"\n";
+        return false;
+    }
+
+    // The whole stream is in memory and the output size is known so decode straight into the output in one pass.
+    // zlib below handles (and reports) anything the fast decoder turns down.
+    if (FastInflate(pStream, (size_t)cdFileHeader.mCompressedSize, pOutputBuffer, (size_t)cdFileHeader.mUncompressedSize))
+    {
+        if (pCRC)
+            *pCRC = crc32_fast(pOutputBuffer, (size_t)cdFileHeader.mUncompressedSize, 0);
+        if (pProgress)
+            pProgress->AddBytesProcessed(cdFileHeader.mUncompressedSize);
+        return true;
+    }
+
+    ZDecompressorPtr pDecompressor = cZCodecPool::AcquireDecompressor();
+    ZDecompressor& decompressor = *pDecompressor;
+
+    // zlib takes 32 bit lengths so the stream goes in a piece at a time
+    const uint64_t kMaxInputPiece = 1024 * 1024 * 1024;
+    uint64_t nInIndex = 0;
+    uint64_t nOutIndex = 0;
+    int32_t nStatus = Z_OK;
+    while (nInIndex < cdFileHeader.mCompressedSize && nStatus != Z_STREAM_END)
     {
-        if (nStatus == Z_OK || nStatus == Z_STREAM_END)
+        uint32_t nPiece = (uint32_t)std::min<uint64_t>(kMaxInputPiece, cdFileHeader.mCompressedSize - nInIndex);
+        decompressor.InitStream(pStream + nInIndex, (int32_t)nPiece);
+        while (decompressor.HasMoreOutput())
         {
+            nStatus = decompressor.Decompress();
+            if (nStatus < 0)
+                break;
+
             uint32_t nDecompressedBytes = (uint32_t)decompressor.GetDecompressedBytes();
+            if (nOutIndex + nDecompressedBytes > cdFileHeader.mUncompressedSize)
+            {
+                nStatus = Z_BUF_ERROR;      // more output than the CD says there is
+                break;
+            }
+
             memcpy(pOutputBuffer + nOutIndex, decompressor.GetDecompressedBuffer(), nDecompressedBytes);
+            if (pCRC)
+                nCRC = crc32_fast(pOutputBuffer + nOutIndex, nDecompressedBytes, nCRC);
             nOutIndex += nDecompressedBytes;
 
             if (pProgress)
                 pProgress->AddBytesProcessed(nDecompressedBytes);
+
+            if (nStatus == Z_STREAM_END)
+                break;
         }
 
         if (nStatus < 0)
-        {
             break;
-        }
+        nInIndex += nPiece;
     }
 
-    delete[] pCompStream;
-
     if (nStatus != Z_STREAM_END)
     {
         cerr << "Decompress Error #:" << to_string(nStatus) << "\n";
         return false;
     }
 
+    // A stream that ends early would leave the rest of the output uninitialized, and without CRC checks nothing else would notice
+    if (nOutIndex != cdFileHeader.mUncompressedSize)
+    {
+        cerr << "Decompressed " << nOutIndex << " bytes for \"" << cdFileHeader.mFileName.c_str() << "\". Expected " << cdFileHeader.mUncompressedSize << "\n";
+        return false;
+    }
+
+    if (pCRC)
+        *pCRC = nCRC;
+
+    return true;
+}
+
+bool ZZipAPI::WriteVerifiedFile(const cCDFileHeader& cdFileHeader, const uint8_t* pData, uint32_t nCRC, const string& sOutputFilename, VerifiedFileInfo* pVerified)
+{
+    shared_ptr<cZZFile> pOutFile;
+    if (!cZZFileOutput::Open(sOutputFilename, cdFileHeader.mUncompressedSize, pOutFile, mnOutputFlags))
+    {
+        cout << "Failed to open " << sOutputFilename.c_str() << " for extraction. Reason: " << errno << "\n";
+        return false;
+    }
+
+    const uint64_t kMaxWrite = 1024 * 1024 * 1024;
+    uint64_t nOffset = 0;
+    while (nOffset < cdFileHeader.mUncompressedSize)
+    {
+        uint32_t nBytesToWrite = (uint32_t)std::min<uint64_t>(kMaxWrite, cdFileHeader.mUncompressedSize - nOffset);
+        uint32_t nBytesWritten = 0;
+        if (!pOutFile->Write(nOffset, nBytesToWrite, (uint8_t*)pData + nOffset, nBytesWritten))
+        {
+            cerr << "Failed to write " << sOutputFilename.c_str() << ". Reason: " << pOutFile->GetLastError() << "\n";
+            pOutFile->Close();
+            std::error_code ec;
+            std::filesystem::remove(sOutputFilename, ec);
+            return false;
+        }
+        nOffset += nBytesToWrite;
+    }
+
+    return FinishOutputFile(*pOutFile, cdFileHeader, sOutputFilename, nCRC, pVerified);
+}
+
+bool ZZipAPI::ExtractRawStreamToBuffer(const cCDFileHeader& cdFileHeader, uint8_t* pOutputBuffer)
+{
+    if (!mbInitted)
+        return false;
+
+    cLocalFileHeader localFileHeader;
+
+    uint32_t nNumBytesProcessed = 0;
+    if (!localFileHeader.Read(*mpZZFile, cdFileHeader.mLocalFileHeaderOffset, nNumBytesProcessed))
+    {
+        cerr << "Failed to read localFileHeader.\n";
+        return false;
+    }
+
+    uint64_t nStreamOffset = cdFileHeader.mLocalFileHeaderOffset + nNumBytesProcessed;
+
+    // Read takes 32 bit sizes so streams over 4GB come in pieces
+    const uint64_t kMaxRead = 1024 * 1024 * 1024;
+    uint64_t nRead = 0;
+    while (nRead < cdFileHeader.mCompressedSize)
+    {
+        uint32_t nBytesToRead = (uint32_t)std::min<uint64_t>(kMaxRead, cdFileHeader.mCompressedSize - nRead);
+        uint32_t nBytesRead = 0;
+        if (!mpZZFile->Read(nStreamOffset + nRead, nBytesToRead, pOutputBuffer + nRead, nBytesRead) || nBytesRead != nBytesToRead)
+        {
+            cerr << "Failed to read stream for file " << cdFileHeader.mFileName.c_str() << " at offset " << nStreamOffset + nRead << "\n";
+            return false;
+        }
+        nRead += nBytesToRead;
+    }
+
+    return true;
+}
+
+bool ZZipAPI::AddRawEntry(const cCDFileHeader& cdFileHeader, uint8_t* pCompressedStream)
+{
+    if (!mbInitted)
+    {
+        cout << "AddRawEntry - Not Initialized!\n";
+        return false;
+    }
+
+    if (!IsOpenForWriting())
+    {
+        cout << "AddRawEntry - ZZipAPI not open for creation!\n";
+        return false;
+    }
+
+    if (!CanCopyEntry(cdFileHeader))
+        return false;
+
+    uint64_t nOffsetToLocalFileHeader = mpZZFile->GetFileSize();
+
+    cLocalFileHeader newLocalHeader;
+    newLocalHeader.mMinVersionToExtract = std::max<uint16_t>(cdFileHeader.mMinVersionToExtract, kDefaultMinVersionToExtract);
+    newLocalHeader.mGeneralPurposeBitFlag = CopiedEntryFlags(cdFileHeader);
+    newLocalHeader.mCompressionMethod = cdFileHeader.mCompressionMethod;
+    newLocalHeader.mLastModificationTime = cdFileHeader.mLastModificationTime;
+    newLocalHeader.mLastModificationDate = cdFileHeader.mLastModificationDate;
+    newLocalHeader.mCRC32 = cdFileHeader.mCRC32;
+    newLocalHeader.mCompressedSize = cdFileHeader.mCompressedSize;
+    newLocalHeader.mUncompressedSize = cdFileHeader.mUncompressedSize;
+    newLocalHeader.mFilename = cdFileHeader.mFileName;
+    newLocalHeader.mFilenameLength = cdFileHeader.mFilenameLength;
+
+    uint64_t nOffsetOfStreamData = nOffsetToLocalFileHeader + newLocalHeader.Size();
+
+    if (!BeginEntry(newLocalHeader, nOffsetToLocalFileHeader))
+        return false;
+
+    const uint32_t kWriteBlockSize = 16 * 1024 * 1024;
+    uint64_t nWritten = 0;
+    while (nWritten < cdFileHeader.mCompressedSize)
+    {
+        uint32_t nBytesToWrite = kWriteBlockSize;
+        if (nWritten + nBytesToWrite > cdFileHeader.mCompressedSize)
+            nBytesToWrite = (uint32_t)(cdFileHeader.mCompressedSize - nWritten);
+
+        uint32_t nNumWritten = 0;
+        if (!mpZZFile->Write(nOffsetOfStreamData + nWritten, nBytesToWrite, pCompressedStream + nWritten, nNumWritten))
+        {
+            cerr << "Failed to write stream for " << cdFileHeader.mFileName.c_str() << " to file " << msZipURL.c_str() << ".  Reason: " << errno << "\n";
+            return false;
+        }
+
+        nWritten += nBytesToWrite;
+    }
+
+    return FinishEntry(newLocalHeader, nOffsetToLocalFileHeader, nullptr, &cdFileHeader);
+}
+
+bool ZZipAPI::AddRawEntry(ZZipAPI& sourceAPI, const cCDFileHeader& cdFileHeader)
+{
+    if (!mbInitted || !sourceAPI.mbInitted)
+    {
+        cout << "AddRawEntry - Not Initialized!\n";
+        return false;
+    }
+
+    if (!IsOpenForWriting())
+    {
+        cout << "AddRawEntry - ZZipAPI not open for creation!\n";
+        return false;
+    }
+
+    if (!CanCopyEntry(cdFileHeader))
+        return false;
+
+    cLocalFileHeader sourceLocalHeader;
+    uint32_t nHeaderBytesProcessed = 0;
+    if (!sourceLocalHeader.Read(*sourceAPI.mpZZFile, cdFileHeader.mLocalFileHeaderOffset, nHeaderBytesProcessed))
+    {
+        cerr << "Failed to read localFileHeader.\n";
+        return false;
+    }
+    uint64_t nSourceStreamOffset = cdFileHeader.mLocalFileHeaderOffset + nHeaderBytesProcessed;
+
+    uint64_t nOffsetToLocalFileHeader = mpZZFile->GetFileSize();
+
+    cLocalFileHeader newLocalHeader;
+    newLocalHeader.mMinVersionToExtract = std::max<uint16_t>(cdFileHeader.mMinVersionToExtract, kDefaultMinVersionToExtract);
+    newLocalHeader.mGeneralPurposeBitFlag = CopiedEntryFlags(cdFileHeader);
+    newLocalHeader.mCompressionMethod = cdFileHeader.mCompressionMethod;
+    newLocalHeader.mLastModificationTime = cdFileHeader.mLastModificationTime;
+    newLocalHeader.mLastModificationDate = cdFileHeader.mLastModificationDate;
+    newLocalHeader.mCRC32 = cdFileHeader.mCRC32;
+    newLocalHeader.mCompressedSize = cdFileHeader.mCompressedSize;
+    newLocalHeader.mUncompressedSize = cdFileHeader.mUncompressedSize;
+    newLocalHeader.mFilename = cdFileHeader.mFileName;
+    newLocalHeader.mFilenameLength = cdFileHeader.mFilenameLength;
+    newLocalHeader.mExtensibleFieldList = sourceLocalHeader.mExtensibleFieldList;
+
+    uint64_t nOffsetOfStreamData = nOffsetToLocalFileHeader + newLocalHeader.Size();
+
+    if (!BeginEntry(newLocalHeader, nOffsetToLocalFileHeader))
+        return false;
+
+    // One block at a time whatever the entry's size
+    const uint32_t kCopyBlockSize = 4 * 1024 * 1024;
+    cPooledBuffer buffer(kCopyBlockSize);
+    uint8_t* pBuffer = buffer.Get();
+
+    uint64_t nCopied = 0;
+    while (nCopied < cdFileHeader.mCompressedSize)
+    {
+        uint32_t nBytesToCopy = (uint32_t)std::min<uint64_t>(kCopyBlockSize, cdFileHeader.mCompressedSize - nCopied);
+
+        uint32_t nNumRead = 0;
+        if (!sourceAPI.mpZZFile->Read(nSourceStreamOffset + nCopied, nBytesToCopy, pBuffer, nNumRead) || nNumRead != nBytesToCopy)
+        {
+            cerr << "Failed to read stream for file " << cdFileHeader.mFileName.c_str() << " at offset " << nSourceStreamOffset + nCopied << "\n";
+            return false;
+        }
+
+        uint32_t nNumWritten = 0;
+        if (!mpZZFile->Write(nOffsetOfStreamData + nCopied, nBytesToCopy, pBuffer, nNumWritten))
+        {
+            cerr << "Failed to write stream for " << cdFileHeader.mFileName.c_str() << " to file " << msZipURL.c_str() << ".  Reason: " << errno << "\n";
+            return false;
+        }
+
+        nCopied += nBytesToCopy;
+    }
+
+    return FinishEntry(newLocalHeader, nOffsetToLocalFileHeader, nullptr, &cdFileHeader);
+}
+
+bool ZZipAPI::CanCopyEntry(const cCDFileHeader& cdFileHeader)
+{
+    // Streaming puts every entry's sizes in a data descriptor. An encrypted entry written without one would then fail its password check.
+    if (mOpenType == kZipCreateStream && (cdFileHeader.mGeneralPurposeBitFlag & kGeneralPurposeFlagEncrypted) && !(cdFileHeader.mGeneralPurposeBitFlag & kGeneralPurposeFlagDataDescriptor))
+    {
+        cerr << "Can't stream encrypted entry \"" << cdFileHeader.mFileName << "\" unchanged. Skipping.\n";
+        return false;
+    }
+
     return true;
 }
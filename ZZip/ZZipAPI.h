@@ -19,8 +19,15 @@
 #include <filesystem>
 #include "ZipHeaders.h"
 #include "ZipJob.h"
+#include "ZipEntryStream.h"
+#include "ZipArena.h"
+#include "ZipEntryCache.h"
+#include "ZipEntryFile.h"
 #include "zlib.h"
+#include "zlibAPI.h"
 #include "common/ZZFileAPI.h"
+#include "common/BufferPool.h"
+#include "common/CrC32Fast.h"
 
 //using namespace std;
 
@@ -33,37 +40,208 @@ public:
     enum eOpenType
     {
         kZipOpen = 0,       // For existing Zips
-        kZipCreate = 1      // For creating new Zips
+        kZipCreate = 1,     // For creating new Zips
+        kZipModify = 2,     // For adding or replacing entries in existing Zips (creates the Zip if it doesn't exist)
+        kZipCreateStream = 3    // For creating new Zips on non-seekable outputs (pipes, fifos). Entries are followed by data descriptors.
     };
 
     bool			        Init(const std::string& sFilename, eOpenType openType = kZipOpen, int32_t nCompressionLevel = Z_DEFAULT_COMPRESSION, const std::string& sName = "", const std::string& sPassword = "");
+    bool                    Init(std::shared_ptr<cZZFile> pZipFile, const std::string& sLabel);      // reads an archive from an already open file (e.g. from OpenEntryAsFile). sLabel stands in for the filename.
     bool                    Shutdown();
 
     // Accessors
     std::string                 GetZipFilename() const { return msZipURL; }
+    eOpenType               GetOpenType() const { return mOpenType; }      // what Init ended up with. kZipModify becomes kZipCreate when there was no archive to modify.
     cZipCD&                 GetZipCD() { return mZipCD;  }
+    void                    SetVerifyCRC(bool bVerify) { mbVerifyCRC = bVerify; }      // when true (default) extraction computes the CRC inline and fails on mismatch
+    void                    SetFlushPointSpacing(uint64_t nBytes) { mnFlushPointSpacing = nBytes; }    // AddToZipFile fully flushes large entries this often (uncompressed) so they can be inflated in parallel. 0 disables.
+    void                    SetEntryCache(std::shared_ptr<cZipEntryCache> pCache) { mpEntryCache = pCache; }    // DecompressToBuffer and GetEntry serve repeat reads from pCache. May be shared between instances. nullptr disables.
+    std::shared_ptr<cZipEntryCache> GetEntryCache() const { return mpEntryCache; }
+    void                    SetOutputFlags(uint32_t nFlags) { mnOutputFlags = nFlags; }       // cZZFileOutput::kOutputMapped, kOutputDirect and/or kOutputSparse for extracted files
 
     // Commands for existing Zips
     void                    DumpReport(const std::string& sOutputFilename);
     bool                    DecompressToBuffer(const std::string& sFilename, uint8_t* pOutputBuffer, Progress* pProgress = nullptr);    // output buffer must be large enough to hold entire output
-    bool                    DecompressToFile(const std::string& sFilename, const std::string& sOutputFilename, Progress* pProgress = nullptr);
+    bool                    DecompressToBuffer(const cCDFileHeader& cdFileHeader, uint8_t* pOutputBuffer, Progress* pProgress = nullptr);
+    bool                    GetEntry(const std::string& sFilename, cZipEntryCache::cEntry& entry, Progress* pProgress = nullptr);       // shared read-only copy of the decompressed entry. From the cache when one is set.
+    bool                    GetEntry(const cCDFileHeader& cdFileHeader, cZipEntryCache::cEntry& entry, Progress* pProgress = nullptr);
+    bool                    ExtractRawStreamToBuffer(const cCDFileHeader& cdFileHeader, uint8_t* pOutputBuffer);          // output buffer must hold mCompressedSize bytes
+    bool                    SameRawStream(const cCDFileHeader& cdFileHeaderA, const cCDFileHeader& cdFileHeaderB);        // true if both entries have the same method and byte identical streams (so identical contents)
+    bool                    InflateRawStream(const cCDFileHeader& cdFileHeader, uint8_t* pStream, uint8_t* pOutputBuffer, uint32_t* pCRC = nullptr, Progress* pProgress = nullptr);  // inflates (or copies) a stream from ExtractRawStreamToBuffer. Output must hold mUncompressedSize bytes.
+    bool                    WriteVerifiedFile(const cCDFileHeader& cdFileHeader, const uint8_t* pData, uint32_t nCRC, const std::string& sOutputFilename, VerifiedFileInfo* pVerified = nullptr);  // writes inflated data whose CRC is nCRC. Fails (removing the file) on CRC mismatch.
+    bool                    DecompressToFile(const std::string& sFilename, const std::string& sOutputFilename, Progress* pProgress = nullptr, VerifiedFileInfo* pVerified = nullptr);  // pVerified receives what was written
     bool                    DecompressToFolder(const std::string& sPattern, const std::string& sOutputFolder, Progress* pProgress = nullptr);
+    bool                    DecompressToArena(const std::string& sPattern, cZipArena& arena, Progress* pProgress = nullptr);     // every matching file into one allocation, in parallel. Files that fail are left out of the arena.
     bool                    ExtractRawStream(const std::string& sFilename, const std::string& sOutputFilename, Progress* pProgress = nullptr);
 
+    // Inflates an entry a chunk at a time into sink, any callable taking (const uint8_t* pData, size_t nBytes) and returning false to stop.
+    // Memory stays bounded (one read buffer plus the decompressor's output) whatever the entry's size and the sink is a template
+    // parameter so the per chunk call inlines. The CRC is checked after the sink has seen all the data.
+    template<typename Sink>
+    bool                    DecompressToSink(const std::string& sFilename, Sink&& sink, Progress* pProgress = nullptr);
+    template<typename Sink>
+    bool                    DecompressToSink(const cCDFileHeader& cdFileHeader, Sink&& sink, Progress* pProgress = nullptr);
+
+    bool                    OpenEntryStream(const std::string& sFilename, cZipEntryStream& entryStream, uint64_t nCheckpointSpacing = cZipEntryStream::kDefaultCheckpointSpacing);     // random access reader over one entry
+    bool                    OpenEntryAsFile(const std::string& sFilename, std::shared_ptr<cZZFile>& pFile);      // read only cZZFile over one entry. Pass to Init to open a zip nested inside this one.
+
     // Commands for creating new Zips
-    bool                    AddToZipFile(const std::string& sFilename, const std::string& sBaseFolder, Progress* pProgress = nullptr);  // Only usable if zip file was open with kZipCreate
+    bool                    AddToZipFile(const std::string& sFilename, const std::string& sBaseFolder, Progress* pProgress = nullptr);  // Only usable if zip file was open with kZipCreate, kZipModify or kZipCreateStream
     bool                    AddToZipFileFromBuffer(uint8_t* nInputBufferSize, uint32_t nBufferSize, const std::string& sFilename, Progress* pProgress = nullptr);       // filename is the relative path within the zipfile 
+    bool                    AddRawEntry(const cCDFileHeader& cdFileHeader, uint8_t* pCompressedStream);    // adds an already compressed stream. The entry's header (flags, attributes, extra fields...) comes from cdFileHeader.
+    bool                    AddRawEntry(ZZipAPI& sourceAPI, const cCDFileHeader& cdFileHeader);            // copies sourceAPI's entry unchanged (local extra fields too) a block at a time, so any size
+
+    // Commands for modifying existing Zips
+    uint64_t                GetWastedBytes();       // bytes in the archive no longer referenced by the CD (superseded entries and directories)
+    bool                    Compact();              // Only usable if zip file was open with kZipModify. Rewrites all live entries contiguously reclaiming wasted space.
 
 private:
     bool                    OpenForReading();
     bool                    CreateZipFile();
+    bool                    OpenForModify();
+
+    void                    ComputeArchiveValidator();
+    cZipEntryCache::cKey    GetCacheKey(const cCDFileHeader& cdFileHeader) const;
+    bool                    ReadAndInflate(const cCDFileHeader& cdFileHeader, uint8_t* pOutputBuffer, uint32_t* pCRC, Progress* pProgress);     // DecompressToBuffer without the cache
+    bool                    GetStreamOffset(const cCDFileHeader& cdFileHeader, uint64_t& nStreamOffset);      // archive offset of the entry's data (past its local header)
+    bool                    CopyStreamToFile(const cCDFileHeader& cdFileHeader, uint64_t nStreamOffset, const std::string& sOutputFilename, Progress* pProgress, uint32_t* pCRC);   // copies the raw stream. pCRC (if given) receives its CRC.
+    bool                    DecompressSegments(const cCDFileHeader& cdFileHeader, uint64_t nStreamOffset, const tFlushPointList& flushPoints, cZZFile& outFile, Progress* pProgress, uint32_t& nCRC);   // inflates the stretches between flush points concurrently. On failure the progress it reported is taken back.
+    bool                    DecompressStreamOverlapped(const cCDFileHeader& cdFileHeader, uint64_t nStreamOffset, cZZFile& outFile, Progress* pProgress, uint32_t& nCRC);     // inflates to outFile with read-ahead and write-behind threads
+    bool                    FinishOutputFile(cZZFile& outFile, const cCDFileHeader& cdFileHeader, const std::string& sOutputFilename, uint32_t nCRC, VerifiedFileInfo* pVerified);     // closes (flushes) the output then FinishVerifiedFile
+    bool                    FinishVerifiedFile(const cCDFileHeader& cdFileHeader, const std::string& sOutputFilename, uint32_t nCRC, VerifiedFileInfo* pVerified);
+    bool                    IsOpenForWriting() const { return mOpenType == kZipCreate || mOpenType == kZipModify || mOpenType == kZipCreateStream; }
+    bool                    BeginEntry(cLocalFileHeader& localHeader, uint64_t nOffsetToLocalFileHeader);     // when streaming, writes the local header ahead of the stream
+    bool                    FinishEntry(cLocalFileHeader& localHeader, uint64_t nOffsetToLocalFileHeader, const tFlushPointList* pFlushPoints = nullptr, const cCDFileHeader* pSourceCDHeader = nullptr);    // writes the local header (or data descriptor when streaming) and adds the CD entry
+    void                    AddCDEntry(const cLocalFileHeader& localHeader, uint64_t nOffsetToLocalFileHeader, const tFlushPointList* pFlushPoints = nullptr, const cCDFileHeader* pSourceCDHeader = nullptr);      // adds the entry to the CD, dropping any entry it supersedes. A copied entry starts from pSourceCDHeader.
+    bool                    CanCopyEntry(const cCDFileHeader& cdFileHeader);     // false for entries AddRawEntry can't write without damaging them
+    bool                    CopyEntryRaw(const cCDFileHeader& cdFileHeader, cZZFile& destFile, uint64_t nDestOffset, uint64_t& nBytesWritten);    // copies local header + compressed stream unchanged. The copy's sizes are in its header rather than a data descriptor (except encrypted entries).
 
-    eOpenType               mOpenType;              // kZipOpen or kZipCreate
+    eOpenType               mOpenType;              // kZipOpen, kZipCreate, kZipModify or kZipCreateStream
     int32_t                 mnCompressionLevel;     // Valid ranges from -1 (default) to 9.
+    uint64_t                mnFlushPointSpacing;
     std::string                 msZipURL;               // path to the zip archive or URL
     std::string                 msName;
     std::string                 msPassword;
     std::shared_ptr<cZZFile>     mpZZFile;               // Abstraction to local file or HTTP file
+    std::shared_ptr<cZipEntryCache> mpEntryCache;
+    uint64_t                mnArchiveValidator;     // hash of the archive's URL, size and modification time. Part of every cache key.
+    uint32_t                mnOutputFlags;          // cZZFileOutput flags
+    uint64_t                mnModifyStartSize;      // kZipModify: archive size when opened (or compacted). It ends with a valid CD.
+    uint64_t                mnModifyCDOffset;       // kZipModify: where that CD starts
+    bool                    mbCDChanged;            // kZipModify: the CD on disk is stale and Shutdown must write a new one
     cZipCD                  mZipCD;                 // Zip Central Directory including all headers
     bool                    mbInitted;
-};
\ No newline at end of file
+    bool                    mbVerifyCRC;            // verify CRC of extracted data inline
+};
+
+
+template<typename Sink>
+bool ZZipAPI::DecompressToSink(const std::string& sFilename, Sink&& sink, Progress* pProgress)
+{
+    if (!mbInitted)
+        return false;
+
+    cCDFileHeader cdFileHeader;
+    if (!mZipCD.GetFileHeader(sFilename, cdFileHeader))
+        return false;
+
+    return DecompressToSink(cdFileHeader, std::forward<Sink>(sink), pProgress);
+}
+
+template<typename Sink>
+bool ZZipAPI::DecompressToSink(const cCDFileHeader& cdFileHeader, Sink&& sink, Progress* pProgress)
+{
+    if (!mbInitted)
+        return false;
+
+    if (cdFileHeader.mCompressionMethod != 0 && cdFileHeader.mCompressionMethod != Z_DEFLATED)
+    {
+        std::cerr << "Unsupported compression method: " << cdFileHeader.mCompressionMethod << "\n";
+        return false;
+    }
+
+    uint64_t nStreamOffset = 0;
+    if (!GetStreamOffset(cdFileHeader, nStreamOffset))
+        return false;
+
+    const uint64_t kReadSize = 256 * 1024;
+    cPooledBuffer input((size_t)std::min<uint64_t>(kReadSize, cdFileHeader.mCompressedSize));
+
+    ZDecompressorPtr pDecompressor;
+    if (cdFileHeader.mCompressionMethod == Z_DEFLATED)
+        pDecompressor = cZCodecPool::AcquireDecompressor();
+
+    uint32_t nCRC = 0;
+    uint64_t nBytesOutput = 0;
+    uint64_t nCompressedBytesProcessed = 0;
+    while (nCompressedBytesProcessed < cdFileHeader.mCompressedSize)
+    {
+        uint32_t nBytesToRead = (uint32_t)std::min<uint64_t>(std::min<uint64_t>(kReadSize, input.Size()), cdFileHeader.mCompressedSize - nCompressedBytesProcessed);
+        uint32_t nBytesRead = 0;
+        if (!mpZZFile->Read(nStreamOffset + nCompressedBytesProcessed, nBytesToRead, input.Get(), nBytesRead) || nBytesRead != nBytesToRead)
+        {
+            std::cerr << "Failed to read compression stream for file " << cdFileHeader.mFileName << " at offset " << nStreamOffset + nCompressedBytesProcessed << "\n";
+            return false;
+        }
+        nCompressedBytesProcessed += nBytesRead;
+
+        // Stored data goes straight from the read buffer
+        if (!pDecompressor)
+        {
+            if (mbVerifyCRC)
+                nCRC = crc32_fast(input.Get(), nBytesRead, nCRC);
+            if (!sink((const uint8_t*)input.Get(), (size_t)nBytesRead))
+                return false;
+
+            nBytesOutput += nBytesRead;
+            if (pProgress)
+                pProgress->AddBytesProcessed(nBytesRead);
+            continue;
+        }
+
+        pDecompressor->InitStream(input.Get(), (int32_t)nBytesRead);
+        int32_t nStatus = Z_OK;
+        while (pDecompressor->HasMoreOutput())
+        {
+            nStatus = pDecompressor->Decompress();
+            if (nStatus < 0)
+                break;
+
+            uint32_t nDecompressedBytes = (uint32_t)pDecompressor->GetDecompressedBytes();
+            if (nDecompressedBytes > 0)
+            {
+                if (mbVerifyCRC)
+                    nCRC = crc32_fast(pDecompressor->GetDecompressedBuffer(), nDecompressedBytes, nCRC);
+                if (!sink((const uint8_t*)pDecompressor->GetDecompressedBuffer(), (size_t)nDecompressedBytes))
+                    return false;
+
+                nBytesOutput += nDecompressedBytes;
+                if (pProgress)
+                    pProgress->AddBytesProcessed(nDecompressedBytes);
+            }
+
+            if (nStatus == Z_STREAM_END)
+                break;
+        }
+
+        if (nStatus < 0)
+        {
+            std::cerr << "Decompress Error #:" << nStatus << " in \"" << cdFileHeader.mFileName << "\"\n";
+            return false;
+        }
+    }
+
+    if (nBytesOutput != cdFileHeader.mUncompressedSize)
+    {
+        std::cerr << "\"" << cdFileHeader.mFileName << "\" inflated to " << nBytesOutput << " bytes. Expected:" << cdFileHeader.mUncompressedSize << "\n";
+        return false;
+    }
+
+    if (mbVerifyCRC && nCRC != cdFileHeader.mCRC32)
+    {
+        std::cerr << "CRC mismatch extracting \"" << cdFileHeader.mFileName << "\". Expected:" << int_to_hex_string(cdFileHeader.mCRC32) << " Got:" << int_to_hex_string(nCRC) << "\n";
+        return false;
+    }
+
+    return true;
+}
@@ -13,6 +13,26 @@
 
 #pragma once
 
+#include <string>
+#include <ostream>
+#include <memory>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////////////
+// What extraction wrote and verified so that the result can be recorded (e.g. in a sync index) without reading the file again
+class VerifiedFileInfo
+{
+public:
+    VerifiedFileInfo() : mnSize(0), mnModificationTime(0), mnInode(0), mnCRC32(0), mbVerified(false) {}
+
+    std::string             msPath;
+    uint64_t                mnSize;
+    int64_t                 mnModificationTime;     // std::filesystem::file_time_type ticks after the write completed
+    uint64_t                mnInode;                // file id where the platform has one
+    uint32_t                mnCRC32;
+    bool                    mbVerified;             // CRC was computed and matched the CD
+};
+
 //////////////////////////////////////////////////////////////////////////////////////////
 class DecompressTaskResult
 {
@@ -28,14 +48,15 @@ public:
     };
 
     DecompressTaskResult() : mDecompressTaskStatus(kNone), mOSErrorCode(0), mBytesDownloaded(0), mBytesWrittenToDisk(0), mRetriesRemaining(0) {}
-    DecompressTaskResult(eDecompressTaskStatus nStatus, uint32_t nOSErrorCode, uint64_t nBytesDownloaded, uint64_t nBytesWrittenToDisk, int32_t retriesRemaining, const std::string& fileName, const std::string& result) :
+    DecompressTaskResult(eDecompressTaskStatus nStatus, uint32_t nOSErrorCode, uint64_t nBytesDownloaded, uint64_t nBytesWrittenToDisk, int32_t retriesRemaining, const std::string& fileName, const std::string& result, const VerifiedFileInfo& verified = VerifiedFileInfo()) :
         mDecompressTaskStatus(nStatus),
         mOSErrorCode(nOSErrorCode),
         mBytesDownloaded(nBytesDownloaded),
         mBytesWrittenToDisk(nBytesWrittenToDisk),
         mRetriesRemaining(retriesRemaining),
         mFilename(fileName),
-        mResult(result) {}
+        mResult(result),
+        mVerified(verified) {}
 
     friend std::ostream& operator << (std::ostream& os, const eDecompressTaskStatus& status)
     {
@@ -60,6 +81,7 @@ public:
     int32_t                 mRetriesRemaining;
     std::string                  mFilename;
     std::string                  mResult;
+    VerifiedFileInfo        mVerified;
 };
 
 //////////////////////////////////////////////////////////////////////////////////////////
@@ -112,6 +134,51 @@ public:
 
 };
 
+//////////////////////////////////////////////////////////////////////////////////////////
+class OptimizeTaskResult
+{
+public:
+    enum eOptimizeTaskStatus
+    {
+        kError = -1,
+        kNone = 0,
+        kRecompressed = 1,      // a stronger encoding was smaller than the original stream
+        kRawCopied = 2          // nothing beat the original stream so it's copied unchanged
+    };
+
+    OptimizeTaskResult() : mOptimizeTaskStatus(kNone), mnCompressionMethod(0), mnOriginalCompressedSize(0), mnNewCompressedSize(0) {}
+    OptimizeTaskResult(eOptimizeTaskStatus nStatus, const std::string& fileName, const std::string& sEncoding, uint16_t nCompressionMethod, uint64_t nOriginalCompressedSize, std::shared_ptr<std::vector<uint8_t> > pStream) :
+        mOptimizeTaskStatus(nStatus),
+        mFilename(fileName),
+        msEncoding(sEncoding),
+        mnCompressionMethod(nCompressionMethod),
+        mnOriginalCompressedSize(nOriginalCompressedSize),
+        mnNewCompressedSize(pStream ? pStream->size() : nOriginalCompressedSize),
+        mpStream(pStream) {}
+
+    friend std::ostream& operator << (std::ostream& os, const eOptimizeTaskStatus& status)
+    {
+        switch (status)
+        {
+        case kError:        os << "Error"; return os;
+        case kNone:         os << "None"; return os;
+        case kRecompressed: os << "Recompressed"; return os;
+        case kRawCopied:    os << "Raw Copied"; return os;
+        }
+        return os;
+    }
+
+    friend std::ostream& operator << (std::ostream& os, const OptimizeTaskResult& result) { os << "Filename:" << result.mFilename << " Status:" << result.mOptimizeTaskStatus << " Encoding:" << result.msEncoding << " Original:" << result.mnOriginalCompressedSize << " New:" << result.mnNewCompressedSize; return os; }
+
+    eOptimizeTaskStatus                     mOptimizeTaskStatus;
+    std::string                             mFilename;
+    std::string                             msEncoding;                 // which encoder/strategy produced the stream
+    uint16_t                                mnCompressionMethod;
+    uint64_t                                mnOriginalCompressedSize;
+    uint64_t                                mnNewCompressedSize;
+    std::shared_ptr<std::vector<uint8_t> >  mpStream;                   // stream to write for the entry. nullptr for a kRawCopied entry to copy straight from the source archive.
+};
+
 //////////////////////////////////////////////////////////////////////////////////////////
 class Progress
 {
@@ -156,6 +223,12 @@ public:
         mnBytesProcessed += nBytes;
     }
 
+    // takes back work reported by an attempt that has to be redone
+    void RemoveBytesProcessed(uint64_t nBytes)
+    {
+        mnBytesProcessed -= nBytes;
+    }
+
 
     uint64_t GetElapsedTimeMS()
     {
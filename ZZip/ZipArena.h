@@ -0,0 +1,77 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// ZipArena
+// Purpose: A single allocation holding the decompressed contents of many entries, filled by
+//          ZZipAPI::DecompressToArena. Each entry is a slice of the arena looked up by name. Slices stay
+//          valid until the arena is cleared, refilled or destroyed.
+//
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <memory>
+#include <unordered_map>
+
+class cZipArena
+{
+public:
+    static const uint64_t kSliceAlignment = 64;     // every slice starts on a cache line
+
+    class cSlice
+    {
+    public:
+        cSlice() : mpData(nullptr), mnSize(0) {}
+        cSlice(const uint8_t* pData, uint64_t nSize) : mpData(pData), mnSize(nSize) {}
+        const uint8_t*  mpData;
+        uint64_t        mnSize;
+    };
+
+    typedef std::unordered_map<std::string, cSlice> tSliceMap;
+
+    cZipArena() : mpBase(nullptr), mnSize(0) {}
+
+    bool                Find(const std::string& sFilename, cSlice& slice) const
+    {
+        auto it = mSlices.find(sFilename);
+        if (it == mSlices.end())
+            return false;
+        slice = it->second;
+        return true;
+    }
+
+    const tSliceMap&    GetSlices() const { return mSlices; }
+    uint64_t            GetSize() const { return mnSize; }        // bytes of the arena in use, including alignment padding
+
+    void                Clear()
+    {
+        mSlices.clear();
+        mpAllocation.reset();
+        mpBase = nullptr;
+        mnSize = 0;
+    }
+
+private:
+    friend class ZZipAPI;
+
+    uint8_t*            Allocate(uint64_t nSize)
+    {
+        Clear();
+        mpAllocation.reset(new uint8_t[(size_t)(nSize + kSliceAlignment)]);
+        mpBase = (uint8_t*)(((uintptr_t)mpAllocation.get() + kSliceAlignment - 1) & ~(uintptr_t)(kSliceAlignment - 1));
+        mnSize = nSize;
+        return mpBase;
+    }
+
+    std::unique_ptr<uint8_t[]>  mpAllocation;
+    uint8_t*            mpBase;             // mpAllocation rounded up to kSliceAlignment
+    uint64_t            mnSize;
+    tSliceMap           mSlices;
+};
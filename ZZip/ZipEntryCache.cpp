@@ -0,0 +1,211 @@
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "ZipEntryCache.h"
+#include <string.h>
+
+using namespace std;
+
+const uint64_t kSketchAgingSamples = cZipEntryCache::kSketchWidth * 8;    // halve every counter after this many accesses so old popularity fades
+const uint8_t kSketchMaxCount = 15;
+
+static uint64_t Mix64(uint64_t n)
+{
+    // splitmix64 finalizer
+    n ^= n >> 30;
+    n *= 0xbf58476d1ce4e5b9ULL;
+    n ^= n >> 27;
+    n *= 0x94d049bb133111ebULL;
+    n ^= n >> 31;
+    return n;
+}
+
+uint64_t cZipEntryCache::cKey::Hash() const
+{
+    uint64_t nHash = Mix64(mnArchiveValidator);
+    nHash = Mix64(nHash ^ mnOffset);
+    nHash = Mix64(nHash ^ mnSize);
+    nHash = Mix64(nHash ^ mnCRC32);
+    return nHash;
+}
+
+void cZipEntryCache::cShard::RecordAccess(uint64_t nHash)
+{
+    uint32_t nA = (uint32_t)nHash;
+    uint32_t nB = (uint32_t)(nHash >> 32) | 1;
+    for (uint32_t nRow = 0; nRow < kSketchDepth; nRow++)
+    {
+        uint8_t& nCount = mSketch[nRow * kSketchWidth + ((nA + nRow * nB) & (kSketchWidth - 1))];
+        if (nCount < kSketchMaxCount)
+            nCount++;
+    }
+
+    if (++mnSamples >= kSketchAgingSamples)
+    {
+        for (uint8_t& nCount : mSketch)
+            nCount >>= 1;
+        mnSamples /= 2;
+    }
+}
+
+uint32_t cZipEntryCache::cShard::Frequency(uint64_t nHash) const
+{
+    uint32_t nA = (uint32_t)nHash;
+    uint32_t nB = (uint32_t)(nHash >> 32) | 1;
+    uint32_t nFrequency = kSketchMaxCount;
+    for (uint32_t nRow = 0; nRow < kSketchDepth; nRow++)
+    {
+        uint32_t nCount = mSketch[nRow * kSketchWidth + ((nA + nRow * nB) & (kSketchWidth - 1))];
+        if (nCount < nFrequency)
+            nFrequency = nCount;
+    }
+    return nFrequency;
+}
+
+cZipEntryCache::cZipEntryCache(uint64_t nCapacityBytes) : mnShardCapacity(nCapacityBytes / kNumShards), mnHits(0), mnMisses(0), mnInsertions(0), mnRejections(0), mnEvictions(0)
+{
+}
+
+bool cZipEntryCache::Lookup(const cKey& key, cEntry& entry)
+{
+    uint64_t nHash = key.Hash();
+    cShard& shard = ShardFor(nHash);
+
+    std::lock_guard<std::mutex> lock(shard.mMutex);
+    shard.RecordAccess(nHash);
+
+    auto it = shard.mIndex.find(key);
+    if (it == shard.mIndex.end())
+    {
+        mnMisses++;
+        return false;
+    }
+
+    shard.mLRU.splice(shard.mLRU.begin(), shard.mLRU, it->second);
+    entry = cEntry(it->second->mpData, it->second->mnSize);
+    mnHits++;
+    return true;
+}
+
+bool cZipEntryCache::Admit(cShard& shard, uint64_t nHash, uint64_t nSize, vector<shared_ptr<const uint8_t> >* pEvicted)
+{
+    if (nSize > mnShardCapacity)
+        return false;
+
+    // Walk victims from the cold end. Each one the new entry would displace must be less popular than it.
+    uint32_t nFrequency = shard.Frequency(nHash);
+    uint64_t nBytes = shard.mnBytes;
+    size_t nVictims = 0;
+    for (auto it = shard.mLRU.rbegin(); it != shard.mLRU.rend() && nBytes + nSize > mnShardCapacity; it++)
+    {
+        if (shard.Frequency(it->mKey.Hash()) >= nFrequency)
+            return false;
+
+        nBytes -= it->mnSize;
+        nVictims++;
+    }
+
+    if (!pEvicted)
+        return true;
+
+    for (size_t i = 0; i < nVictims; i++)
+    {
+        cCached& victim = shard.mLRU.back();
+        shard.mIndex.erase(victim.mKey);
+        shard.mnBytes -= victim.mnSize;
+        pEvicted->push_back(victim.mpData);      // freed once the lock is dropped
+        shard.mLRU.pop_back();
+    }
+
+    mnEvictions += nVictims;
+    return true;
+}
+
+bool cZipEntryCache::Insert(const cKey& key, const uint8_t* pData, uint64_t nSize)
+{
+    uint64_t nHash = key.Hash();
+    cShard& shard = ShardFor(nHash);
+
+    // Decide before paying for the copy
+    {
+        std::lock_guard<std::mutex> lock(shard.mMutex);
+        if (shard.mIndex.find(key) != shard.mIndex.end())
+            return true;
+
+        if (!Admit(shard, nHash, nSize, nullptr))
+        {
+            mnRejections++;
+            return false;
+        }
+    }
+
+    uint8_t* pCopy = new uint8_t[nSize ? (size_t)nSize : 1];
+    memcpy(pCopy, pData, (size_t)nSize);
+    return Insert(key, shared_ptr<const uint8_t>(pCopy, std::default_delete<const uint8_t[]>()), nSize);
+}
+
+bool cZipEntryCache::Insert(const cKey& key, shared_ptr<const uint8_t> pData, uint64_t nSize)
+{
+    uint64_t nHash = key.Hash();
+    cShard& shard = ShardFor(nHash);
+
+    vector<shared_ptr<const uint8_t> > evicted;
+    std::lock_guard<std::mutex> lock(shard.mMutex);
+    if (shard.mIndex.find(key) != shard.mIndex.end())
+        return true;
+
+    if (!Admit(shard, nHash, nSize, &evicted))
+    {
+        mnRejections++;
+        return false;
+    }
+
+    cCached cached;
+    cached.mKey = key;
+    cached.mpData = pData;
+    cached.mnSize = nSize;
+    shard.mLRU.push_front(cached);
+    shard.mIndex[key] = shard.mLRU.begin();
+    shard.mnBytes += nSize;
+    mnInsertions++;
+    return true;
+}
+
+void cZipEntryCache::Clear()
+{
+    for (cShard& shard : mShards)
+    {
+        tLRUList released;
+        {
+            std::lock_guard<std::mutex> lock(shard.mMutex);
+            shard.mIndex.clear();
+            released.swap(shard.mLRU);
+            shard.mnBytes = 0;
+        }
+    }
+}
+
+cZipEntryCache::cStats cZipEntryCache::GetStats() const
+{
+    cStats stats;
+    stats.mnHits = mnHits;
+    stats.mnMisses = mnMisses;
+    stats.mnInsertions = mnInsertions;
+    stats.mnRejections = mnRejections;
+    stats.mnEvictions = mnEvictions;
+
+    for (const cShard& shard : mShards)
+    {
+        std::lock_guard<std::mutex> lock(const_cast<std::mutex&>(shard.mMutex));
+        stats.mnEntries += shard.mLRU.size();
+        stats.mnBytes += shard.mnBytes;
+    }
+
+    return stats;
+}
@@ -0,0 +1,137 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// ZipEntryCache
+// Purpose: Size bounded in-process cache of decompressed entries for callers that read the same entries over
+//          and over. Entries are keyed by archive validator (path, size and modification time) plus the entry's
+//          offset, size and CRC so a changed archive never serves stale data. The cache is split into shards, each
+//          with its own lock, LRU list and TinyLFU frequency sketch. A new entry only displaces entries that have
+//          been asked for less often than it has, so a burst of one-off reads (or one big entry) can't flush out
+//          the hot set. Cached data is handed out as shared read-only buffers without copying.
+//          One cache can be shared by any number of ZZipAPI instances and threads.
+//
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <list>
+#include <vector>
+#include <unordered_map>
+
+class cZipEntryCache
+{
+public:
+    static const uint32_t kNumShards = 16;
+    static const uint32_t kSketchWidth = 4096;      // counters per sketch row (per shard)
+    static const uint32_t kSketchDepth = 4;
+
+    class cKey
+    {
+    public:
+        cKey() : mnArchiveValidator(0), mnOffset(0), mnSize(0), mnCRC32(0) {}
+        cKey(uint64_t nArchiveValidator, uint64_t nOffset, uint64_t nSize, uint32_t nCRC32) : mnArchiveValidator(nArchiveValidator), mnOffset(nOffset), mnSize(nSize), mnCRC32(nCRC32) {}
+
+        bool        operator==(const cKey& other) const { return mnArchiveValidator == other.mnArchiveValidator && mnOffset == other.mnOffset && mnSize == other.mnSize && mnCRC32 == other.mnCRC32; }
+        uint64_t    Hash() const;
+
+        uint64_t    mnArchiveValidator;
+        uint64_t    mnOffset;               // local file header offset
+        uint64_t    mnSize;                 // uncompressed
+        uint32_t    mnCRC32;
+    };
+
+    // Read-only view of cached data. Keeps the data alive after the cache evicts it.
+    class cEntry
+    {
+    public:
+        cEntry() : mnSize(0) {}
+        cEntry(std::shared_ptr<const uint8_t> pData, uint64_t nSize) : mpData(pData), mnSize(nSize) {}
+
+        const uint8_t*  Data() const { return mpData.get(); }
+        uint64_t        Size() const { return mnSize; }
+        bool            Valid() const { return mpData != nullptr || mnSize == 0; }
+
+    private:
+        std::shared_ptr<const uint8_t> mpData;
+        uint64_t        mnSize;
+    };
+
+    class cStats
+    {
+    public:
+        cStats() : mnHits(0), mnMisses(0), mnInsertions(0), mnRejections(0), mnEvictions(0), mnEntries(0), mnBytes(0) {}
+        double      HitRate() const { return (mnHits + mnMisses) ? (double)mnHits / (double)(mnHits + mnMisses) : 0.0; }
+
+        uint64_t    mnHits;
+        uint64_t    mnMisses;
+        uint64_t    mnInsertions;
+        uint64_t    mnRejections;           // turned away by the admission policy (or too big for a shard)
+        uint64_t    mnEvictions;
+        uint64_t    mnEntries;
+        uint64_t    mnBytes;
+    };
+
+    explicit cZipEntryCache(uint64_t nCapacityBytes);
+
+    bool        Lookup(const cKey& key, cEntry& entry);                            // counts as an access for admission whether or not it hits
+    bool        Insert(const cKey& key, const uint8_t* pData, uint64_t nSize);     // copies the data only if it's admitted
+    bool        Insert(const cKey& key, std::shared_ptr<const uint8_t> pData, uint64_t nSize);
+    void        Clear();
+
+    cStats      GetStats() const;
+    uint64_t    GetCapacity() const { return mnShardCapacity * kNumShards; }
+
+private:
+    class cKeyHash
+    {
+    public:
+        size_t operator()(const cKey& key) const { return (size_t)key.Hash(); }
+    };
+
+    class cCached
+    {
+    public:
+        cKey                            mKey;
+        std::shared_ptr<const uint8_t>  mpData;
+        uint64_t                        mnSize;
+    };
+
+    typedef std::list<cCached> tLRUList;       // most recently used first
+
+    class cShard
+    {
+    public:
+        cShard() : mnBytes(0), mnSamples(0), mSketch(kSketchWidth * kSketchDepth, 0) {}
+
+        void        RecordAccess(uint64_t nHash);
+        uint32_t    Frequency(uint64_t nHash) const;
+
+        std::mutex  mMutex;
+        tLRUList    mLRU;
+        std::unordered_map<cKey, tLRUList::iterator, cKeyHash> mIndex;
+        uint64_t    mnBytes;
+        uint64_t    mnSamples;                  // accesses since the sketch was last aged
+        std::vector<uint8_t> mSketch;           // count-min sketch of access frequency. Counters saturate at 15.
+    };
+
+    cShard&     ShardFor(uint64_t nHash) { return mShards[(nHash >> 56) % kNumShards]; }      // top bits. The sketch indexes with the low ones.
+    bool        Admit(cShard& shard, uint64_t nHash, uint64_t nSize, std::vector<std::shared_ptr<const uint8_t> >* pEvicted);     // under the shard lock. Makes room (unless pEvicted is null) or returns false if the entry loses to what it would displace.
+
+    uint64_t    mnShardCapacity;
+    cShard      mShards[kNumShards];
+
+    std::atomic<uint64_t>   mnHits;
+    std::atomic<uint64_t>   mnMisses;
+    std::atomic<uint64_t>   mnInsertions;
+    std::atomic<uint64_t>   mnRejections;
+    std::atomic<uint64_t>   mnEvictions;
+};
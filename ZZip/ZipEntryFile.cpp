@@ -0,0 +1,111 @@
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "ZipEntryFile.h"
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+
+bool cZipEntryFile::Open(shared_ptr<cZZFile> pArchive, const cCDFileHeader& cdFileHeader, shared_ptr<cZZFile>& pFile, uint64_t nCheckpointSpacing)
+{
+    cZipEntryFile* pNewFile = new cZipEntryFile();
+    pFile.reset(pNewFile);
+
+    pNewFile->msPath = cdFileHeader.mFileName;
+    pNewFile->mpArchive = pArchive;
+    pNewFile->mnFileSize = cdFileHeader.mUncompressedSize;
+    pNewFile->mbStored = cdFileHeader.mCompressionMethod == 0;
+
+    if (!pNewFile->mbStored)
+        return pNewFile->mEntryStream.Open(pArchive, cdFileHeader, nCheckpointSpacing);
+
+    cLocalFileHeader localFileHeader;
+    uint32_t nNumBytesProcessed = 0;
+    if (!localFileHeader.Read(*pArchive, cdFileHeader.mLocalFileHeaderOffset, nNumBytesProcessed))
+    {
+        cerr << "Failed to read localFileHeader for \"" << cdFileHeader.mFileName.c_str() << "\"\n";
+        return false;
+    }
+
+    pNewFile->mnStreamOffset = cdFileHeader.mLocalFileHeaderOffset + nNumBytesProcessed;
+    if (pNewFile->mnStreamOffset + cdFileHeader.mUncompressedSize > pArchive->GetFileSize())
+    {
+        cerr << "Entry \"" << cdFileHeader.mFileName.c_str() << "\" runs past the end of the archive.\n";
+        return false;
+    }
+
+    return true;
+}
+
+cZipEntryFile::cZipEntryFile() : cZZFile(), mbStored(false), mnStreamOffset(0), mnPosition(0)
+{
+    mbVerbose = false;
+}
+
+cZipEntryFile::~cZipEntryFile()
+{
+    cZipEntryFile::Close();
+}
+
+bool cZipEntryFile::OpenInternal(string, uint32_t, string, string, bool)
+{
+    std::cerr << "cZipEntryFile is opened from an archive entry with cZipEntryFile::Open." << std::endl;
+    return false;
+}
+
+bool cZipEntryFile::Close()
+{
+    std::unique_lock<mutex> lock(mMutex);
+    mEntryStream.Close();
+    mpArchive.reset();
+    return true;
+}
+
+bool cZipEntryFile::Read(int64_t nOffset, uint32_t nBytes, uint8_t* pDestination, uint32_t& nBytesRead)
+{
+    std::unique_lock<mutex> lock(mMutex);
+    nBytesRead = 0;
+
+    if (!mpArchive)
+        return false;
+
+    uint64_t nPosition = (nOffset == ZZFILE_NO_SEEK) ? mnPosition : (uint64_t)nOffset;
+    if (nPosition >= mnFileSize)
+    {
+        mnPosition = nPosition;
+        return nBytes == 0;         // same as a local file read at EOF
+    }
+
+    uint32_t nToRead = (uint32_t)std::min<uint64_t>(nBytes, mnFileSize - nPosition);
+
+    bool bResult;
+    if (mbStored)
+    {
+        // Straight through to the outer file. Its reads lock themselves so this doesn't need ours.
+        shared_ptr<cZZFile> pArchive(mpArchive);
+        lock.unlock();
+        bResult = pArchive->Read(mnStreamOffset + nPosition, nToRead, pDestination, nBytesRead);
+        lock.lock();
+    }
+    else
+    {
+        bResult = mEntryStream.Read(nPosition, nToRead, pDestination, nBytesRead);
+    }
+
+    if (bResult)
+        mnPosition = nPosition + nBytesRead;
+    return bResult;
+}
+
+bool cZipEntryFile::Write(int64_t, uint32_t, uint8_t*, uint32_t&)
+{
+    std::cerr << "cZipEntryFile does not support writing." << std::endl;
+    return false;
+}
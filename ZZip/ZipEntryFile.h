@@ -0,0 +1,55 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// ZipEntryFile
+// Purpose: A read only cZZFile over one entry of an open archive, so a zip stored inside a zip can be opened
+//          by ZZipAPI (or anything else reading a cZZFile) without extracting it first.
+//          Stored entries forward reads straight to the entry's range of the outer file. Deflated entries go
+//          through a cZipEntryStream, whose checkpoint index lets the random reads cZipCD makes resume near
+//          their target rather than inflating from the top. Either way only the bytes touched are fetched,
+//          which matters when the outer archive is served over HTTP.
+//
+// Usage:   shared_ptr<cZZFile> pInner;
+//          if (cZipEntryFile::Open(pOuterFile, cdFileHeader, pInner))
+//              innerZip.Init(pInner, "bundle.zip/pack.zip");
+//
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include "ZipHeaders.h"
+#include "ZipEntryStream.h"
+#include "common/ZZFileAPI.h"
+
+class cZipEntryFile : public cZZFile
+{
+public:
+    // Factory Construction. pArchive must stay open while the entry file is in use.
+    static bool     Open(std::shared_ptr<cZZFile> pArchive, const cCDFileHeader& cdFileHeader, std::shared_ptr<cZZFile>& pFile, uint64_t nCheckpointSpacing = cZipEntryStream::kDefaultCheckpointSpacing);
+
+    ~cZipEntryFile();
+
+    virtual bool    Close();
+    virtual bool    Read(int64_t nOffset, uint32_t nBytes, uint8_t* pDestination, uint32_t& nBytesRead);
+    virtual bool    Write(int64_t, uint32_t, uint8_t*, uint32_t&);    // not permitted
+
+protected:
+    cZipEntryFile();    // private constructor.... use cZipEntryFile::Open factory function for construction
+
+    virtual bool    OpenInternal(std::string sURL, uint32_t nOpenMode, std::string sName, std::string sPassword, bool bVerbose);    // not permitted. There's no URL for an entry.
+
+    std::shared_ptr<cZZFile>    mpArchive;
+    bool            mbStored;
+    uint64_t        mnStreamOffset;     // archive offset of a stored entry's data
+    uint64_t        mnPosition;         // for ZZFILE_NO_SEEK reads
+    cZipEntryStream mEntryStream;       // deflated entries
+    std::mutex      mMutex;
+};
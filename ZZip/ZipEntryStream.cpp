@@ -0,0 +1,487 @@
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "ZipEntryStream.h"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <string.h>
+#include "common/CrC32Fast.h"
+
+using namespace std;
+
+const uint32_t kEntryStreamInputSize = 256 * 1024;     // compressed bytes fetched per read. Large enough to keep HTTP requests few.
+
+const char kEntryIndexHeader[8] = { 'Z', 'Z', 'S', 'E', 'E', 'K', '1', 0 };
+
+cZipEntryStream::cZipEntryStream() : mnStreamOffset(0), mnPosition(0), mnCheckpointSpacing(kDefaultCheckpointSpacing), mbStreamInitted(false), mbStreamEnded(false),
+    mnDecodedOffset(0), mnInputOffset(0), mnWindowPos(0), mnCRC(0), mbCRCValid(false)
+{
+    memset(&mStream, 0, sizeof(mStream));
+}
+
+cZipEntryStream::~cZipEntryStream()
+{
+    Close();
+}
+
+bool cZipEntryStream::Open(std::shared_ptr<cZZFile> pZipFile, const cCDFileHeader& cdFileHeader, uint64_t nCheckpointSpacing)
+{
+    Close();
+
+    if (!pZipFile)
+        return false;
+
+    if (cdFileHeader.mCompressionMethod != 0 && cdFileHeader.mCompressionMethod != Z_DEFLATED)
+    {
+        cerr << "Unsupported compression method:" << cdFileHeader.mCompressionMethod << " for \"" << cdFileHeader.mFileName << "\"\n";
+        return false;
+    }
+
+    cLocalFileHeader localFileHeader;
+    uint32_t nNumBytesProcessed = 0;
+    if (!localFileHeader.Read(*pZipFile, cdFileHeader.mLocalFileHeaderOffset, nNumBytesProcessed))
+    {
+        cerr << "Failed to read localFileHeader for \"" << cdFileHeader.mFileName << "\"\n";
+        return false;
+    }
+
+    mpZipFile = pZipFile;
+    mCDFileHeader = cdFileHeader;
+    mnStreamOffset = cdFileHeader.mLocalFileHeaderOffset + nNumBytesProcessed;
+    mnPosition = 0;
+    mnCheckpointSpacing = nCheckpointSpacing ? nCheckpointSpacing : kDefaultCheckpointSpacing;
+
+    if (cdFileHeader.mCompressionMethod == Z_DEFLATED)
+    {
+        mInput.Acquire(kEntryStreamInputSize);
+        mWindow.Acquire(kWindowSize);
+        if (!ResetDecoder(nullptr))
+        {
+            Close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void cZipEntryStream::Close()
+{
+    if (mbStreamInitted)
+        inflateEnd(&mStream);
+    memset(&mStream, 0, sizeof(mStream));
+    mbStreamInitted = false;
+    mbStreamEnded = false;
+
+    mpZipFile.reset();
+    mCheckpoints.clear();
+    mInput.Release();
+    mWindow.Release();
+    mnStreamOffset = 0;
+    mnPosition = 0;
+    mnDecodedOffset = 0;
+    mnInputOffset = 0;
+    mnWindowPos = 0;
+    mbCRCValid = false;
+}
+
+bool cZipEntryStream::Seek(uint64_t nOffset)
+{
+    if (!mpZipFile || nOffset > mCDFileHeader.mUncompressedSize)
+        return false;
+
+    mnPosition = nOffset;     // the decoder catches up on the next Read
+    return true;
+}
+
+bool cZipEntryStream::Read(uint64_t nOffset, uint32_t nBytes, uint8_t* pDestination, uint32_t& nBytesRead)
+{
+    nBytesRead = 0;
+    if (!Seek(nOffset))
+        return false;
+
+    return Read(pDestination, nBytes, nBytesRead);
+}
+
+bool cZipEntryStream::Read(uint8_t* pDestination, uint32_t nBytes, uint32_t& nBytesRead)
+{
+    nBytesRead = 0;
+    if (!mpZipFile)
+        return false;
+
+    nBytes = (uint32_t)std::min<uint64_t>(nBytes, mCDFileHeader.mUncompressedSize - mnPosition);
+    if (nBytes == 0)
+        return true;
+
+    if (mCDFileHeader.mCompressionMethod == 0)
+    {
+        uint32_t nRead = 0;
+        if (!mpZipFile->Read(mnStreamOffset + mnPosition, nBytes, pDestination, nRead) || nRead != nBytes)
+        {
+            cerr << "Failed to read " << nBytes << " bytes of \"" << mCDFileHeader.mFileName << "\" at offset " << mnPosition << "\n";
+            return false;
+        }
+
+        mnPosition += nBytes;
+        nBytesRead = nBytes;
+        return true;
+    }
+
+    // Restart from the nearest checkpoint at or before the position unless the decoder is already between it and the position
+    auto it = std::upper_bound(mCheckpoints.begin(), mCheckpoints.end(), mnPosition, [](uint64_t nOffset, const cCheckpoint& checkpoint) { return nOffset < checkpoint.mnUncompressedOffset; });
+    const cCheckpoint* pCheckpoint = (it == mCheckpoints.begin()) ? nullptr : &*(it - 1);
+    uint64_t nCheckpointOffset = pCheckpoint ? pCheckpoint->mnUncompressedOffset : 0;
+
+    if (mbStreamEnded || mnDecodedOffset > mnPosition || mnDecodedOffset < nCheckpointOffset)
+    {
+        if (!ResetDecoder(pCheckpoint))
+            return false;
+    }
+
+    uint64_t nProduced = 0;
+    if (mnDecodedOffset < mnPosition)
+    {
+        uint64_t nSkip = mnPosition - mnDecodedOffset;
+        if (!Inflate(nullptr, nSkip, nProduced) || nProduced != nSkip)
+            return false;
+    }
+
+    if (!Inflate(pDestination, nBytes, nProduced))
+        return false;
+
+    if (nProduced != nBytes)
+    {
+        cerr << "Compressed stream for \"" << mCDFileHeader.mFileName << "\" ended at " << mnDecodedOffset << " bytes. Expected:" << mCDFileHeader.mUncompressedSize << "\n";
+        return false;
+    }
+
+    mnPosition += nBytes;
+    nBytesRead = nBytes;
+    return true;
+}
+
+bool cZipEntryStream::BuildIndex()
+{
+    if (!mpZipFile)
+        return false;
+
+    if (mCDFileHeader.mCompressionMethod == 0)
+        return true;        // nothing to index
+
+    // carry on from wherever indexing got to
+    const cCheckpoint* pLast = mCheckpoints.empty() ? nullptr : &mCheckpoints.back();
+    if (mbStreamEnded || mnDecodedOffset < (pLast ? pLast->mnUncompressedOffset : 0))
+    {
+        if (!ResetDecoder(pLast))
+            return false;
+    }
+
+    uint64_t nRemaining = mCDFileHeader.mUncompressedSize - mnDecodedOffset;
+    uint64_t nProduced = 0;
+    if (!Inflate(nullptr, nRemaining, nProduced))
+        return false;
+
+    if (nProduced != nRemaining)
+    {
+        cerr << "Compressed stream for \"" << mCDFileHeader.mFileName << "\" ended at " << mnDecodedOffset << " bytes. Expected:" << mCDFileHeader.mUncompressedSize << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+bool cZipEntryStream::ResetDecoder(const cCheckpoint* pCheckpoint)
+{
+    if (!mbStreamInitted)
+    {
+        memset(&mStream, 0, sizeof(mStream));
+        if (inflateInit2(&mStream, -MAX_WBITS) != Z_OK)
+        {
+            cerr << "Failed to initialize inflate for \"" << mCDFileHeader.mFileName << "\"\n";
+            return false;
+        }
+        mbStreamInitted = true;
+    }
+    else if (inflateReset(&mStream) != Z_OK)
+    {
+        cerr << "Failed to reset inflate for \"" << mCDFileHeader.mFileName << "\"\n";
+        return false;
+    }
+
+    mStream.next_in = nullptr;
+    mStream.avail_in = 0;
+    mbStreamEnded = false;
+    mnWindowPos = 0;
+
+    if (!pCheckpoint)
+    {
+        memset(mWindow.Get(), 0, kWindowSize);     // checkpoints taken before the first 32KB include the unused part of the window
+        mnDecodedOffset = 0;
+        mnInputOffset = 0;
+        mnCRC = 0;
+        mbCRCValid = true;
+        return true;
+    }
+
+    mbCRCValid = false;
+    mnDecodedOffset = pCheckpoint->mnUncompressedOffset;
+    mnInputOffset = pCheckpoint->mnCompressedOffset - (pCheckpoint->mnBits ? 1 : 0);
+
+    if (pCheckpoint->mnBits)
+    {
+        // the checkpoint lands mid byte. Feed the decoder the bits of that byte it hadn't consumed.
+        if (!FillInput())
+            return false;
+        int nByte = *mStream.next_in;
+        mStream.next_in++;
+        mStream.avail_in--;
+        inflatePrime(&mStream, pCheckpoint->mnBits, nByte >> (8 - pCheckpoint->mnBits));
+    }
+
+    uLongf nWindowSize = kWindowSize;
+    if (uncompress(mWindow.Get(), &nWindowSize, pCheckpoint->mWindow.data(), (uLong)pCheckpoint->mWindow.size()) != Z_OK || nWindowSize != kWindowSize ||
+        inflateSetDictionary(&mStream, mWindow.Get(), kWindowSize) != Z_OK)
+    {
+        cerr << "Failed to restore checkpoint at offset " << pCheckpoint->mnUncompressedOffset << " of \"" << mCDFileHeader.mFileName << "\"\n";
+        return false;
+    }
+
+    return true;
+}
+
+bool cZipEntryStream::FillInput()
+{
+    uint64_t nRemaining = mCDFileHeader.mCompressedSize - mnInputOffset;
+    if (nRemaining == 0)
+    {
+        cerr << "Compressed stream for \"" << mCDFileHeader.mFileName << "\" is truncated.\n";
+        return false;
+    }
+
+    uint32_t nToRead = (uint32_t)std::min<uint64_t>(mInput.Size(), nRemaining);
+    uint32_t nRead = 0;
+    if (!mpZipFile->Read(mnStreamOffset + mnInputOffset, nToRead, mInput.Get(), nRead) || nRead == 0)
+    {
+        cerr << "Failed to read compression stream for \"" << mCDFileHeader.mFileName << "\" at offset " << mnStreamOffset + mnInputOffset << "\n";
+        return false;
+    }
+
+    mStream.next_in = mInput.Get();
+    mStream.avail_in = nRead;
+    mnInputOffset += nRead;
+    return true;
+}
+
+bool cZipEntryStream::Inflate(uint8_t* pDestination, uint64_t nBytes, uint64_t& nProduced)
+{
+    nProduced = 0;
+    while (nProduced < nBytes && !mbStreamEnded)
+    {
+        if (mStream.avail_in == 0 && !FillInput())
+            return false;
+
+        // Everything decoded passes through the window ring so that its last 32KB are at hand for a checkpoint
+        uint8_t* pOut = mWindow.Get() + mnWindowPos;
+        uint32_t nAvail = (uint32_t)std::min<uint64_t>(kWindowSize - mnWindowPos, nBytes - nProduced);
+        mStream.next_out = pOut;
+        mStream.avail_out = nAvail;
+
+        int nResult = inflate(&mStream, Z_BLOCK);     // returns at each block boundary
+        if (nResult != Z_OK && nResult != Z_STREAM_END && nResult != Z_BUF_ERROR)
+        {
+            cerr << "Failed to inflate \"" << mCDFileHeader.mFileName << "\" at offset " << mnDecodedOffset << ". Error:" << nResult << "\n";
+            return false;
+        }
+
+        uint32_t nOut = nAvail - mStream.avail_out;
+        if (nOut > 0)
+        {
+            if (mbCRCValid)
+                mnCRC = crc32_fast(pOut, nOut, mnCRC);
+            if (pDestination)
+                memcpy(pDestination + nProduced, pOut, nOut);
+
+            nProduced += nOut;
+            mnDecodedOffset += nOut;
+            mnWindowPos = (mnWindowPos + nOut) % kWindowSize;
+
+            if (mbCRCValid && mnDecodedOffset == mCDFileHeader.mUncompressedSize)
+            {
+                mbCRCValid = false;     // checked
+                if (mnCRC != mCDFileHeader.mCRC32)
+                {
+                    cerr << "CRC mismatch reading \"" << mCDFileHeader.mFileName << "\". Expected:0x" << std::hex << mCDFileHeader.mCRC32 << " Got:0x" << mnCRC << std::dec << "\n";
+                    return false;
+                }
+            }
+        }
+
+        if (nResult == Z_STREAM_END)
+        {
+            mbStreamEnded = true;
+            break;
+        }
+
+        // end of a block that isn't the last one
+        if ((mStream.data_type & 128) && !(mStream.data_type & 64))
+        {
+            uint64_t nNextCheckpoint = (mCheckpoints.empty() ? 0 : mCheckpoints.back().mnUncompressedOffset) + mnCheckpointSpacing;
+            if (mnDecodedOffset >= nNextCheckpoint)
+                AddCheckpoint(mStream.data_type & 7);
+        }
+    }
+
+    return true;
+}
+
+void cZipEntryStream::AddCheckpoint(uint32_t nBits)
+{
+    cCheckpoint checkpoint;
+    checkpoint.mnUncompressedOffset = mnDecodedOffset;
+    checkpoint.mnCompressedOffset = mnInputOffset - mStream.avail_in;
+    checkpoint.mnBits = nBits;
+
+    // unroll the ring oldest byte first
+    std::vector<uint8_t> window(kWindowSize);
+    memcpy(window.data(), mWindow.Get() + mnWindowPos, kWindowSize - mnWindowPos);
+    memcpy(window.data() + kWindowSize - mnWindowPos, mWindow.Get(), mnWindowPos);
+
+    uLongf nCompressedSize = compressBound(kWindowSize);
+    checkpoint.mWindow.resize(nCompressedSize);
+    if (compress2(checkpoint.mWindow.data(), &nCompressedSize, window.data(), kWindowSize, Z_BEST_SPEED) != Z_OK)
+        return;     // just a missed checkpoint
+    checkpoint.mWindow.resize(nCompressedSize);
+
+    mCheckpoints.push_back(std::move(checkpoint));
+}
+
+bool cZipEntryStream::SaveIndex(const string& sIndexPath)
+{
+    if (!mpZipFile)
+        return false;
+
+    // Write to a temp file and swap it in so that an interrupted save never leaves a partial index
+    string sTempPath(sIndexPath + ".tmp");
+    {
+        ofstream outFile(sTempPath, ios::binary | ios::trunc);
+        if (!outFile)
+        {
+            cerr << "Failed to write entry index \"" << sTempPath << "\"\n";
+            return false;
+        }
+
+        uint64_t nNumCheckpoints = mCheckpoints.size();
+        outFile.write(kEntryIndexHeader, sizeof(kEntryIndexHeader));
+        outFile.write((const char*)&mCDFileHeader.mLocalFileHeaderOffset, sizeof(uint64_t));
+        outFile.write((const char*)&mCDFileHeader.mCompressedSize, sizeof(uint64_t));
+        outFile.write((const char*)&mCDFileHeader.mUncompressedSize, sizeof(uint64_t));
+        outFile.write((const char*)&mCDFileHeader.mCRC32, sizeof(uint32_t));
+        outFile.write((const char*)&nNumCheckpoints, sizeof(uint64_t));
+
+        for (const cCheckpoint& checkpoint : mCheckpoints)
+        {
+            uint32_t nWindowBytes = (uint32_t)checkpoint.mWindow.size();
+            outFile.write((const char*)&checkpoint.mnUncompressedOffset, sizeof(uint64_t));
+            outFile.write((const char*)&checkpoint.mnCompressedOffset, sizeof(uint64_t));
+            outFile.write((const char*)&checkpoint.mnBits, sizeof(uint32_t));
+            outFile.write((const char*)&nWindowBytes, sizeof(uint32_t));
+            outFile.write((const char*)checkpoint.mWindow.data(), nWindowBytes);
+        }
+
+        if (!outFile)
+        {
+            cerr << "Failed to write entry index \"" << sTempPath << "\"\n";
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(sTempPath, sIndexPath, ec);
+    if (ec)
+    {
+        cerr << "Failed to replace entry index \"" << sIndexPath << "\". Reason: " << ec.message() << "\n";
+        std::filesystem::remove(sTempPath, ec);
+        return false;
+    }
+
+    return true;
+}
+
+bool cZipEntryStream::LoadIndex(const string& sIndexPath)
+{
+    if (!mpZipFile)
+        return false;
+
+    mCheckpoints.clear();
+
+    ifstream inFile(sIndexPath, ios::binary);
+    if (!inFile)
+        return false;
+
+    char header[sizeof(kEntryIndexHeader)];
+    uint64_t nLocalFileHeaderOffset = 0;
+    uint64_t nCompressedSize = 0;
+    uint64_t nUncompressedSize = 0;
+    uint32_t nCRC = 0;
+    uint64_t nNumCheckpoints = 0;
+    inFile.read(header, sizeof(header));
+    inFile.read((char*)&nLocalFileHeaderOffset, sizeof(uint64_t));
+    inFile.read((char*)&nCompressedSize, sizeof(uint64_t));
+    inFile.read((char*)&nUncompressedSize, sizeof(uint64_t));
+    inFile.read((char*)&nCRC, sizeof(uint32_t));
+    inFile.read((char*)&nNumCheckpoints, sizeof(uint64_t));
+
+    if (!inFile || memcmp(header, kEntryIndexHeader, sizeof(header)) != 0)
+    {
+        cerr << "Ignoring unrecognized entry index \"" << sIndexPath << "\"\n";
+        return false;
+    }
+
+    if (nLocalFileHeaderOffset != mCDFileHeader.mLocalFileHeaderOffset || nCompressedSize != mCDFileHeader.mCompressedSize ||
+        nUncompressedSize != mCDFileHeader.mUncompressedSize || nCRC != mCDFileHeader.mCRC32)
+    {
+        cerr << "Ignoring entry index \"" << sIndexPath << "\" written for a different version of \"" << mCDFileHeader.mFileName << "\"\n";
+        return false;
+    }
+
+    uint64_t nPreviousOffset = 0;
+    for (uint64_t i = 0; i < nNumCheckpoints; i++)
+    {
+        cCheckpoint checkpoint;
+        uint32_t nWindowBytes = 0;
+        inFile.read((char*)&checkpoint.mnUncompressedOffset, sizeof(uint64_t));
+        inFile.read((char*)&checkpoint.mnCompressedOffset, sizeof(uint64_t));
+        inFile.read((char*)&checkpoint.mnBits, sizeof(uint32_t));
+        inFile.read((char*)&nWindowBytes, sizeof(uint32_t));
+
+        if (!inFile || checkpoint.mnUncompressedOffset <= nPreviousOffset || checkpoint.mnUncompressedOffset >= nUncompressedSize ||
+            checkpoint.mnCompressedOffset == 0 || checkpoint.mnCompressedOffset > nCompressedSize || checkpoint.mnBits > 7 || nWindowBytes > compressBound(kWindowSize))
+        {
+            cerr << "Ignoring corrupt entry index \"" << sIndexPath << "\"\n";
+            mCheckpoints.clear();
+            return false;
+        }
+
+        checkpoint.mWindow.resize(nWindowBytes);
+        inFile.read((char*)checkpoint.mWindow.data(), nWindowBytes);
+        if (!inFile)
+        {
+            cerr << "Ignoring corrupt entry index \"" << sIndexPath << "\"\n";
+            mCheckpoints.clear();
+            return false;
+        }
+
+        nPreviousOffset = checkpoint.mnUncompressedOffset;
+        mCheckpoints.push_back(std::move(checkpoint));
+    }
+
+    return true;
+}
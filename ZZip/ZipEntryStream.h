@@ -0,0 +1,89 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// ZipEntryStream
+// Purpose: Random access reads of a single entry's uncompressed bytes without extracting it.
+//          Stored entries map straight onto their range of the archive. Deflated entries keep a checkpoint
+//          index (bit position plus the preceding 32KB window at block boundaries every so many MB) that is
+//          built as the entry is first read, so a later seek resumes from the nearest checkpoint instead of
+//          inflating from the start. The index can be saved and loaded to skip that first pass next time.
+//          An instance is not thread safe. Use one per reader.
+//
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include "ZipHeaders.h"
+#include "zlib.h"
+#include "common/ZZFileAPI.h"
+#include "common/BufferPool.h"
+
+class cZipEntryStream
+{
+public:
+    static const uint32_t kWindowSize = 32 * 1024;                          // deflate's maximum match distance
+    static const uint64_t kDefaultCheckpointSpacing = 8 * 1024 * 1024;      // uncompressed bytes between checkpoints
+
+    cZipEntryStream();
+    ~cZipEntryStream();
+
+    bool                    Open(std::shared_ptr<cZZFile> pZipFile, const cCDFileHeader& cdFileHeader, uint64_t nCheckpointSpacing = kDefaultCheckpointSpacing);
+    void                    Close();
+
+    bool                    Read(uint8_t* pDestination, uint32_t nBytes, uint32_t& nBytesRead);                      // reads from the current position. nBytesRead is short only at the end of the entry.
+    bool                    Read(uint64_t nOffset, uint32_t nBytes, uint8_t* pDestination, uint32_t& nBytesRead);    // seek + read
+    bool                    Seek(uint64_t nOffset);
+
+    uint64_t                GetPosition() const { return mnPosition; }
+    uint64_t                GetSize() const { return mCDFileHeader.mUncompressedSize; }
+    const cCDFileHeader&    GetFileHeader() const { return mCDFileHeader; }
+    size_t                  GetNumCheckpoints() const { return mCheckpoints.size(); }
+
+    bool                    BuildIndex();                                   // inflates whatever hasn't been indexed yet (and checks the entry's CRC when that's the whole entry)
+    bool                    LoadIndex(const std::string& sIndexPath);       // false (leaving the index empty) if missing or written for a different entry
+    bool                    SaveIndex(const std::string& sIndexPath);
+
+private:
+    class cCheckpoint
+    {
+    public:
+        cCheckpoint() : mnUncompressedOffset(0), mnCompressedOffset(0), mnBits(0) {}
+        uint64_t                mnUncompressedOffset;
+        uint64_t                mnCompressedOffset;     // first byte of the stream not fully consumed. mnBits of the byte before it are still unused.
+        uint32_t                mnBits;
+        std::vector<uint8_t>    mWindow;                // preceding kWindowSize bytes, deflated to keep the index small
+    };
+
+    bool                    ResetDecoder(const cCheckpoint* pCheckpoint);   // nullptr starts from the top of the stream
+    bool                    Inflate(uint8_t* pDestination, uint64_t nBytes, uint64_t& nProduced);  // nullptr discards
+    bool                    FillInput();
+    void                    AddCheckpoint(uint32_t nBits);
+
+    std::shared_ptr<cZZFile>    mpZipFile;
+    cCDFileHeader           mCDFileHeader;
+    uint64_t                mnStreamOffset;         // archive offset of the entry's data
+    uint64_t                mnPosition;             // next byte Read returns
+    uint64_t                mnCheckpointSpacing;
+
+    // deflated entries
+    z_stream                mStream;
+    bool                    mbStreamInitted;
+    bool                    mbStreamEnded;
+    uint64_t                mnDecodedOffset;        // uncompressed offset the decoder produces next
+    uint64_t                mnInputOffset;          // stream offset just past what's been read into mInput
+    cPooledBuffer           mInput;
+    cPooledBuffer           mWindow;                // decoder output ring. Always holds the last kWindowSize bytes decoded.
+    uint32_t                mnWindowPos;
+    uint32_t                mnCRC;
+    bool                    mbCRCValid;             // decoder has run from the top of the stream so mnCRC covers everything decoded
+    std::vector<cCheckpoint>    mCheckpoints;       // ascending mnUncompressedOffset
+};
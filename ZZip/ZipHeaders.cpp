@@ -14,6 +14,7 @@
 #include <filesystem>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 #include "common/FNMatch.h"
 
 using namespace std;
@@ -41,6 +42,7 @@ string cExtensibleFieldEntry::HeaderToString()
     case 0x0065:    return "0x65-IBM S / 390 (Z390), AS / 400 (I400)attributes-uncompressed";
     case 0x0066:    return "0x66-Reserved for IBM S / 390 (Z390), AS / 400 (I400)attributes - compressed";
     case 0x4690:    return "0x4690-POSZIP 4690 (reserved)";
+    case kZipExtraFieldFlushPointsTag:  return "0x7a7a-ZZip flush points";
     }
 
     return "";
@@ -200,35 +202,70 @@ bool cLocalFileHeader::Read(cZZFile& file, uint64_t nOffsetToLocalFileHeader, ui
 
 
 
-bool cLocalFileHeader::Write(cZZFile& file, uint64_t nOffsetToLocalFileHeader)
+uint32_t cLocalFileHeader::Serialize(uint8_t* pBuffer)
 {
-    bool bSuccess = true;
-    uint32_t nWritten = 0;
-    bSuccess &= file.Write(nOffsetToLocalFileHeader, sizeof(uint32_t), (uint8_t*)&mLocalFileTag, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mMinVersionToExtract, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mGeneralPurposeBitFlag, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mCompressionMethod, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mLastModificationTime, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mLastModificationDate, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint32_t), (uint8_t*)&mCRC32, nWritten);
-
     uint16_t nExtraFieldLengthToWrite = kExtendedFieldLength;
-    uint16_t nExtendedFieldLengthToWrite = kExtendedFieldLength - sizeof(uint16_t) - sizeof(uint16_t);
+    uint16_t nExtendedFieldLengthToWrite = kExtendedFieldLength - sizeof(uint16_t) - sizeof(uint16_t);    // extra field just includes this extended field minus tag and size of data
+
+    *((uint32_t*)(pBuffer + 0)) = mLocalFileTag;
+    *((uint16_t*)(pBuffer + 4)) = mMinVersionToExtract;
+    *((uint16_t*)(pBuffer + 6)) = mGeneralPurposeBitFlag;
+    *((uint16_t*)(pBuffer + 8)) = mCompressionMethod;
+    *((uint16_t*)(pBuffer + 10)) = mLastModificationTime;
+    *((uint16_t*)(pBuffer + 12)) = mLastModificationDate;
+    *((uint32_t*)(pBuffer + 14)) = mCRC32;
+    *((uint32_t*)(pBuffer + 18)) = (uint32_t)-1;        // compressed size is in the zip64 extended field
+    *((uint32_t*)(pBuffer + 22)) = (uint32_t)-1;        // uncompressed size is in the zip64 extended field
+    *((uint16_t*)(pBuffer + 26)) = mFilenameLength;
+    *((uint16_t*)(pBuffer + 28)) = SerializedExtraFieldLength();
+    memcpy(pBuffer + kStaticDataSize, mFilename.c_str(), mFilenameLength);
+
+    // now the extra field
+    uint8_t* pExtra = pBuffer + kStaticDataSize + mFilenameLength;
+    *((uint16_t*)(pExtra + 0)) = kZipExtraFieldZip64ExtendedInfoTag;
+    *((uint16_t*)(pExtra + 2)) = nExtendedFieldLengthToWrite;
+    *((uint64_t*)(pExtra + 4)) = mUncompressedSize;
+    *((uint64_t*)(pExtra + 12)) = mCompressedSize;
+
+    // then any other fields carried over (the Zip64 field above replaces whatever was parsed)
+    uint32_t nExtraFieldLength = nExtraFieldLengthToWrite;
+    for (const cExtensibleFieldEntry& entry : mExtensibleFieldList)
+    {
+        if (entry.mnHeader == kZipExtraFieldZip64ExtendedInfoTag || nExtraFieldLength + sizeof(uint32_t) + entry.mnSize > 0xffff)
+            continue;
+
+        *((uint16_t*)(pExtra + nExtraFieldLength)) = entry.mnHeader;
+        *((uint16_t*)(pExtra + nExtraFieldLength + 2)) = entry.mnSize;
+        if (entry.mnSize > 0)
+            memcpy(pExtra + nExtraFieldLength + 4, entry.mpData.get(), entry.mnSize);
+        nExtraFieldLength += sizeof(uint32_t) + entry.mnSize;
+    }
 
-    uint32_t nNegOne = (uint32_t)-1;
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint32_t), (uint8_t*)&nNegOne, nWritten);                              // compressed size
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint32_t), (uint8_t*)&nNegOne, nWritten);                              // uncompressed size
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mFilenameLength, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&nExtraFieldLengthToWrite, nWritten);
+    return kStaticDataSize + mFilenameLength + nExtraFieldLength;
+}
+
+uint16_t cLocalFileHeader::SerializedExtraFieldLength()
+{
+    uint32_t nExtraFieldLength = kExtendedFieldLength;
+    for (const cExtensibleFieldEntry& entry : mExtensibleFieldList)
+    {
+        if (entry.mnHeader == kZipExtraFieldZip64ExtendedInfoTag || nExtraFieldLength + sizeof(uint32_t) + entry.mnSize > 0xffff)
+            continue;
 
-    // write the filename
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, mFilenameLength, (uint8_t*)mFilename.c_str(), nWritten);
+        nExtraFieldLength += sizeof(uint32_t) + entry.mnSize;
+    }
 
-    // now write the extra field
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&kZipExtraFieldZip64ExtendedInfoTag, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&nExtendedFieldLengthToWrite, nWritten);         // extra field just includes this extended field minus tag and size of data
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint64_t), (uint8_t*)&mUncompressedSize, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint64_t), (uint8_t*)&mCompressedSize, nWritten);
+    return (uint16_t)nExtraFieldLength;
+}
+
+bool cLocalFileHeader::Write(cZZFile& file, uint64_t nOffsetToLocalFileHeader)
+{
+    uint8_t* pBuffer = new uint8_t[(uint32_t)Size()];
+    uint32_t nSize = Serialize(pBuffer);
+
+    uint32_t nWritten = 0;
+    bool bSuccess = file.Write(nOffsetToLocalFileHeader, nSize, pBuffer, nWritten);
+    delete[] pBuffer;
 
     if (!bSuccess)
     {
@@ -241,7 +278,32 @@ bool cLocalFileHeader::Write(cZZFile& file, uint64_t nOffsetToLocalFileHeader)
 
 uint64_t cLocalFileHeader::Size()
 {
-    return kStaticDataSize + mFilenameLength + kExtendedFieldLength;
+    return kStaticDataSize + mFilenameLength + SerializedExtraFieldLength();
+}
+
+uint32_t cZip64DataDescriptor::Serialize(uint8_t* pBuffer)
+{
+    *((uint32_t*)(pBuffer + 0)) = mDataDescriptorTag;
+    *((uint32_t*)(pBuffer + 4)) = mCRC32;
+    *((uint64_t*)(pBuffer + 8)) = mCompressedSize;
+    *((uint64_t*)(pBuffer + 16)) = mUncompressedSize;
+
+    return kStaticDataSize;
+}
+
+bool cZip64DataDescriptor::Write(cZZFile& file, int64_t nOffset)
+{
+    uint8_t buffer[kStaticDataSize];
+    uint32_t nSize = Serialize(buffer);
+
+    uint32_t nWritten = 0;
+    if (!file.Write(nOffset, nSize, buffer, nWritten))
+    {
+        cout << "cZip64DataDescriptor::Write - Failure to write data descriptor!\n";
+        return false;
+    }
+
+    return true;
 }
 
 bool cEndOfCDRecord::ParseRaw(uint8_t* pBuffer, uint32_t& nNumBytesProcessed)
@@ -266,21 +328,29 @@ bool cEndOfCDRecord::ParseRaw(uint8_t* pBuffer, uint32_t& nNumBytesProcessed)
     return true;
 }
 
-bool cEndOfCDRecord::Write(cZZFile& file)
+uint32_t cEndOfCDRecord::Serialize(uint8_t* pBuffer)
 {
-    bool bSuccess = true;
-    uint32_t nWritten = 0;
-    bSuccess &= file.Write(cZZFile::ZZFILE_SEEK_END, sizeof(uint32_t), (uint8_t*)&mEndOfCDRecTag, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mDiskNum, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mDiskNumOfCD, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mNumCDRecordsThisDisk, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mNumTotalRecords, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint32_t), (uint8_t*)&mNumBytesOfCD, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint32_t), (uint8_t*)&mCDStartOffset, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mNumBytesOfComment, nWritten);
+    *((uint32_t*)(pBuffer + 0)) = mEndOfCDRecTag;
+    *((uint16_t*)(pBuffer + 4)) = mDiskNum;
+    *((uint16_t*)(pBuffer + 6)) = mDiskNumOfCD;
+    *((uint16_t*)(pBuffer + 8)) = mNumCDRecordsThisDisk;
+    *((uint16_t*)(pBuffer + 10)) = mNumTotalRecords;
+    *((uint32_t*)(pBuffer + 12)) = mNumBytesOfCD;
+    *((uint32_t*)(pBuffer + 16)) = mCDStartOffset;
+    *((uint16_t*)(pBuffer + 20)) = mNumBytesOfComment;
+    memcpy(pBuffer + kStaticDataSize, mComment.c_str(), mNumBytesOfComment);
+
+    return kStaticDataSize + mNumBytesOfComment;
+}
 
+bool cEndOfCDRecord::Write(cZZFile& file)
+{
+    uint8_t* pBuffer = new uint8_t[(uint32_t)Size()];
+    uint32_t nSize = Serialize(pBuffer);
 
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, (uint32_t) mComment.length(), (uint8_t*)mComment.c_str(), nWritten);
+    uint32_t nWritten = 0;
+    bool bSuccess = file.Write(cZZFile::ZZFILE_SEEK_END, nSize, pBuffer, nWritten);
+    delete[] pBuffer;
 
     if (!bSuccess)
     {
@@ -353,30 +423,40 @@ bool cZip64EndOfCDRecord::ParseRaw(uint8_t* pBuffer, uint32_t& nNumBytesProcesse
     return true;
 }
 
-bool cZip64EndOfCDRecord::Write(cZZFile& file)
+uint32_t cZip64EndOfCDRecord::Serialize(uint8_t* pBuffer)
 {
-    bool bSuccess = true;
-    uint32_t nWritten = 0;
-    bSuccess &= file.Write(cZZFile::ZZFILE_SEEK_END, sizeof(uint32_t), (uint8_t*)&mZip64EndOfCDRecTag, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint64_t), (uint8_t*)&mSizeOfZiP64EndOfCDRecord, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mVersionMadeBy, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mMinVersionToExtract, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint32_t), (uint8_t*)&mDiskNum, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint32_t), (uint8_t*)&mDiskNumOfCD, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint64_t), (uint8_t*)&mNumCDRecordsThisDisk, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint64_t), (uint8_t*)&mNumTotalRecords, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint64_t), (uint8_t*)&mNumBytesOfCD, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint64_t), (uint8_t*)&mCDStartOffset, nWritten);
+    *((uint32_t*)(pBuffer + 0)) = mZip64EndOfCDRecTag;
+    *((uint64_t*)(pBuffer + 4)) = mSizeOfZiP64EndOfCDRecord;
+    *((uint16_t*)(pBuffer + 12)) = mVersionMadeBy;
+    *((uint16_t*)(pBuffer + 14)) = mMinVersionToExtract;
+    *((uint32_t*)(pBuffer + 16)) = mDiskNum;
+    *((uint32_t*)(pBuffer + 20)) = mDiskNumOfCD;
+    *((uint64_t*)(pBuffer + 24)) = mNumCDRecordsThisDisk;
+    *((uint64_t*)(pBuffer + 32)) = mNumTotalRecords;
+    *((uint64_t*)(pBuffer + 40)) = mNumBytesOfCD;
+    *((uint64_t*)(pBuffer + 48)) = mCDStartOffset;
 
     if (mpZip64ExtensibleDataSector)
     {
-        bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, mnDerivedSizeOfExtensibleDataSector, (uint8_t*)mpZip64ExtensibleDataSector, nWritten);
+        memcpy(pBuffer + kStaticDataSize, mpZip64ExtensibleDataSector, mnDerivedSizeOfExtensibleDataSector);
+        return kStaticDataSize + mnDerivedSizeOfExtensibleDataSector;
     }
 
+    return kStaticDataSize;
+}
+
+bool cZip64EndOfCDRecord::Write(cZZFile& file)
+{
+    uint8_t* pBuffer = new uint8_t[(uint32_t)Size()];
+    uint32_t nSize = Serialize(pBuffer);
+
+    uint32_t nWritten = 0;
+    bool bSuccess = file.Write(cZZFile::ZZFILE_SEEK_END, nSize, pBuffer, nWritten);
+    delete[] pBuffer;
 
     if (!bSuccess)
     {
-        cout << "cCDFileHeader::Write - Failure to write CDFileHeader!\n";
+        cout << "cZip64EndOfCDRecord::Write - Failure to write cZip64EndOfCDRecord!\n";
         return false;
     }
 
@@ -423,16 +503,23 @@ bool cZip64EndOfCDLocator::ParseRaw(uint8_t* pBuffer, uint32_t& nNumBytesProcess
     return true;
 }
 
+uint32_t cZip64EndOfCDLocator::Serialize(uint8_t* pBuffer)
+{
+    *((uint32_t*)(pBuffer + 0)) = mZip64EndOfCDLocatorTag;
+    *((uint32_t*)(pBuffer + 4)) = mDiskNumOfCD;
+    *((uint64_t*)(pBuffer + 8)) = mZip64EndofCDOffset;
+    *((uint32_t*)(pBuffer + 16)) = mNumTotalDisks;
+
+    return kStaticDataSize;
+}
+
 bool cZip64EndOfCDLocator::Write(cZZFile& file)
 {
-    bool bSuccess = true;
-    uint32_t nWritten = 0;
-    bSuccess &= file.Write(cZZFile::ZZFILE_SEEK_END, sizeof(uint32_t), (uint8_t*)&mZip64EndOfCDLocatorTag, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint32_t), (uint8_t*)&mDiskNumOfCD, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint64_t), (uint8_t*)&mZip64EndofCDOffset, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint32_t), (uint8_t*)&mNumTotalDisks, nWritten);
+    uint8_t buffer[kStaticDataSize];
+    uint32_t nSize = Serialize(buffer);
 
-    if (!bSuccess)
+    uint32_t nWritten = 0;
+    if (!file.Write(cZZFile::ZZFILE_SEEK_END, nSize, buffer, nWritten))
     {
         cout << "cZip64EndOfCDLocator::Write - Failure to write cZip64EndOfCDLocator!\n";
         return false;
@@ -511,6 +598,12 @@ bool cCDFileHeader::ParseRaw(uint8_t* pBuffer, uint32_t& nNumBytesProcessed)
                 pSearch += sizeof(uint64_t);
             }
 
+            if (mDiskNumFileStart == 0xffff)
+            {
+                mDiskNumFileStart = (uint16_t)*((uint32_t*)(pSearch));
+                pSearch += sizeof(uint32_t);
+            }
+
             break;
         }
         else if (nTag == kZipExtraFieldUnicodePathTag)
@@ -532,43 +625,134 @@ bool cCDFileHeader::ParseRaw(uint8_t* pBuffer, uint32_t& nNumBytesProcessed)
     return true;
 }
 
+uint32_t cCDFileHeader::Serialize(uint8_t* pBuffer)
+{
+    *((uint32_t*)(pBuffer + 0)) = mCDTag;
+    *((uint16_t*)(pBuffer + 4)) = mVersionMadeBy;
+    *((uint16_t*)(pBuffer + 6)) = mMinVersionToExtract;
+    *((uint16_t*)(pBuffer + 8)) = mGeneralPurposeBitFlag;
+    *((uint16_t*)(pBuffer + 10)) = mCompressionMethod;
+    *((uint16_t*)(pBuffer + 12)) = mLastModificationTime;
+    *((uint16_t*)(pBuffer + 14)) = mLastModificationDate;
+    *((uint32_t*)(pBuffer + 16)) = mCRC32;
+    *((uint32_t*)(pBuffer + 20)) = (uint32_t)-1;        // compressed size is in the zip64 extended field
+    *((uint32_t*)(pBuffer + 24)) = (uint32_t)-1;        // uncompressed size is in the zip64 extended field
+    *((uint16_t*)(pBuffer + 28)) = mFilenameLength;
+    *((uint16_t*)(pBuffer + 30)) = SerializedExtraFieldLength();
+    *((uint16_t*)(pBuffer + 32)) = mFileCommentLength;
+    *((uint16_t*)(pBuffer + 34)) = 0xffff;              // disk number is in the zip64 extended field
+    *((uint16_t*)(pBuffer + 36)) = mInternalFileAttributes;
+    *((uint32_t*)(pBuffer + 38)) = mExternalFileAttributes;
+    *((uint32_t*)(pBuffer + 42)) = (uint32_t)-1;        // local file header offset is in the zip64 extended field
+    memcpy(pBuffer + kStaticDataSize, mFileName.c_str(), mFilenameLength);
+
+    // now the extra field
+    uint8_t* pExtra = pBuffer + kStaticDataSize + mFilenameLength;
+    *((uint16_t*)(pExtra + 0)) = kZipExtraFieldZip64ExtendedInfoTag;
+    *((uint16_t*)(pExtra + 2)) = kExtendedFieldLength;
+    *((uint64_t*)(pExtra + 4)) = mUncompressedSize;
+    *((uint64_t*)(pExtra + 12)) = mCompressedSize;
+    *((uint64_t*)(pExtra + 20)) = mLocalFileHeaderOffset;
+    *((uint32_t*)(pExtra + 28)) = mDiskNumFileStart;
+
+    // then any other fields carried over or added (the Zip64 field above replaces whatever was parsed)
+    uint32_t nExtraFieldLength = kExtraFieldLength;
+    for (const cExtensibleFieldEntry& entry : mExtensibleFieldList)
+    {
+        if (entry.mnHeader == kZipExtraFieldZip64ExtendedInfoTag || nExtraFieldLength + sizeof(uint32_t) + entry.mnSize > 0xffff)
+            continue;
+
+        *((uint16_t*)(pExtra + nExtraFieldLength)) = entry.mnHeader;
+        *((uint16_t*)(pExtra + nExtraFieldLength + 2)) = entry.mnSize;
+        if (entry.mnSize > 0)
+            memcpy(pExtra + nExtraFieldLength + 4, entry.mpData.get(), entry.mnSize);
+        nExtraFieldLength += sizeof(uint32_t) + entry.mnSize;
+    }
+
+    memcpy(pExtra + nExtraFieldLength, mFileComment.c_str(), mFileCommentLength);
+
+    return kStaticDataSize + mFilenameLength + nExtraFieldLength + mFileCommentLength;
+}
+
+uint16_t cCDFileHeader::SerializedExtraFieldLength()
+{
+    uint32_t nExtraFieldLength = kExtraFieldLength;
+    for (const cExtensibleFieldEntry& entry : mExtensibleFieldList)
+    {
+        if (entry.mnHeader == kZipExtraFieldZip64ExtendedInfoTag || nExtraFieldLength + sizeof(uint32_t) + entry.mnSize > 0xffff)
+            continue;
+
+        nExtraFieldLength += sizeof(uint32_t) + entry.mnSize;
+    }
+
+    return (uint16_t)nExtraFieldLength;
+}
+
+bool cCDFileHeader::GetFlushPoints(tFlushPointList& flushPoints) const
+{
+    flushPoints.clear();
+    for (const cExtensibleFieldEntry& entry : mExtensibleFieldList)
+    {
+        if (entry.mnHeader != kZipExtraFieldFlushPointsTag)
+            continue;
+
+        if (entry.mnSize == 0 || entry.mnSize % (2 * sizeof(uint64_t)) != 0)
+            return false;
+
+        // Each point: uncompressed offset, compressed offset. Both strictly increasing and inside the entry.
+        const uint8_t* pData = entry.mpData.get();
+        for (uint32_t nOffset = 0; nOffset < entry.mnSize; nOffset += 2 * sizeof(uint64_t))
+        {
+            cFlushPoint point(*((uint64_t*)(pData + nOffset)), *((uint64_t*)(pData + nOffset + sizeof(uint64_t))));
+            uint64_t nPreviousUncompressed = flushPoints.empty() ? 0 : flushPoints.back().mnUncompressedOffset;
+            uint64_t nPreviousCompressed = flushPoints.empty() ? 0 : flushPoints.back().mnCompressedOffset;
+
+            if (point.mnUncompressedOffset <= nPreviousUncompressed || point.mnUncompressedOffset >= mUncompressedSize ||
+                point.mnCompressedOffset <= nPreviousCompressed || point.mnCompressedOffset >= mCompressedSize)
+            {
+                flushPoints.clear();
+                return false;
+            }
+
+            flushPoints.push_back(point);
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+void cCDFileHeader::SetFlushPoints(const tFlushPointList& flushPoints)
+{
+    mExtensibleFieldList.remove_if([](const cExtensibleFieldEntry& entry) { return entry.mnHeader == kZipExtraFieldFlushPointsTag; });
+    if (flushPoints.empty())
+        return;
+
+    size_t nPoints = std::min<size_t>(flushPoints.size(), kMaxFlushPoints);
+
+    cExtensibleFieldEntry entry;
+    entry.mnHeader = kZipExtraFieldFlushPointsTag;
+    entry.mnSize = (uint16_t)(nPoints * 2 * sizeof(uint64_t));
+    entry.mpData.reset(new uint8_t[entry.mnSize], std::default_delete<uint8_t[]>());
+
+    for (size_t i = 0; i < nPoints; i++)
+    {
+        *((uint64_t*)(entry.mpData.get() + i * 2 * sizeof(uint64_t))) = flushPoints[i].mnUncompressedOffset;
+        *((uint64_t*)(entry.mpData.get() + i * 2 * sizeof(uint64_t) + sizeof(uint64_t))) = flushPoints[i].mnCompressedOffset;
+    }
+
+    mExtensibleFieldList.push_back(entry);
+}
+
 bool cCDFileHeader::Write(cZZFile& file)
 {
-    bool bSuccess = true;
+    uint8_t* pBuffer = new uint8_t[(uint32_t)Size()];
+    uint32_t nSize = Serialize(pBuffer);
+
     uint32_t nWritten = 0;
-    bSuccess &= file.Write(cZZFile::ZZFILE_SEEK_END, sizeof(uint32_t), (uint8_t*)&mCDTag, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mVersionMadeBy, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mMinVersionToExtract, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mGeneralPurposeBitFlag, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mCompressionMethod, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mLastModificationTime, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mLastModificationDate, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint32_t), (uint8_t*)&mCRC32, nWritten);
-
-    uint32_t nNegOne = (uint32_t)-1;
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint32_t), (uint8_t*)&nNegOne, nWritten);                             // compressed size
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint32_t), (uint8_t*)&nNegOne, nWritten);                             // uncompressed size
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mFilenameLength, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&kExtraFieldLength, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mFileCommentLength, nWritten);
-
-    uint16_t n16NegOne = 0xffff;
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&n16NegOne, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&mInternalFileAttributes, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint32_t), (uint8_t*)&mExternalFileAttributes, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint32_t), (uint8_t*)&nNegOne, nWritten);                             // local file header offset
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, mFilenameLength, (uint8_t*)mFileName.c_str(), nWritten);
-
-    // now write the extra field
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&kZipExtraFieldZip64ExtendedInfoTag, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint16_t), (uint8_t*)&kExtendedFieldLength, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint64_t), (uint8_t*)&mUncompressedSize, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint64_t), (uint8_t*)&mCompressedSize, nWritten);
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint64_t), (uint8_t*)&mLocalFileHeaderOffset, nWritten);
-    uint32_t nDiskNum = mDiskNumFileStart;
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, sizeof(uint32_t), (uint8_t*)&nDiskNum, nWritten);
-
-    bSuccess &= file.Write(cZZFile::ZZFILE_NO_SEEK, mFileCommentLength, (uint8_t*)mFileComment.c_str(), nWritten);
+    bool bSuccess = file.Write(cZZFile::ZZFILE_SEEK_END, nSize, pBuffer, nWritten);
+    delete[] pBuffer;
 
     if (!bSuccess)
     {
@@ -581,7 +765,7 @@ bool cCDFileHeader::Write(cZZFile& file)
 
 uint64_t cCDFileHeader::Size()
 {
-    return kStaticDataSize + mFilenameLength + mFileCommentLength + kExtraFieldLength;
+    return kStaticDataSize + mFilenameLength + mFileCommentLength + SerializedExtraFieldLength();
 }
 
 
@@ -826,7 +1010,7 @@ bool cZipCD::ComputeCDRecords(uint64_t nStartOfCDOffset)
     mEndOfCDRecord.mNumCDRecordsThisDisk = mEndOfCDRecord.mNumTotalRecords;
     mEndOfCDRecord.mCDStartOffset = 0xffffffff;
 
-    mZip64EndOfCDRecord.mSizeOfZiP64EndOfCDRecord = mZip64EndOfCDRecord.Size();
+    mZip64EndOfCDRecord.mSizeOfZiP64EndOfCDRecord = mZip64EndOfCDRecord.Size() - sizeof(uint32_t) - sizeof(uint64_t);      // record size excludes the leading tag and size fields
     mZip64EndOfCDRecord.mNumCDRecordsThisDisk = mCDFileHeaderList.size();
     mZip64EndOfCDRecord.mNumTotalRecords = mCDFileHeaderList.size();
     mZip64EndOfCDRecord.mNumBytesOfCD = Size();
@@ -845,10 +1029,6 @@ uint64_t cZipCD::Size()
         nSize += cdFileHeader.Size();
     }
 
-    nSize += mEndOfCDRecord.Size();
-    nSize += mZip64EndOfCDLocator.Size();
-    nSize += mZip64EndOfCDRecord.Size();
-
     return nSize;
 }
 
@@ -945,27 +1125,54 @@ bool cZipCD::GetFileHeader(const string& sFilename, cCDFileHeader& fileHeader)
 
 bool cZipCD::Write(cZZFile& file)
 {
+    // Everything is serialized into a write-behind buffer and emitted in large writes at explicit offsets
+    uint32_t nTrailerSize = (uint32_t)(mZip64EndOfCDRecord.Size() + mZip64EndOfCDLocator.Size() + mEndOfCDRecord.Size());
+    uint32_t nBufferSize = 1024 * 1024;
+    if (nBufferSize < nTrailerSize)
+        nBufferSize = nTrailerSize;
+
+    uint8_t* pBuffer = new uint8_t[nBufferSize];
+    uint32_t nBuffered = 0;
+    uint64_t nWriteOffset = mZip64EndOfCDRecord.mCDStartOffset;
+
     bool bSuccess = true;
+    auto flush = [&]()
+    {
+        uint32_t nWritten = 0;
+        if (nBuffered > 0)
+            bSuccess &= file.Write(nWriteOffset, nBuffered, pBuffer, nWritten);
+
+        nWriteOffset += nBuffered;
+        nBuffered = 0;
+    };
 
     for (tCDFileHeaderList::iterator it = mCDFileHeaderList.begin(); it != mCDFileHeaderList.end(); it++)
     {
         cCDFileHeader& cdFileHeader = *it;
-        //cout << "writing header for file \"" << cdFileHeader.mFileName << "\" at offset " << file.tellg() << cdFileHeader.ToString() << "\n";
-        bSuccess &= cdFileHeader.Write(file);
+        if (nBuffered + cdFileHeader.Size() > nBufferSize)
+            flush();
+
+        nBuffered += cdFileHeader.Serialize(pBuffer + nBuffered);
     }
 
-    // Write Zip64 End of CD Record
-    // but first record the offset to it
-    //mZip64EndOfCDLocator.mZip64EndofCDOffset = file.tellg();
-    mZip64EndOfCDLocator.mZip64EndofCDOffset = file.GetFileSize();
+    if (nBuffered + nTrailerSize > nBufferSize)
+        flush();
 
-    bSuccess &= mZip64EndOfCDRecord.Write(file);
+    // Zip64 End of CD Record immediately follows the CD, then the locator and End of CD Record
+    mZip64EndOfCDLocator.mZip64EndofCDOffset = nWriteOffset + nBuffered;
 
-    // Write Zip64 End of CD Locator
-    bSuccess &= mZip64EndOfCDLocator.Write(file);
+    nBuffered += mZip64EndOfCDRecord.Serialize(pBuffer + nBuffered);
+    nBuffered += mZip64EndOfCDLocator.Serialize(pBuffer + nBuffered);
+    nBuffered += mEndOfCDRecord.Serialize(pBuffer + nBuffered);
+    flush();
 
-    // Write End of CD Record
-    bSuccess &= mEndOfCDRecord.Write(file);
+    delete[] pBuffer;
 
-    return bSuccess;
+    if (!bSuccess)
+    {
+        cout << "cZipCD::Write - Failure to write Central Directory!\n";
+        return false;
+    }
+
+    return true;
 }
@@ -16,6 +16,7 @@
 #include <stdint.h>
 #include <string>
 #include <list>
+#include <vector>
 #include <thread>
 #include <iostream>
 #include "common/ZZFileAPI.h"
@@ -29,14 +30,18 @@ const uint32_t kZip64EndofCDTag                     = 0x06064b50;
 const uint32_t kZip64EndofCDLocatorTag              = 0x07064b50;
 const uint32_t kZipCDTag                            = 0x02014b50;
 const uint32_t kZipLocalFileHeaderTag               = 0x04034b50;
+const uint32_t kZipDataDescriptorTag                = 0x08074b50;
 const uint16_t kZipExtraFieldZip64ExtendedInfoTag   = 0x0001;
 const uint16_t kZipExtraFieldNTFSTag                = 0x000a;
 const uint16_t kZipExtraFieldUnicodePathTag         = 0x7075;   // TBD unicode support
 const uint16_t kZipExtraFieldUnicodeCommentTag      = 0x6375;   // TBD unicode support
+const uint16_t kZipExtraFieldFlushPointsTag         = 0x7a7a;   // private. Full flush points within the deflate stream (see cCDFileHeader::GetFlushPoints)
 
 const uint16_t kDefaultMinVersionToExtract          = 45;
 const uint16_t kDefaultVersionMadeBy                = 45;
 const uint16_t kDefaultGeneralPurposeFlag           = 2;
+const uint16_t kGeneralPurposeFlagEncrypted         = 0x0001;   // bit 0. The stream is encrypted
+const uint16_t kGeneralPurposeFlagDataDescriptor    = 0x0008;   // bit 3. CRC and sizes follow the stream in a data descriptor
 
 
 //////////////////////////////////////////////////////////////////////////////////////////
@@ -57,6 +62,18 @@ public:
 
 typedef std::list<cExtensibleFieldEntry> tExtensibleFieldList;
 
+// A point where the deflate stream was fully flushed. Inflating can start there without any preceding data.
+class cFlushPoint
+{
+public:
+    cFlushPoint() : mnUncompressedOffset(0), mnCompressedOffset(0) {}
+    cFlushPoint(uint64_t nUncompressedOffset, uint64_t nCompressedOffset) : mnUncompressedOffset(nUncompressedOffset), mnCompressedOffset(nCompressedOffset) {}
+    uint64_t                mnUncompressedOffset;
+    uint64_t                mnCompressedOffset;     // from the start of the entry's stream
+};
+
+typedef std::vector<cFlushPoint> tFlushPointList;
+
 
 
 //////////////////////////////////////////////////////////////////////////////////////////
@@ -90,6 +107,7 @@ public:
 
     bool                    Read(cZZFile& file, uint64_t nOffsetToLocalFileHeader, uint32_t& nNumBytesProcessed);
     bool                    Write(cZZFile& file, uint64_t nOffsetToLocalFileHeader);
+    uint32_t                Serialize(uint8_t* pBuffer);    // encodes the header as written into pBuffer (at least Size() bytes). Returns bytes encoded.
 
     // offsets
     uint32_t                mLocalFileTag;                  // 0
@@ -105,6 +123,34 @@ public:
     uint16_t                mExtraFieldLength;              // 28
     std::string                  mFilename;                      // 30
     tExtensibleFieldList    mExtensibleFieldList;           // 30 + mFilenameLength;
+
+private:
+    uint16_t                SerializedExtraFieldLength();   // Zip64 field plus whatever else in mExtensibleFieldList fits
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////
+// Follows the compressed stream of an entry written with kGeneralPurposeFlagDataDescriptor.
+// Always the Zip64 form since our local headers always carry the Zip64 extended info field.
+class cZip64DataDescriptor
+{
+public:
+    static const uint32_t kStaticDataSize =
+        sizeof(uint32_t) + // mDataDescriptorTag
+        sizeof(uint32_t) + // mCRC32
+        sizeof(uint64_t) + // mCompressedSize
+        sizeof(uint64_t);  // mUncompressedSize
+
+    cZip64DataDescriptor() : mDataDescriptorTag(kZipDataDescriptorTag), mCRC32(0), mCompressedSize(0), mUncompressedSize(0) {}
+
+    bool            Write(cZZFile& file, int64_t nOffset = cZZFile::ZZFILE_NO_SEEK);
+    uint32_t        Serialize(uint8_t* pBuffer);    // Returns bytes encoded
+    uint64_t        Size() { return kStaticDataSize; }
+
+    // offsets
+    uint32_t        mDataDescriptorTag;             // 0
+    uint32_t        mCRC32;                         // 4
+    uint64_t        mCompressedSize;                // 8
+    uint64_t        mUncompressedSize;              // 16
 };
 
 //////////////////////////////////////////////////////////////////////////////////////////
@@ -128,6 +174,7 @@ public:
     static std::string   FieldNames(eToStringFormat format = kTabs);                   // returns tab delimited field names that correspond with the ones returned from ToString
     std::string          ToString(eToStringFormat format = kTabs);
     bool            Write(cZZFile& file); // assumes must be written at end of file
+    uint32_t        Serialize(uint8_t* pBuffer);    // Returns bytes encoded
 
     uint64_t        Size() { return (uint64_t) kStaticDataSize + (uint64_t) mNumBytesOfComment; }
 
@@ -167,6 +214,7 @@ public:
     static std::string   FieldNames(eToStringFormat format = kTabs);                   // returns tab delimited field names that correspond with the ones returned from ToString
     std::string          ToString(eToStringFormat format = kTabs);
     bool            Write(cZZFile& file);   // assumes must be written at end of file
+    uint32_t        Serialize(uint8_t* pBuffer);    // Returns bytes encoded
 
     uint64_t        Size() { return (uint64_t) kStaticDataSize + (uint64_t) mnDerivedSizeOfExtensibleDataSector; }
 
@@ -204,6 +252,7 @@ public:
     std::string          ToString(eToStringFormat format = kTabs);
 
     bool            Write(cZZFile& file);   // assumes must be written at end of file
+    uint32_t        Serialize(uint8_t* pBuffer);    // Returns bytes encoded
     uint64_t        Size() { return kStaticDataSize; }
 
     // offsets
@@ -250,9 +299,14 @@ public:
     std::string                  ToString(eToStringFormat format = kTabs);
 
     bool                    Write(cZZFile& file);   // assumes must be written at end of file
+    uint32_t                Serialize(uint8_t* pBuffer);    // encodes the header as written into pBuffer (at least Size() bytes). Returns bytes encoded.
 
     uint64_t                Size();                         // in bytes
 
+    bool                    GetFlushPoints(tFlushPointList& flushPoints) const;        // false if the entry has no (or a malformed) flush point field
+    void                    SetFlushPoints(const tFlushPointList& flushPoints);        // replaces any existing flush point field. At most kMaxFlushPoints are kept.
+    static const size_t     kMaxFlushPoints = (0xffff - kExtraFieldLength - sizeof(uint32_t)) / (2 * sizeof(uint64_t));     // what fits alongside the Zip64 field
+
                                                             // offsets
     uint32_t                mCDTag;                         // 0
     uint16_t                mVersionMadeBy;                 // 4
@@ -274,6 +328,9 @@ public:
     std::string                  mFileName;                      // 46
     tExtensibleFieldList    mExtensibleFieldList;           // 46 + mFilenameLength;
     std::string                  mFileComment;                   // 46 + mFilenameLength + mExtraFieldLength;
+
+private:
+    uint16_t                SerializedExtraFieldLength();   // Zip64 field plus whatever else in mExtensibleFieldList fits
 };
 
 typedef std::list<cCDFileHeader> tCDFileHeaderList;
@@ -293,8 +350,8 @@ public:
     uint64_t                GetTotalCompressedBytes();
     uint64_t                GetTotalUncompressedBytes();
 
-    bool                    Write(cZZFile& file);   // assumes must be written at end of file
-    uint64_t                Size();     // size of CD in bytes
+    bool                    Write(cZZFile& file);   // writes the CD and trailer records at the offset given to ComputeCDRecords
+    uint64_t                Size();     // size of CD in bytes (file headers only, not the trailer records)
 
     void                    DumpCD(std::ostream& out, const std::string& sPattern, bool bVerbose, eToStringFormat format);
 
@@ -17,10 +17,51 @@
 #include "common/CrC32Fast.h"
 #include "common/FNMatch.h"
 #include "common/thread_pool.hpp"
+#include "common/work_stealing_pool.hpp"
+#include "common/BoundedQueue.h"
+#include "common/BufferPool.h"
 #include "common/ZZFileAPI.h"
+#include "zlibAPI.h"
+#include <deque>
+#include <atomic>
+#include <unordered_map>
+#include <map>
+#include <tuple>
+#include <string_view>
+#include <algorithm>
+#include <limits>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 
 using namespace std;
 
+const uint64_t kParallelCRCThreshold = 64 * 1024 * 1024;     // files at least this large are verified by several threads
+const uint64_t kParallelCRCChunkSize = 16 * 1024 * 1024;     // each thread CRCs this much at a time
+const uint64_t kPipelineMaxEntrySize = 64 * 1024 * 1024;     // larger entries (or those over a quarter of the memory budget) bypass the pipeline and stream to disk
+const uint64_t kStreamedEntryBudget = 12 * 1024 * 1024;      // what DecompressToFile holds while streaming one entry: the output's 4MB write block plus up to
+                                                             // 4 segment threads' 1MB input and 256KB inflate buffers, or the overlapped path's 6MB of rings
+const uint64_t kKernelCopyMinSize = 4 * 1024 * 1024;         // stored entries of a local package at least this large bypass the pipeline so the kernel copies them
+const uint64_t kVerifyBufferSize = 128 * 1024;               // what FileNeedsUpdate reads through when CRCing on one thread
+const uint64_t kParallelCRCBufferSize = 1024 * 1024;         // what each ParallelCRC worker reads through
+
+// An entry moving through the extraction pipeline
+class cExtractItem
+{
+public:
+    cExtractItem() : mnIndex(0), mnCRC(0), mnBudget(0) {}
+
+    size_t                      mnIndex;        // into the job's entry list
+    std::unique_ptr<uint8_t[]>  mpStream;       // compressed stream, once fetched
+    std::unique_ptr<uint8_t[]>  mpData;         // inflated data, once inflated
+    uint32_t                    mnCRC;          // of mpData
+    uint64_t                    mnBudget;       // bytes charged against the memory budget
+};
+
 
 ZipJob::~ZipJob()
 {
@@ -56,6 +97,7 @@ bool ZipJob::Run()
         pThread = new std::thread(ZipJob::RunDecompressionJob, (void*)this);
         break;
     case kCompress:
+    case kAdd:
         pThread = new std::thread(ZipJob::RunCompressionJob, (void*)this);
         break;
     case kDiff:
@@ -64,6 +106,9 @@ bool ZipJob::Run()
     case kList:
         pThread = new std::thread(ZipJob::RunListJob, (void*)this);
         break;
+    case kOptimize:
+        pThread = new std::thread(ZipJob::RunOptimizeJob, (void*)this);
+        break;
     }
     mWorkers.push_back(pThread);
 
@@ -94,7 +139,12 @@ void ZipJob::RunCompressionJob(void* pContext)
     }
 
     ZZipAPI zipAPI;
-    if (!zipAPI.Init(pZipJob->msPackageURL, ZZipAPI::kZipCreate))
+    ZZipAPI::eOpenType openType = ZZipAPI::kZipCreate;
+    if (pZipJob->mJobType == kAdd)
+        openType = ZZipAPI::kZipModify;
+    else if (pZipJob->mbStreaming)
+        openType = ZZipAPI::kZipCreateStream;
+    if (!zipAPI.Init(pZipJob->msPackageURL, openType))
     {
         pZipJob->mJobStatus.SetError(JobStatus::kError_OpenFailed, "Couldn't create package:\"" + pZipJob->msPackageURL + "\" for compression Job!");
         //cerr << "Couldn't Open " << pZipJob->msPackageURL << " for Decompression Job!" << std::endl;
@@ -112,6 +162,9 @@ void ZipJob::RunCompressionJob(void* pContext)
 
     for (auto it : std::filesystem::recursive_directory_iterator(compressFolder))
     {
+        if (it.path().filename() == cSyncIndex::kIndexFilename)     // local bookkeeping, not content
+            continue;
+
         if (pZipJob->mbVerbose)
             cout << "Found:" << it;
 
@@ -127,6 +180,10 @@ void ZipJob::RunCompressionJob(void* pContext)
                 fileHeader.mUncompressedSize = file_size(it.path());
                 nTotalBytes += fileHeader.mUncompressedSize;
             }
+            else if (is_directory(it.path()))
+            {
+                fileHeader.mFileName.append("/");   // named as it will be in the archive so layout can tell folders from files
+            }
 
             filesToCompress.push_back(fileHeader);
         }
@@ -145,6 +202,12 @@ void ZipJob::RunCompressionJob(void* pContext)
         return;
     }
 
+    if (!pZipJob->ApplyLayout(filesToCompress, pZipJob->msBaseFolder))
+    {
+        pZipJob->mJobStatus.SetError(JobStatus::kError_NotFound, "Couldn't read layout \"" + pZipJob->msLayout + "\"");
+        return;
+    }
+
     cout << "Found " << filesToCompress.size() << " files.  Total size: " << FormatFriendlyBytes(nTotalBytes, StringHelpers::kMiB) << " (" << nTotalBytes << " bytes)\n";
     pZipJob->mJobProgress.Reset();
     pZipJob->mJobProgress.AddBytesToProcess(nTotalBytes);
@@ -157,6 +220,18 @@ void ZipJob::RunCompressionJob(void* pContext)
         zipAPI.AddToZipFile(fileHeader.mFileName, pZipJob->msBaseFolder, &pZipJob->mJobProgress);
     }
 
+    if (zipAPI.GetOpenType() == ZZipAPI::kZipModify)      // a freshly created archive has nothing to compact
+    {
+        uint64_t nWastedBytes = zipAPI.GetWastedBytes();
+        uint64_t nArchiveBytes = zipAPI.GetZipCD().GetTotalCompressedBytes() + nWastedBytes;
+        if (nArchiveBytes > 0 && nWastedBytes * 100 / nArchiveBytes >= pZipJob->mnCompactThresholdPercent)
+        {
+            cout << "Superseded entries and directories waste " << FormatFriendlyBytes(nWastedBytes) << ". Compacting.\n";
+            if (!zipAPI.Compact())
+                cerr << "Failed to compact \"" << pZipJob->msPackageURL << "\"\n";
+        }
+    }
+
     cout << "Finished\n";
 
 
@@ -198,6 +273,326 @@ void ZipJob::RunCompressionJob(void* pContext)
     pZipJob->mJobStatus.mStatus = JobStatus::kFinished;
 }
 
+bool ZipJob::ApplyLayout(tCDFileHeaderList& entries, const string& sPrefix)
+{
+    if (msLayout.empty())
+        return true;
+
+    // Anything other than "dirs" is a file listing entries (an access trace or startup list), one per line, in the order they should be placed
+    unordered_map<string, size_t> listedRank;
+    if (msLayout != "dirs")
+    {
+        std::ifstream listFile(msLayout);
+        if (listFile.fail())
+        {
+            cerr << "Couldn't open layout list \"" << msLayout << "\"!\n";
+            return false;
+        }
+
+        string sLine;
+        while (std::getline(listFile, sLine))
+        {
+            if (!sLine.empty() && sLine[sLine.length() - 1] == '\r')
+                sLine.pop_back();
+            if (sLine.empty() || sLine[0] == '#')
+                continue;
+
+            std::replace(sLine.begin(), sLine.end(), '\\', '/');    // Only forward slashes
+            listedRank.emplace(sLine, listedRank.size());          // first occurrence in a trace wins
+        }
+
+        cout << "Layout: " << listedRank.size() << " listed entries first, remaining grouped by directory.\n";
+    }
+    else
+    {
+        cout << "Layout: grouped by directory.\n";
+    }
+
+    // Listed entries lead in listed order. Everything else is grouped by directory with each folder entry ahead of its contents.
+    // Each entry's sort key is worked out once (views into its name) so sorting millions of entries doesn't allocate per comparison.
+    struct cLayoutKey
+    {
+        size_t                          nRank;          // in the list, kUnlisted if not in it
+        std::string_view                sDirectory;     // relative, with trailing slash. A folder entry ("a/b/") is its own directory.
+        std::string_view                sName;          // relative
+        tCDFileHeaderList::iterator     it;
+    };
+    const size_t kUnlisted = std::numeric_limits<size_t>::max();
+
+    vector<cLayoutKey> keys;
+    keys.reserve(entries.size());
+    for (tCDFileHeaderList::iterator it = entries.begin(); it != entries.end(); it++)
+    {
+        std::string_view sName((*it).mFileName);
+        sName.remove_prefix(std::min<size_t>(sPrefix.length(), sName.length()));
+
+        size_t nRank = kUnlisted;
+        if (!listedRank.empty())
+        {
+            auto rank = listedRank.find(string(sName));
+            if (rank != listedRank.end())
+                nRank = rank->second;
+        }
+
+        size_t nLastSlash = sName.find_last_of('/');
+        std::string_view sDirectory = (nLastSlash == std::string_view::npos) ? std::string_view() : sName.substr(0, nLastSlash + 1);
+        keys.push_back(cLayoutKey{ nRank, sDirectory, sName, it });
+    }
+
+    std::stable_sort(keys.begin(), keys.end(), [kUnlisted](const cLayoutKey& a, const cLayoutKey& b)
+    {
+        if (a.nRank != b.nRank)
+            return a.nRank < b.nRank;
+        if (a.nRank != kUnlisted)
+            return false;
+
+        if (a.sDirectory != b.sDirectory)
+            return a.sDirectory < b.sDirectory;
+
+        bool bAIsFolder = (a.sName.length() == a.sDirectory.length());
+        bool bBIsFolder = (b.sName.length() == b.sDirectory.length());
+        if (bAIsFolder != bBIsFolder)
+            return bAIsFolder;
+
+        return a.sName < b.sName;
+    });
+
+    // Moving the nodes over in order leaves the names (and so the views) where they are
+    tCDFileHeaderList sorted;
+    for (const cLayoutKey& key : keys)
+        sorted.splice(sorted.end(), entries, key.it);
+    entries.swap(sorted);
+
+    return true;
+}
+
+// Deflates the whole input at maximum effort with the given strategy
+static bool DeflateBuffer(uint8_t* pInput, uint64_t nInputSize, int nStrategy, vector<uint8_t>& output)
+{
+    output.clear();
+
+    ZCompressorPtr pCompressor = cZCodecPool::AcquireCompressor(Z_BEST_COMPRESSION, nStrategy);
+    if (!pCompressor)
+        return false;
+    ZCompressor& compressor = *pCompressor;
+
+    compressor.InitStream(pInput, (int32_t)nInputSize);
+    int32_t nStatus = Z_OK;
+    while (compressor.HasMoreOutput())
+    {
+        nStatus = compressor.Compress(true);
+        output.insert(output.end(), compressor.GetCompressedBuffer(), compressor.GetCompressedBuffer() + compressor.GetCompressedBytes());
+
+        if (nStatus != Z_OK)
+            break;
+    }
+
+    return nStatus == Z_STREAM_END;
+}
+
+void ZipJob::RunOptimizeJob(void* pContext)
+{
+    ZipJob* pZipJob = (ZipJob*)pContext;
+
+    eToStringFormat stringFormat = pZipJob->mOutputFormat;
+
+    cout << "Running Optimize Job.\n";
+    cout << "Package: " << pZipJob->msPackageURL << "\n";
+    cout << "Output:  " << pZipJob->msOutputURL << "\n";
+
+    ZZipAPI sourceAPI;
+    if (!sourceAPI.Init(pZipJob->msPackageURL, ZZipAPI::kZipOpen, Z_DEFAULT_COMPRESSION, pZipJob->msName, pZipJob->msPassword))
+    {
+        pZipJob->mJobStatus.SetError(JobStatus::kError_OpenFailed, "Couldn't Open package:\"" + pZipJob->msPackageURL + "\" for Optimize Job!");
+        return;
+    }
+
+    ZZipAPI destAPI;
+    if (!destAPI.Init(pZipJob->msOutputURL, ZZipAPI::kZipCreate))
+    {
+        pZipJob->mJobStatus.SetError(JobStatus::kError_OpenFailed, "Couldn't create package:\"" + pZipJob->msOutputURL + "\" for Optimize Job!");
+        return;
+    }
+
+    cZipCD& sourceCD = sourceAPI.GetZipCD();
+
+    pZipJob->mJobProgress.Reset();
+    pZipJob->mJobProgress.AddBytesToProcess(sourceCD.GetTotalUncompressedBytes());
+
+    tCDFileHeaderList entriesToWrite(sourceCD.mCDFileHeaderList);
+    if (!pZipJob->ApplyLayout(entriesToWrite, ""))
+    {
+        pZipJob->mJobStatus.SetError(JobStatus::kError_NotFound, "Couldn't read layout \"" + pZipJob->msLayout + "\"");
+        return;
+    }
+
+    // Each entry is decompressed and deflated at maximum effort with each of these strategies. The smallest wins.
+    const int kStrategies[] = { Z_DEFAULT_STRATEGY, Z_FILTERED, Z_RLE };
+    const char* kStrategyNames[] = { "deflate-9", "deflate-9-filtered", "deflate-9-rle" };
+    const uint64_t kMaxEntrySize = 1024 * 1024 * 1024;     // larger entries are copied as-is a block at a time rather than held in memory
+
+    // Only stored and deflated entries can be re-encoded. Encrypted, unknown methods, empty and very large entries are copied unchanged.
+    auto canRecompress = [kMaxEntrySize](const cCDFileHeader& cdHeader)
+    {
+        bool bEncrypted = (cdHeader.mGeneralPurposeBitFlag & kGeneralPurposeFlagEncrypted) != 0;
+        bool bKnownMethod = (cdHeader.mCompressionMethod == 0 || cdHeader.mCompressionMethod == 8);
+        return !bEncrypted && bKnownMethod && cdHeader.mUncompressedSize > 0 && cdHeader.mUncompressedSize <= kMaxEntrySize && cdHeader.mCompressedSize <= kMaxEntrySize;
+    };
+
+    // Most a task holds at once: the original stream, the uncompressed data and up to two candidate streams (each under the uncompressed size plus a little)
+    auto workingSet = [&canRecompress](const cCDFileHeader& cdHeader)
+    {
+        return canRecompress(cdHeader) ? cdHeader.mCompressedSize + cdHeader.mUncompressedSize * 3 : 0;
+    };
+
+    auto optimizeEntry = [&sourceAPI, pZipJob, &kStrategies, &kStrategyNames, &canRecompress](cCDFileHeader cdHeader)
+    {
+        if (!canRecompress(cdHeader))
+        {
+            pZipJob->mJobProgress.AddBytesProcessed(cdHeader.mUncompressedSize);
+            return OptimizeTaskResult(OptimizeTaskResult::kRawCopied, cdHeader.mFileName, "original", cdHeader.mCompressionMethod, cdHeader.mCompressedSize, nullptr);
+        }
+
+        shared_ptr<vector<uint8_t> > pOriginal(new vector<uint8_t>((size_t)cdHeader.mCompressedSize));
+        if (cdHeader.mCompressedSize > 0 && !sourceAPI.ExtractRawStreamToBuffer(cdHeader, pOriginal->data()))
+            return OptimizeTaskResult(OptimizeTaskResult::kError, cdHeader.mFileName, "", cdHeader.mCompressionMethod, cdHeader.mCompressedSize, nullptr);
+
+        vector<uint8_t> uncompressed((size_t)cdHeader.mUncompressedSize);
+        if (cdHeader.mCompressionMethod == 0)
+            uncompressed.assign(pOriginal->begin(), pOriginal->end());
+        else if (!sourceAPI.DecompressToBuffer(cdHeader, uncompressed.data()))
+            return OptimizeTaskResult(OptimizeTaskResult::kError, cdHeader.mFileName, "", cdHeader.mCompressionMethod, cdHeader.mCompressedSize, nullptr);
+
+        if (crc32_fast(uncompressed.data(), uncompressed.size(), 0) != cdHeader.mCRC32)
+        {
+            cerr << "CRC mismatch in \"" << cdHeader.mFileName << "\". Copying unchanged.\n";
+            pZipJob->mJobProgress.AddBytesProcessed(cdHeader.mUncompressedSize);
+            return OptimizeTaskResult(OptimizeTaskResult::kRawCopied, cdHeader.mFileName, "original", cdHeader.mCompressionMethod, cdHeader.mCompressedSize, pOriginal);
+        }
+
+        shared_ptr<vector<uint8_t> > pBest;
+        string sBestEncoding;
+        for (size_t i = 0; i < sizeof(kStrategies) / sizeof(kStrategies[0]); i++)
+        {
+            shared_ptr<vector<uint8_t> > pCandidate(new vector<uint8_t>());
+            if (!DeflateBuffer(uncompressed.data(), uncompressed.size(), kStrategies[i], *pCandidate))
+                continue;
+
+            if (!pBest || pCandidate->size() < pBest->size())
+            {
+                pBest = pCandidate;
+                sBestEncoding = kStrategyNames[i];
+            }
+        }
+
+        pZipJob->mJobProgress.AddBytesProcessed(cdHeader.mUncompressedSize);
+
+        if (!pBest || pBest->size() >= cdHeader.mCompressedSize)
+            return OptimizeTaskResult(OptimizeTaskResult::kRawCopied, cdHeader.mFileName, "original", cdHeader.mCompressionMethod, cdHeader.mCompressedSize, pOriginal);
+
+        return OptimizeTaskResult(OptimizeTaskResult::kRecompressed, cdHeader.mFileName, sBestEncoding, 8, cdHeader.mCompressedSize, pBest);
+    };
+
+    cout << StartPageHeader(stringFormat);
+    cout << StartSection(stringFormat);
+    cout << FormatStrings(stringFormat, "Entry", "Original Size", "New Size", "Saved", "Encoding");
+
+    // Entries are optimized in parallel but written in their original order. Only a window of results is held in memory at once,
+    // limited by count and by the job's memory budget. An entry bigger than the whole budget runs once nothing else is pending.
+    ThreadPool pool(pZipJob->mnThreads);
+    deque<pair<cCDFileHeader, shared_future<OptimizeTaskResult> > > pending;
+    const size_t kMaxPending = pZipJob->mnThreads * 2;
+    uint64_t nPendingBytes = 0;
+
+    uint64_t nTotalOriginal = 0;
+    uint64_t nTotalNew = 0;
+    uint64_t nTotalRecompressed = 0;
+    uint64_t nTotalRawCopied = 0;
+    uint64_t nTotalErrors = 0;
+
+    auto writeNext = [&]()
+    {
+        cCDFileHeader cdHeader = pending.front().first;
+        OptimizeTaskResult result = pending.front().second.get();
+        pending.pop_front();
+        nPendingBytes -= workingSet(cdHeader);
+
+        if (result.mOptimizeTaskStatus == OptimizeTaskResult::kError)
+        {
+            cerr << "Failed to read \"" << cdHeader.mFileName << "\". Entry dropped.\n";
+            nTotalErrors++;
+            return;
+        }
+
+        bool bAdded = false;
+        if (result.mpStream)
+        {
+            // A new stream keeps the entry's header but deflate's option bits now describe maximum compression and old flush points no longer apply
+            if (result.mOptimizeTaskStatus == OptimizeTaskResult::kRecompressed)
+            {
+                cdHeader.mGeneralPurposeBitFlag = (cdHeader.mGeneralPurposeBitFlag & ~0x0006) | kDefaultGeneralPurposeFlag;
+                cdHeader.SetFlushPoints(tFlushPointList());
+            }
+            cdHeader.mCompressionMethod = result.mnCompressionMethod;
+            cdHeader.mCompressedSize = result.mnNewCompressedSize;
+            bAdded = destAPI.AddRawEntry(cdHeader, result.mpStream->data());
+        }
+        else
+        {
+            bAdded = destAPI.AddRawEntry(sourceAPI, cdHeader);
+        }
+
+        if (!bAdded)
+        {
+            nTotalErrors++;
+            return;
+        }
+
+        if (result.mOptimizeTaskStatus == OptimizeTaskResult::kRecompressed)
+            nTotalRecompressed++;
+        else
+            nTotalRawCopied++;
+
+        nTotalOriginal += result.mnOriginalCompressedSize;
+        nTotalNew += result.mnNewCompressedSize;
+
+        cout << FormatStrings(stringFormat, result.mFilename, to_string(result.mnOriginalCompressedSize), to_string(result.mnNewCompressedSize), to_string(result.mnOriginalCompressedSize - result.mnNewCompressedSize), result.msEncoding);
+    };
+
+    for (auto cdHeader : entriesToWrite)
+    {
+        uint64_t nWorkingSet = workingSet(cdHeader);
+        while (!pending.empty() && nPendingBytes + nWorkingSet > pZipJob->mnMemoryBudget)
+            writeNext();
+
+        nPendingBytes += nWorkingSet;
+        pending.emplace_back(cdHeader, pool.enqueue(optimizeEntry, cdHeader));
+        if (pending.size() >= kMaxPending)
+            writeNext();
+    }
+
+    while (!pending.empty())
+        writeNext();
+
+    cout << EndSection(stringFormat);
+
+    cout << StartSection(stringFormat);
+    cout << StartDelimiter(stringFormat, 5) << "Optimize Summary" << EndDelimiter(stringFormat);
+    cout << FormatStrings(stringFormat, "Entries Recompressed: ", to_string(nTotalRecompressed));
+    cout << FormatStrings(stringFormat, "Entries Raw Copied: ", to_string(nTotalRawCopied));
+    cout << FormatStrings(stringFormat, "Errors: ", to_string(nTotalErrors));
+    cout << FormatStrings(stringFormat, "Original Compressed Bytes: ", to_string(nTotalOriginal));
+    cout << FormatStrings(stringFormat, "New Compressed Bytes: ", to_string(nTotalNew));
+    cout << FormatStrings(stringFormat, "Bytes Saved: ", to_string(nTotalOriginal - nTotalNew), FormatFriendlyBytes(nTotalOriginal - nTotalNew));
+    cout << EndSection(stringFormat);
+    cout << EndPageFooter(stringFormat);
+
+    if (nTotalErrors == 0)
+        pZipJob->mJobStatus.mStatus = JobStatus::kFinished;
+    else
+        pZipJob->mJobStatus.SetError(JobStatus::kError_ReadFailed, to_string(nTotalErrors) + " entries failed to optimize.");
+}
+
 void ZipJob::RunDiffJob(void* pContext)
 {
     ZipJob* pZipJob = (ZipJob*) pContext;
@@ -277,6 +672,9 @@ void ZipJob::RunDiffJob(void* pContext)
 
     for (auto it : filesystem::recursive_directory_iterator(fullPath))
     {
+        if (it.path().filename() == cSyncIndex::kIndexFilename)
+            continue;
+
         string sRelativePath = it.path().generic_string().substr(pZipJob->msBaseFolder.length());  // get the relative path from the iterator's found path
         bool bIsDirectory = is_directory(it.path());
 
@@ -421,17 +819,49 @@ bool ZipJob::FileNeedsUpdate(const string& sPath, uint64_t nComparedFileSize, ui
         return true;
     }
 
+    // Large files are split across whatever extra threads the job has spare. Every verify worker may get here at once
+    // so the extra threads are shared job wide rather than each starting its own set.
     uint32_t nCRC = 0;
-    uint32_t kCalcBufferSize = 128 * 1024;	// 128k buffer
-    unique_ptr<uint8_t> pCalcBuffer(new uint8_t[kCalcBufferSize]);
-    uint32_t nBytesProcessed = 0;
+    uint32_t nHelpers = 0;
+    if (nFileSize >= kParallelCRCThreshold && mnThreads > 1)
+        nHelpers = AcquireCRCHelpers((uint32_t)std::min<uint64_t>(mnThreads - 1, (nFileSize + kParallelCRCChunkSize - 1) / kParallelCRCChunkSize - 1));
 
-    while (nBytesProcessed < nFileSize)
+    if (nHelpers > 0)
     {
-        uint32_t nBytesRead = 0;
-        pLocalFile->Read(cZZFile::ZZFILE_NO_SEEK, kCalcBufferSize, pCalcBuffer.get(), nBytesRead);
-        nCRC = crc32_16bytes(pCalcBuffer.get(), nBytesRead, nCRC);
-        nBytesProcessed += nBytesRead;
+        pLocalFile->Close();
+        bool bCRCed = false;
+        {
+            cBudgetReservation reservation(mpMemoryBudget, kParallelCRCBufferSize * (nHelpers + 1));
+            bCRCed = ParallelCRC(sPath, nFileSize, nHelpers + 1, nCRC);
+        }
+        ReleaseCRCHelpers(nHelpers);
+
+        if (!bCRCed)
+        {
+            if (mbVerbose)
+                cout << "...changed or unreadable while verifying. NEEDS UPDATE.\n";
+            return true;
+        }
+    }
+    else
+    {
+        cBudgetReservation reservation(mpMemoryBudget, kVerifyBufferSize);
+        cPooledBuffer calcBuffer(kVerifyBufferSize);
+        uint8_t* pCalcBuffer = calcBuffer.Get();
+        uint64_t nBytesProcessed = 0;
+
+        while (nBytesProcessed < nFileSize)
+        {
+            uint32_t nBytesRead = 0;
+            if (!pLocalFile->Read(cZZFile::ZZFILE_NO_SEEK, (uint32_t)kVerifyBufferSize, pCalcBuffer, nBytesRead) || nBytesRead == 0)
+            {
+                if (mbVerbose)
+                    cout << "...read failed at " << nBytesProcessed << ". NEEDS UPDATE.\n";
+                return true;
+            }
+            nCRC = crc32_fast(pCalcBuffer, nBytesRead, nCRC);
+            nBytesProcessed += nBytesRead;
+        }
     }
 
     if (nCRC != nComparedFileCRC)
@@ -449,6 +879,126 @@ bool ZipJob::FileNeedsUpdate(const string& sPath, uint64_t nComparedFileSize, ui
 
 
 
+uint32_t ZipJob::AcquireCRCHelpers(uint32_t nWanted)
+{
+    uint32_t nInUse = mnCRCHelpers;
+    uint32_t nGranted = 0;
+    do
+    {
+        uint32_t nAvailable = (mnThreads > 1 + nInUse) ? mnThreads - 1 - nInUse : 0;
+        nGranted = std::min<uint32_t>(nWanted, nAvailable);
+    } while (nGranted > 0 && !mnCRCHelpers.compare_exchange_weak(nInUse, nInUse + nGranted));
+
+    return nGranted;
+}
+
+bool ZipJob::ParallelCRC(const string& sPath, uint64_t nFileSize, uint32_t nThreads, uint32_t& nCRC)
+{
+    // Each worker opens its own handle so positional reads don't serialize on one file's lock. Workers pull chunk indices
+    // until all are claimed or any of them sees the file end early, fail to read, etc. Partial CRCs are then merged in order.
+    uint64_t nChunks = (nFileSize + kParallelCRCChunkSize - 1) / kParallelCRCChunkSize;
+    if (nThreads > nChunks)
+        nThreads = (uint32_t)nChunks;
+
+    vector<uint32_t> chunkCRCs((size_t)nChunks, 0);
+    atomic<uint64_t> nNextChunk(0);
+    atomic<bool> bCancel(false);
+
+    auto worker = [&]()
+    {
+        shared_ptr<cZZFile> pFile;
+        if (!cZZFile::Open(sPath, cZZFile::ZZFILE_READ, pFile))
+        {
+            bCancel = true;
+            return;
+        }
+
+        cPooledBuffer calcBuffer(kParallelCRCBufferSize);
+        uint8_t* pCalcBuffer = calcBuffer.Get();
+
+        for (uint64_t nChunk = nNextChunk++; nChunk < nChunks && !bCancel; nChunk = nNextChunk++)
+        {
+            uint64_t nOffset = nChunk * kParallelCRCChunkSize;
+            uint64_t nEnd = std::min<uint64_t>(nOffset + kParallelCRCChunkSize, nFileSize);
+            uint32_t nChunkCRC = 0;
+
+            while (nOffset < nEnd && !bCancel)
+            {
+                uint32_t nBytesToRead = (uint32_t)std::min<uint64_t>(kParallelCRCBufferSize, nEnd - nOffset);
+                uint32_t nBytesRead = 0;
+                if (!pFile->Read(nOffset, nBytesToRead, pCalcBuffer, nBytesRead) || nBytesRead != nBytesToRead)
+                {
+                    bCancel = true;     // file shrank or can't be read, no point in hashing the rest
+                    return;
+                }
+                nChunkCRC = crc32_fast(pCalcBuffer, nBytesRead, nChunkCRC);
+                nOffset += nBytesRead;
+            }
+
+            chunkCRCs[(size_t)nChunk] = nChunkCRC;
+        }
+    };
+
+    vector<thread> workers;
+    for (uint32_t i = 1; i < nThreads; i++)
+        workers.emplace_back(worker);
+    worker();
+    for (auto& t : workers)
+        t.join();
+
+    if (bCancel)
+        return false;
+
+    nCRC = chunkCRCs[0];
+    for (uint64_t nChunk = 1; nChunk < nChunks; nChunk++)
+    {
+        uint64_t nChunkSize = std::min<uint64_t>(kParallelCRCChunkSize, nFileSize - nChunk * kParallelCRCChunkSize);
+        nCRC = (uint32_t)crc32_combine(nCRC, chunkCRCs[(size_t)nChunk], (z_off_t)nChunkSize);
+    }
+
+    return true;
+}
+
+
+// Makes sDest a duplicate of the already extracted sSource. Falls back to a copy when the link can't be made (other volume, no support).
+static bool ProduceDuplicate(const string& sSource, const string& sDest, ZipJob::eDuplicateMode mode, bool& bCopied)
+{
+    bCopied = false;
+    std::error_code ec;
+    std::filesystem::remove(sDest, ec);
+
+    if (mode == ZipJob::kDuplicateHardlink)
+    {
+        std::filesystem::create_hard_link(sSource, sDest, ec);
+        if (!ec)
+            return true;
+    }
+#ifdef __linux__
+    else if (mode == ZipJob::kDuplicateReflink)
+    {
+        bool bCloned = false;
+        int nInFD = open(sSource.c_str(), O_RDONLY | O_CLOEXEC);
+        if (nInFD >= 0)
+        {
+            int nOutFD = open(sDest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+            if (nOutFD >= 0)
+            {
+                bCloned = ioctl(nOutFD, FICLONE, nInFD) == 0;
+                close(nOutFD);
+            }
+            close(nInFD);
+        }
+
+        if (bCloned)
+            return true;
+    }
+#endif
+
+    // The standard library hands this to the OS's own copy where there is one
+    bCopied = true;
+    return std::filesystem::copy_file(sSource, sDest, std::filesystem::copy_options::overwrite_existing, ec) && !ec;
+}
+
 void ZipJob::RunDecompressionJob(void* pContext)
 {
     ZipJob* pZipJob = (ZipJob*) pContext;
@@ -474,12 +1024,15 @@ void ZipJob::RunDecompressionJob(void* pContext)
         pZipJob->mJobStatus.SetError(JobStatus::kError_OpenFailed, "Couldn't Open package:\"" + pZipJob->msPackageURL + "\" for Decompression Job!");
         return;
     }
+    zipAPI.SetOutputFlags(pZipJob->mnOutputFlags);
 
     string sExtractPath = pZipJob->msBaseFolder + "/";
 
     cZipCD& zipCD = zipAPI.GetZipCD();
 
     pZipJob->mJobProgress.Reset();
+    pZipJob->mVerifiedFiles.clear();
+    pZipJob->mSyncIndex.Load(pZipJob->msBaseFolder);
 
     tCDFileHeaderList filesToDecompress;
     uint64_t nTotalFilesSkipped = 0;
@@ -516,21 +1069,70 @@ void ZipJob::RunDecompressionJob(void* pContext)
         }
     }
 
-    ThreadPool pool(pZipJob->mnThreads);
-    vector<shared_future<DecompressTaskResult> > decompResults;
+    // Largest entries first (LPT) so that a huge entry found late in the CD doesn't set the job's finishing time
+    vector<cCDFileHeader> entries(filesToDecompress.begin(), filesToDecompress.end());
+    std::stable_sort(entries.begin(), entries.end(), [](const cCDFileHeader& a, const cCDFileHeader& b) { return a.mUncompressedSize > b.mUncompressedSize; });
+
+    // Entries matching an earlier one on CRC, sizes and method are byte identical files under another path. Only the first
+    // of each group (its primary) goes through the pipeline. The rest are made from its output afterwards.
+    const size_t kNoPrimary = (size_t)-1;
+    vector<size_t> primaryOf(entries.size(), kNoPrimary);
+    if (pZipJob->mDuplicateMode != kDuplicateExtract)
+    {
+        map<tuple<uint32_t, uint64_t, uint64_t, uint16_t>, size_t> firstOf;
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (entries[i].mUncompressedSize == 0)
+                continue;
+
+            auto key = make_tuple(entries[i].mCRC32, entries[i].mUncompressedSize, entries[i].mCompressedSize, entries[i].mCompressionMethod);
+            auto it = firstOf.find(key);
+            if (it == firstOf.end())
+                firstOf[key] = i;
+            else
+                primaryOf[i] = it->second;
+        }
+    }
+
+    vector<size_t> duplicates;
+    std::mutex duplicatesMutex;
 
-    for (auto cdHeader : filesToDecompress)
+    // Batch up small entries so each scheduled task carries a reasonable amount of work
+    const uint64_t kBatchBytes = 4 * 1024 * 1024;
+    const size_t kBatchMaxEntries = 256;
+    vector<size_t> batchStarts;
+    uint64_t nBatchBytes = kBatchBytes;
+    for (size_t i = 0; i < entries.size(); i++)
     {
-        decompResults.emplace_back(pool.enqueue([=, &zipCD, &zipAPI, &nTotalTimeOnFileVerification, &nTotalBytesVerified]
+        if (nBatchBytes >= kBatchBytes || i - batchStarts.back() >= kBatchMaxEntries)
+        {
+            batchStarts.push_back(i);
+            nBatchBytes = 0;
+        }
+        nBatchBytes += entries[i].mUncompressedSize;
+    }
+    batchStarts.push_back(entries.size());
+
+    vector<DecompressTaskResult> decompResults(entries.size());
+
+    // Every buffer of file data the job holds (verification reads, fetched streams, inflated data, streaming windows) is
+    // charged against one budget so that peak memory is set by the budget rather than by the thread count.
+    cMemoryBudget budget(pZipJob->mnMemoryBudget);
+    pZipJob->mpMemoryBudget = &budget;
+    uint64_t nMaxBufferedEntry = std::min<uint64_t>(kPipelineMaxEntrySize, pZipJob->mnMemoryBudget / 4);
+
+    // Returns true if the entry needs extracting. Otherwise fills in its result.
+    auto verifyEntry = [pZipJob, &nTotalTimeOnFileVerification, &nTotalBytesVerified](const cCDFileHeader& cdHeader, DecompressTaskResult& result)
         {
             if (cdHeader.mFileName.length() == 0)
-                return DecompressTaskResult(DecompressTaskResult::kAlreadyUpToDate, 0, 0, 0, 0, "", "empty filename.");
+            {
+                result = DecompressTaskResult(DecompressTaskResult::kAlreadyUpToDate, 0, 0, 0, 0, "", "empty filename.");
+                return false;
+            }
 
             std::filesystem::path fullPath(pZipJob->msBaseFolder);
             fullPath.append(cdHeader.mFileName);
 
-
-            // decompress
             if (!filesystem::is_directory(fullPath.parent_path()))
             {
                 if (pZipJob->mbVerbose)
@@ -538,45 +1140,245 @@ void ZipJob::RunDecompressionJob(void* pContext)
                 std::filesystem::create_directories(fullPath.parent_path());
             }
 
-            // If the path ends in '/' it's a folder and shouldn't be processed for decompression
-            if (cdHeader.mFileName[cdHeader.mFileName.length() - 1] != '/')
+            if (pZipJob->mbSkipCRC)
+                return true;
+
+//            boost::posix_time::ptime verificationStartTime = boost::posix_time::microsec_clock::local_time();
+            uint64_t verificationStartTime = GetUSSinceEpoch();
+
+            bool bNeedsUpdate = true;
+            VerifiedFileInfo verified;
+            uint32_t nIndexedCRC = 0;
+            if (!pZipJob->mbParanoid && pZipJob->mSyncIndex.Lookup(cdHeader.mFileName, fullPath.string(), nIndexedCRC))
+            {
+                // Stat data unchanged since the file was last verified so its recorded CRC can be trusted
+                bNeedsUpdate = nIndexedCRC != cdHeader.mCRC32;
+                if (pZipJob->mbVerbose)
+                    cout << "Sync index: " << fullPath.string() << (bNeedsUpdate ? " differs. NEEDS UPDATE.\n" : " unchanged.\n");
+            }
+            else
             {
-                if (!pZipJob->mbSkipCRC)	// If doing CRC checking
+                bool bStatted = cSyncIndex::StatFile(fullPath.string(), verified.mnSize, verified.mnModificationTime, verified.mnInode);
+                bNeedsUpdate = pZipJob->FileNeedsUpdate(fullPath.string(), cdHeader.mUncompressedSize, cdHeader.mCRC32);
+                if (!bNeedsUpdate && bStatted)
                 {
-//                    boost::posix_time::ptime verificationStartTime = boost::posix_time::microsec_clock::local_time();
-                    uint64_t verificationStartTime = GetUSSinceEpoch();
+                    verified.msPath = fullPath.string();
+                    verified.mnCRC32 = cdHeader.mCRC32;
+                    verified.mbVerified = true;
+                }
+            }
+
+//            boost::posix_time::ptime verificationEndTime = boost::posix_time::microsec_clock::local_time();
+            uint64_t verificationEndTime = GetUSSinceEpoch();
 
-                    bool bNeedsUpdate = pZipJob->FileNeedsUpdate(fullPath.string(), cdHeader.mUncompressedSize, cdHeader.mCRC32);
+//            boost::posix_time::time_duration verificationDelta = verificationEndTime - verificationStartTime;
+            uint64_t verificationDelta = verificationEndTime - verificationStartTime;
+
+            nTotalTimeOnFileVerification += verificationDelta;
+            nTotalBytesVerified += cdHeader.mUncompressedSize;   // in reality it's the size of the file on the drive but this should be good enough for tracking purposes
+
+            if (!bNeedsUpdate)
+            {
+                pZipJob->mJobProgress.AddBytesProcessed(cdHeader.mUncompressedSize);
+                result = DecompressTaskResult(DecompressTaskResult::kAlreadyUpToDate, 0, 0, 0, 0, cdHeader.mFileName, "already matches target.", verified);
+                return false;
+            }
+
+            return true;
+        };
+
+    auto outputPath = [pZipJob](const cCDFileHeader& cdHeader)
+        {
+            std::filesystem::path fullPath(pZipJob->msBaseFolder);
+            fullPath.append(cdHeader.mFileName);
+            return fullPath.generic_string();
+        };
 
-//                    boost::posix_time::ptime verificationEndTime = boost::posix_time::microsec_clock::local_time();
-                    uint64_t verificationEndTime = GetUSSinceEpoch();
+    // Extraction pipeline. Entries that need extracting flow verify -> fetch -> inflate -> write with a bounded queue
+    // between stages and threads per stage sized for what the stage waits on: many fetchers for a remote package,
+    // one inflater per thread and a few writers. Buffers are charged against a byte budget when fetched and refunded
+    // once written, which throttles the fetchers when inflating or writing falls behind.
+    bool bRemotePackage = pZipJob->msPackageURL.substr(0, 4) == "http";
 
-//                    boost::posix_time::time_duration verificationDelta = verificationEndTime - verificationStartTime;
-                    uint64_t verificationDelta = verificationEndTime - verificationStartTime;
+    // A local package's duplicates are confirmed by comparing their raw streams with the primary's. For a remote one that
+    // would download the bytes being saved so the CD is trusted, unless asked to be paranoid.
+    bool bTrustDuplicates = bRemotePackage && !pZipJob->mbParanoid;
 
-                    nTotalTimeOnFileVerification += verificationDelta;
-                    nTotalBytesVerified += cdHeader.mUncompressedSize;   // in reality it's the size of the file on the drive but this should be good enough for tracking purposes
+    uint32_t nFetchers = bRemotePackage ? pZipJob->mnThreads * 4 : pZipJob->mnThreads;
+    uint32_t nInflaters = pZipJob->mnThreads;
+    uint32_t nWriters = std::min<uint32_t>(pZipJob->mnThreads, 4);
 
+    cBoundedQueue<cExtractItem> fetchQueue(nFetchers * 2);
+    cBoundedQueue<cExtractItem> inflateQueue(nInflaters * 2);
+    cBoundedQueue<cExtractItem> writeQueue(nWriters * 2);
 
-                    if (!bNeedsUpdate)
+    auto fetchStage = [&]()
+        {
+            cExtractItem item;
+            while (fetchQueue.Pop(item))
+            {
+                const cCDFileHeader& cdHeader = entries[item.mnIndex];
+
+                // Entries too large to hold in memory are streamed straight to disk through fixed size windows.
+                // Large stored entries of a local package go the same way since DecompressToFile has the kernel copy those.
+                bool bKernelCopy = !bRemotePackage && cdHeader.mCompressionMethod == 0 && cdHeader.mCompressedSize >= kKernelCopyMinSize;
+                if (cdHeader.mUncompressedSize > nMaxBufferedEntry || cdHeader.mCompressedSize > nMaxBufferedEntry || bKernelCopy)
+                {
                     {
-                        pZipJob->mJobProgress.AddBytesProcessed(cdHeader.mUncompressedSize);
-                        return DecompressTaskResult(DecompressTaskResult::kAlreadyUpToDate, 0, 0, 0, 0, cdHeader.mFileName, "already matches target.");
+                        cBudgetReservation reservation(&budget, kStreamedEntryBudget);
+                        VerifiedFileInfo verified;
+                        if (zipAPI.DecompressToFile(cdHeader.mFileName, outputPath(cdHeader), &pZipJob->mJobProgress, &verified))
+                            decompResults[item.mnIndex] = DecompressTaskResult(DecompressTaskResult::kExtracted, 0, cdHeader.mCompressedSize, cdHeader.mUncompressedSize, 0, cdHeader.mFileName, "Extracted File", verified);
+                        else
+                            decompResults[item.mnIndex] = DecompressTaskResult(DecompressTaskResult::kError, 0, 0, 0, 0, cdHeader.mFileName, "Error Decompressing to File");
                     }
+                    cPooledBuffer::FreeThreadCache();      // don't let the windows outlive their reservation in this thread's pool
+                    continue;
                 }
 
-                    if (zipAPI.DecompressToFile(cdHeader.mFileName, fullPath.generic_string(), &pZipJob->mJobProgress))
+                item.mnBudget = cdHeader.mCompressedSize;
+                if (cdHeader.mCompressionMethod != 0)
+                    item.mnBudget += cdHeader.mUncompressedSize;
+                budget.Acquire(item.mnBudget);
+
+                item.mpStream.reset(new uint8_t[(size_t)cdHeader.mCompressedSize]);
+                if (!zipAPI.ExtractRawStreamToBuffer(cdHeader, item.mpStream.get()))
+                {
+                    decompResults[item.mnIndex] = DecompressTaskResult(DecompressTaskResult::kError, 0, 0, 0, 0, cdHeader.mFileName, "Error reading compressed stream");
+                    item.mpStream.reset();
+                    budget.Release(item.mnBudget);
+                    continue;
+                }
+
+                inflateQueue.Push(std::move(item));
+            }
+        };
+
+    auto inflateStage = [&]()
+        {
+            cExtractItem item;
+            while (inflateQueue.Pop(item))
+            {
+                const cCDFileHeader& cdHeader = entries[item.mnIndex];
+
+                if (cdHeader.mCompressionMethod == 0)
+                {
+                    // stored, the stream is the data
+                    item.mnCRC = crc32_fast(item.mpStream.get(), (size_t)cdHeader.mUncompressedSize, 0);
+                    item.mpData = std::move(item.mpStream);
+                    pZipJob->mJobProgress.AddBytesProcessed(cdHeader.mUncompressedSize);
+                }
+                else
+                {
+                    item.mpData.reset(new uint8_t[(size_t)cdHeader.mUncompressedSize]);
+                    bool bInflated = zipAPI.InflateRawStream(cdHeader, item.mpStream.get(), item.mpData.get(), &item.mnCRC, &pZipJob->mJobProgress);
+                    item.mpStream.reset();
+                    if (!bInflated)
                     {
-                        return DecompressTaskResult(DecompressTaskResult::kExtracted, 0, cdHeader.mCompressedSize, cdHeader.mUncompressedSize, 0, cdHeader.mFileName, "Extracted File");
+                        decompResults[item.mnIndex] = DecompressTaskResult(DecompressTaskResult::kError, 0, 0, 0, 0, cdHeader.mFileName, "Error Decompressing to File");
+                        item.mpData.reset();
+                        budget.Release(item.mnBudget);
+                        continue;
                     }
-                    else
+                }
+
+                writeQueue.Push(std::move(item));
+            }
+        };
+
+    auto writeStage = [&]()
+        {
+            cExtractItem item;
+            while (writeQueue.Pop(item))
+            {
+                const cCDFileHeader& cdHeader = entries[item.mnIndex];
+
+                VerifiedFileInfo verified;
+                if (zipAPI.WriteVerifiedFile(cdHeader, item.mpData.get(), item.mnCRC, outputPath(cdHeader), &verified))
+                    decompResults[item.mnIndex] = DecompressTaskResult(DecompressTaskResult::kExtracted, 0, cdHeader.mCompressedSize, cdHeader.mUncompressedSize, 0, cdHeader.mFileName, "Extracted File", verified);
+                else
+                    decompResults[item.mnIndex] = DecompressTaskResult(DecompressTaskResult::kError, 0, 0, 0, 0, cdHeader.mFileName, "Error Decompressing to File");
+
+                item.mpData.reset();
+                budget.Release(item.mnBudget);
+            }
+        };
+
+    vector<thread> fetchers, inflaters, writers;
+    for (uint32_t i = 0; i < nFetchers; i++)
+        fetchers.emplace_back(fetchStage);
+    for (uint32_t i = 0; i < nInflaters; i++)
+        inflaters.emplace_back(inflateStage);
+    for (uint32_t i = 0; i < nWriters; i++)
+        writers.emplace_back(writeStage);
+
+    {
+        WorkStealingPool pool(pZipJob->mnThreads);
+        pool.parallel_for(batchStarts.size() - 1, 1, [&](size_t nBatch)
+        {
+            for (size_t i = batchStarts[nBatch]; i < batchStarts[nBatch + 1]; i++)
+            {
+                if (verifyEntry(entries[i], decompResults[i]))
+                {
+                    if (primaryOf[i] != kNoPrimary && (bTrustDuplicates || zipAPI.SameRawStream(entries[primaryOf[i]], entries[i])))
                     {
-                        return DecompressTaskResult(DecompressTaskResult::kError, 0, 0, 0, 0, cdHeader.mFileName, "Error Decompressing to File");
+                        std::lock_guard<std::mutex> lock(duplicatesMutex);
+                        duplicates.push_back(i);
+                        continue;
                     }
+
+                    cExtractItem item;
+                    item.mnIndex = i;
+                    fetchQueue.Push(std::move(item));
+                }
             }
+        });
+    }
 
-          return DecompressTaskResult(DecompressTaskResult::kFolderCreated, 0, 0, 0, 0, cdHeader.mFileName, "Created Folder");
-        }));
+    // Drain the stages in order
+    fetchQueue.Close();
+    for (auto& t : fetchers)
+        t.join();
+    inflateQueue.Close();
+    for (auto& t : inflaters)
+        t.join();
+    writeQueue.Close();
+    for (auto& t : writers)
+        t.join();
+    pZipJob->mpMemoryBudget = nullptr;
+
+    // Duplicates from their primary's file, now that it's on disk. If the primary failed they're extracted themselves.
+    {
+        WorkStealingPool pool(pZipJob->mnThreads);
+        pool.parallel_for(duplicates.size(), 1, [&](size_t nDuplicate)
+        {
+            size_t i = duplicates[nDuplicate];
+            const cCDFileHeader& cdHeader = entries[i];
+            const DecompressTaskResult& primaryResult = decompResults[primaryOf[i]];
+
+            bool bPrimaryOnDisk = primaryResult.mDecompressTaskStatus == DecompressTaskResult::kExtracted || primaryResult.mDecompressTaskStatus == DecompressTaskResult::kAlreadyUpToDate;
+            bool bCopied = false;
+            if (bPrimaryOnDisk && ProduceDuplicate(outputPath(entries[primaryOf[i]]), outputPath(cdHeader), pZipJob->mDuplicateMode, bCopied))
+            {
+                VerifiedFileInfo verified;
+                if (cSyncIndex::StatFile(outputPath(cdHeader), verified.mnSize, verified.mnModificationTime, verified.mnInode))
+                {
+                    verified.msPath = outputPath(cdHeader);
+                    verified.mnCRC32 = cdHeader.mCRC32;
+                    verified.mbVerified = primaryResult.mVerified.mbVerified;
+                }
+
+                pZipJob->mJobProgress.AddBytesProcessed(cdHeader.mUncompressedSize);
+                decompResults[i] = DecompressTaskResult(DecompressTaskResult::kExtracted, 0, 0, bCopied ? cdHeader.mUncompressedSize : 0, 0, cdHeader.mFileName, "Duplicate of " + entries[primaryOf[i]].mFileName, verified);
+                return;
+            }
+
+            VerifiedFileInfo verified;
+            if (zipAPI.DecompressToFile(cdHeader.mFileName, outputPath(cdHeader), &pZipJob->mJobProgress, &verified))
+                decompResults[i] = DecompressTaskResult(DecompressTaskResult::kExtracted, 0, cdHeader.mCompressedSize, cdHeader.mUncompressedSize, 0, cdHeader.mFileName, "Extracted File", verified);
+            else
+                decompResults[i] = DecompressTaskResult(DecompressTaskResult::kError, 0, 0, 0, 0, cdHeader.mFileName, "Error Decompressing to File");
+        });
     }
 
     uint64_t nTotalBytesDownloaded = 0;
@@ -585,15 +1387,25 @@ void ZipJob::RunDecompressionJob(void* pContext)
     uint64_t nTotalErrors = 0;
     uint64_t nTotalFilesUpToDate = 0;
     uint64_t nTotalFilesUpdated = 0;
-    for (auto &result : decompResults)
+    for (auto &taskResult : decompResults)
     {
-        DecompressTaskResult taskResult = result.get();
         if (taskResult.mDecompressTaskStatus == DecompressTaskResult::kError)
+        {
             nTotalErrors++;
+            pZipJob->mSyncIndex.Remove(taskResult.mFilename);
+        }
         else if (taskResult.mDecompressTaskStatus == DecompressTaskResult::kAlreadyUpToDate)
+        {
             nTotalFilesUpToDate++;
+            pZipJob->mSyncIndex.Record(taskResult.mFilename, taskResult.mVerified);
+        }
         else if (taskResult.mDecompressTaskStatus == DecompressTaskResult::kExtracted)
+        {
             nTotalFilesUpdated++;
+            if (taskResult.mVerified.mbVerified)
+                pZipJob->mVerifiedFiles.push_back(taskResult.mVerified);
+            pZipJob->mSyncIndex.Record(taskResult.mFilename, taskResult.mVerified);
+        }
         else if (taskResult.mDecompressTaskStatus == DecompressTaskResult::kFolderCreated)
             nTotalFoldersCreated++;
 
@@ -603,6 +1415,8 @@ void ZipJob::RunDecompressionJob(void* pContext)
         //		cout << taskResult << "\n";
     }
 
+    pZipJob->mSyncIndex.Save();
+
 
 
     uint64_t endTime = GetUSSinceEpoch();
@@ -621,7 +1435,7 @@ void ZipJob::RunDecompressionJob(void* pContext)
     {
         cout << "Total Files Verified:              " << nTotalFilesUpToDate << "\n";
         cout << "Total Bytes Verified:              " << FormatFriendlyBytes(nTotalBytesVerified);
-        if (nTotalTimeOnFileVerification > 0)
+        if (nTotalTimeOnFileVerification >= 1000)     // index hits can verify everything in under a millisecond
             cout << " (Rate:" << (nTotalBytesVerified / 1024) / (nTotalTimeOnFileVerification / 1000) << "MB/s)";
         cout << "\n";
     }
@@ -633,6 +1447,8 @@ void ZipJob::RunDecompressionJob(void* pContext)
     {
 
         cout << "Total Files Extracted:             " << nTotalFilesUpdated << "\n";
+        if (!duplicates.empty())
+            cout << "Total Duplicates Reused:           " << duplicates.size() << "\n";
         cout << "Total Folders Created:             " << nTotalFoldersCreated << "\n";
         cout << "Total Errors:                      " << nTotalErrors << "\n";
 
@@ -664,6 +1480,8 @@ void ZipJob::RunDecompressionJob(void* pContext)
             cout << "No files needed to be extracted.\n";
     }
 
+    cout << "Peak Buffered Memory:              " << FormatFriendlyBytes(budget.GetPeak()) << " (Budget:" << FormatFriendlyBytes(budget.GetLimit()) << ")\n";
+
     if (pZipJob->mbVerbose)
     {
         cout << "[--------------------------------------------------------------]\n";
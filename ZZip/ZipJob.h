@@ -17,8 +17,11 @@
 #include <stdint.h>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include "ZipHeaders.h"
 #include "ZZipTrackers.h"
+#include "SyncIndex.h"
+#include "common/MemoryBudget.h"
 
 
 class ZZipAPI;
@@ -33,15 +36,27 @@ public:
         kExtract = 1,  
         kCompress = 2,
         kDiff = 3,
-        kList = 4
+        kList = 4,
+        kAdd = 5,           // Adds or replaces files in an existing archive
+        kOptimize = 6       // Recompresses an existing archive into a new (smaller) one
     };
 
-    ZipJob(eJobType jobType) : mbSkipCRC(false), mbKillHoldingProcess(false), mnThreads(6), mOutputFormat(kTabs), mbVerbose(false) { mJobType = jobType; }
+    // How extraction produces files whose entry matches an earlier one (same CRC, sizes and method)
+    enum eDuplicateMode
+    {
+        kDuplicateExtract = 0,      // extract each one separately
+        kDuplicateCopy = 1,         // copy the first one's output
+        kDuplicateHardlink = 2,     // hard link to the first one's output. They're then one file so changing either changes both.
+        kDuplicateReflink = 3       // copy on write clone where the filesystem supports it (btrfs, xfs), otherwise a copy
+    };
+
+    ZipJob(eJobType jobType) : mbSkipCRC(false), mbKillHoldingProcess(false), mnThreads(6), mOutputFormat(kTabs), mbVerbose(false), mnCompactThresholdPercent(25), mbStreaming(false), mbParanoid(false), mnMemoryBudget(256 * 1024 * 1024), mpMemoryBudget(nullptr), mDuplicateMode(kDuplicateCopy), mnOutputFlags(0), mnCRCHelpers(0) { mJobType = jobType; }
 
     ~ZipJob();
 
     // Configuration API
     void SetURL(const std::string& sURL)                { msPackageURL = sURL; }
+    void SetOutputURL(const std::string& sURL)          { msOutputURL = sURL; }
     void SetNamePassword(const std::string& sName, const std::string& sPassword) { msName = sName; msPassword = sPassword; }
     void SetBaseFolder(const std::string& sBaseFolder);
     void SetPattern(const std::string& sPattern)        { msPattern = sPattern; }
@@ -50,6 +65,13 @@ public:
     void SetNumThreads(uint32_t nThreads)           { if (!mbVerbose) mnThreads = nThreads; }   // verbose mode is single threaded
     void SetOutputFormat(eToStringFormat format)    { mOutputFormat = format; }
     void SetVerbose(bool bVerbose)                  { mbVerbose = bVerbose; if (mbVerbose) mnThreads = 1; }
+    void SetCompactThreshold(uint32_t nPercent)     { mnCompactThresholdPercent = nPercent; }
+    void SetStreaming(bool bStreaming)              { mbStreaming = bStreaming; }
+    void SetLayout(const std::string& sLayout)      { msLayout = sLayout; }
+    void SetParanoid(bool bParanoid)                { mbParanoid = bParanoid; }
+    void SetMemoryBudget(uint64_t nBytes)           { mnMemoryBudget = nBytes; }
+    void SetDuplicateMode(eDuplicateMode mode)      { mDuplicateMode = mode; }
+    void SetOutputFlags(uint32_t nFlags)            { mnOutputFlags = nFlags; }
     
     // Controls
     bool Run();
@@ -59,20 +81,27 @@ public:
     bool IsDone() { return mJobStatus.mStatus == JobStatus::eJobStatus::kFinished || mJobStatus.mStatus == JobStatus::eJobStatus::kError; }
     JobStatus GetStatus() { return mJobStatus; }    // makes a copy
     Progress GetProgress() { return mJobProgress; } // makes a copy
+    const std::list<VerifiedFileInfo>& GetVerifiedFiles() const { return mVerifiedFiles; }    // files written and CRC checked by the last decompress job
 
 private:
     bool FileNeedsUpdate(const std::string& sPath, uint64_t nComparedFileSize, uint32_t nComparedFileCRC);
+    uint32_t AcquireCRCHelpers(uint32_t nWanted);      // claims up to nWanted of the job's mnThreads-1 extra CRC threads. Returns how many it got.
+    void ReleaseCRCHelpers(uint32_t nHelpers)      { mnCRCHelpers -= nHelpers; }
+    static bool ParallelCRC(const std::string& sPath, uint64_t nFileSize, uint32_t nThreads, uint32_t& nCRC);   // CRCs chunks concurrently and merges them. false if the file changed or couldn't be read.
+    bool ApplyLayout(tCDFileHeaderList& entries, const std::string& sPrefix);     // orders entries (named sPrefix + relative path) for msLayout
 
     static void RunDecompressionJob(void* pContext);
     static void RunCompressionJob(void* pContext);
     static void RunDiffJob(void* pContext);
     static void RunListJob(void* pContext);
+    static void RunOptimizeJob(void* pContext);
 
     tThreadList         mWorkers;
     std::mutex          mMutex;
 
     eJobType            mJobType;           
     std::string             msPackageURL;           // source package URL
+    std::string             msOutputURL;            // destination package for jobs that write a new package from the source
     std::string             msName;                 // Auth
     std::string             msPassword;             // Auth
     std::string             msBaseFolder;           // Destination base folder. (default is the folder of ZZipUpdate.exe)
@@ -84,6 +113,17 @@ private:
     JobStatus           mJobStatus; 
     Progress            mJobProgress;
     bool                mbVerbose;
+    uint32_t            mnCompactThresholdPercent;  // When adding to an archive, compact it if superseded entries exceed this percentage of its size
+    bool                mbStreaming;            // When creating, write strictly sequentially so the package can be a pipe or fifo
+    std::list<VerifiedFileInfo> mVerifiedFiles;     // filled by the decompress job
+    cSyncIndex          mSyncIndex;             // verified stat data of files in msBaseFolder from previous updates
+    bool                mbParanoid;             // ignore mSyncIndex and re-CRC every file
+    uint64_t            mnMemoryBudget;         // cap on bytes of file data buffered at once while extracting or optimizing
+    cMemoryBudget*      mpMemoryBudget;         // the extraction job's budget while it runs, otherwise nullptr
+    eDuplicateMode      mDuplicateMode;
+    uint32_t            mnOutputFlags;          // cZZFileOutput::kOutputMapped, kOutputDirect and/or kOutputSparse for extracted files
+    std::atomic<uint32_t> mnCRCHelpers;         // extra threads ParallelCRC calls are running right now, across all verify workers
+    std::string             msLayout;               // When creating or optimizing, order of entries: "" (as found), "dirs" (grouped by directory) or a file listing entries to place first
 };
 
 
@@ -12,6 +12,7 @@
 #include "zlib.h"
 #include "zutil.h"
 #include <iostream>
+#include <vector>
 
 #ifndef ZLIB_INTERNAL
 #define ZLIB_INTERNAL
@@ -35,6 +36,7 @@ ZDecompressor::ZDecompressor()
     mTotalOutputBytes = 0;
     mStatus = Z_OK;
     mbFinalPass = false;
+    mbInflateInitted = false;
 }
 
 ZDecompressor::~ZDecompressor()
@@ -65,15 +67,23 @@ int32_t ZDecompressor::Init()
     mTotalOutputBytes = 0;
     mbFinalPass = false;
 
+    // Re-Init of a used decompressor keeps its inflate state and output buffer and just resets them
+    if (mbInflateInitted)
+    {
+        mStatus = inflateReset(mpZStream);
+        return mStatus;
+    }
+
     mStatus = inflateInit2(mpZStream, -MAX_WBITS);
     if (mStatus != Z_OK)
         return mStatus;
+    mbInflateInitted = true;
 
-    uint8_t* pNew = (uint8_t*)ZALLOC(mpZStream, 1, mnOutputBufferSpace + kDefaultDecompressBuffer);
-    memcpy((void*)pNew, mpOutputBuffer, mnOutputBufferSpace);
-    ZFREE(mpZStream, mpOutputBuffer);
-    mpOutputBuffer = pNew;
-    mnOutputBufferSpace += kDefaultDecompressBuffer;
+    if (!mpOutputBuffer)
+    {
+        mpOutputBuffer = (uint8_t*)ZALLOC(mpZStream, 1, kDefaultDecompressBuffer);
+        mnOutputBufferSpace = kDefaultDecompressBuffer;
+    }
 
     return mStatus;
 }
@@ -90,11 +100,13 @@ int32_t ZDecompressor::Shutdown()
     mTotalInputBytesProcessed = 0;
     mTotalOutputBytes = 0;
 
-    inflateEnd(mpZStream);
+    if (mbInflateInitted)
+        inflateEnd(mpZStream);
     free(mpZStream);
     mpZStream = NULL;
 
     mInitialized = false;
+    mbInflateInitted = false;
     mbFinalPass = false;
 
     return Z_OK;
@@ -151,18 +163,10 @@ int32_t ZDecompressor::Decompress()
         }
 
         if (mStatus == Z_STREAM_END)
-        {
-            inflateEnd(mpZStream);
             return Z_STREAM_END;
-        }
 
-        if (mStatus < 0)
-        {
-            if (mStatus != Z_BUF_ERROR)
-                inflateEnd(mpZStream);
-            else
-                mStatus = Z_OK; // Explicitly allow Z_BUF_ERROR because we either have more data coming, or we will catch this error via other means
-        }
+        if (mStatus == Z_BUF_ERROR)
+            mStatus = Z_OK; // Explicitly allow Z_BUF_ERROR because we either have more data coming, or we will catch this error via other means
     }
 
     return mStatus;
@@ -200,6 +204,9 @@ ZCompressor::ZCompressor()
 
     mTotalInputBytesProcessed = 0;
     mTotalOutputBytes = 0;
+    mbPendingOutput = false;
+    mnCompressionLevel = Z_DEFAULT_COMPRESSION;
+    mnStrategy = Z_DEFAULT_STRATEGY;
 }
 
 ZCompressor::~ZCompressor()
@@ -207,7 +214,7 @@ ZCompressor::~ZCompressor()
     Shutdown();
 }
 
-int32_t ZCompressor::Init(int nCompressionLevel)
+int32_t ZCompressor::Init(int nCompressionLevel, int nStrategy)
 {
     if (!mbInitted)
     {
@@ -219,7 +226,9 @@ int32_t ZCompressor::Init(int nCompressionLevel)
         mpZStream->next_in = nullptr;
         mpZStream->avail_in = 0;
 
-        mStatus = deflateInit2(mpZStream, nCompressionLevel, Z_DEFLATED, -MAX_WBITS, 9, Z_DEFAULT_STRATEGY);
+        mStatus = deflateInit2(mpZStream, nCompressionLevel, Z_DEFLATED, -MAX_WBITS, 9, nStrategy);
+        mnCompressionLevel = nCompressionLevel;
+        mnStrategy = nStrategy;
 
         if (mStatus == Z_OK)
         {
@@ -227,18 +236,35 @@ int32_t ZCompressor::Init(int nCompressionLevel)
             mnOutputAvailable = 0;
             mTotalInputBytesProcessed = 0;
             mTotalOutputBytes = 0;      
+            mbPendingOutput = false;
         }
 
-        uint8_t* pNew = (uint8_t*)ZALLOC(mpZStream, 1, mnOutputBufferSpace + kDefaultCompressBuffer);
-        memcpy((void*)pNew, mpOutputBuffer, mnOutputBufferSpace);
-        ZFREE(mpZStream, mpOutputBuffer);
-        mpOutputBuffer = pNew;
-        mnOutputBufferSpace += kDefaultCompressBuffer;
+        if (!mpOutputBuffer)
+        {
+            mpOutputBuffer = (uint8_t*)ZALLOC(mpZStream, 1, kDefaultCompressBuffer);
+            mnOutputBufferSpace = kDefaultCompressBuffer;
+        }
     }
 
     return mStatus;
 }
 
+int32_t ZCompressor::Reset()
+{
+    if (!mbInitted)
+        return Z_ERRNO;
+
+    mnOutputAvailable = 0;
+    mTotalInputBytesProcessed = 0;
+    mTotalOutputBytes = 0;
+    mbPendingOutput = false;
+
+    mpZStream->next_in = nullptr;
+    mpZStream->avail_in = 0;
+    mStatus = deflateReset(mpZStream);
+    return mStatus;
+}
+
 int32_t ZCompressor::Shutdown()
 {
     if (mpOutputBuffer)
@@ -251,7 +277,8 @@ int32_t ZCompressor::Shutdown()
     mTotalInputBytesProcessed = 0;
     mTotalOutputBytes = 0;
 
-    deflateEnd(mpZStream);
+    if (mpZStream)
+        deflateEnd(mpZStream);
     free(mpZStream);
     mpZStream = NULL;
 
@@ -278,7 +305,7 @@ int32_t ZCompressor::InitStream(uint8_t* sourceStream, int32_t sourceLength)
     return Z_OK;
 }
 
-int32_t ZCompressor::Compress(bool bFinalBlock)
+int32_t ZCompressor::Compress(bool bFinalBlock, bool bFullFlush)
 {
     if (!mbInitted)
     {
@@ -288,7 +315,7 @@ int32_t ZCompressor::Compress(bool bFinalBlock)
 
     mnOutputAvailable = 0;
 
-    if (mpZStream->avail_in > 0)
+    if (mpZStream->avail_in > 0 || mbPendingOutput)
     {
         mpZStream->next_out = (uint8_t*)(mpOutputBuffer);
         mpZStream->avail_out = (uInt)mnOutputBufferSpace;
@@ -298,6 +325,8 @@ int32_t ZCompressor::Compress(bool bFinalBlock)
 
         if (bFinalBlock)
             mStatus = deflate(mpZStream, Z_FINISH);
+        else if (bFullFlush)
+            mStatus = deflate(mpZStream, Z_FULL_FLUSH);
         else
             mStatus = deflate(mpZStream, Z_SYNC_FLUSH);
 
@@ -311,6 +340,8 @@ int32_t ZCompressor::Compress(bool bFinalBlock)
         mnOutputAvailable = bytesCompressed;
         mTotalInputBytesProcessed += bytesProcessed;
         mTotalOutputBytes += bytesCompressed;
+
+        mbPendingOutput = (mStatus == Z_OK && mpZStream->avail_out == 0);
     }
 
     return mStatus;
@@ -337,3 +368,79 @@ bool ZCompressor::NeedsMoreInput()
 
     return mStatus == Z_OK;
 }
+
+
+const size_t kMaxPooledCodecs = 4;      // per thread
+
+// Codecs released by a thread, ready to be reset and reused by it
+class cThreadCodecs
+{
+public:
+    std::vector<std::unique_ptr<ZDecompressor> >    mDecompressors;
+    std::vector<std::unique_ptr<ZCompressor> >      mCompressors;
+};
+
+static cThreadCodecs& GetThreadCodecs()
+{
+    static thread_local cThreadCodecs codecs;
+    return codecs;
+}
+
+void ZCodecRelease::operator()(ZDecompressor* pDecompressor) const
+{
+    cThreadCodecs& codecs = GetThreadCodecs();
+    if (codecs.mDecompressors.size() < kMaxPooledCodecs)
+        codecs.mDecompressors.emplace_back(pDecompressor);
+    else
+        delete pDecompressor;
+}
+
+void ZCodecRelease::operator()(ZCompressor* pCompressor) const
+{
+    cThreadCodecs& codecs = GetThreadCodecs();
+    if (codecs.mCompressors.size() < kMaxPooledCodecs)
+        codecs.mCompressors.emplace_back(pCompressor);
+    else
+        delete pCompressor;
+}
+
+ZDecompressorPtr cZCodecPool::AcquireDecompressor()
+{
+    cThreadCodecs& codecs = GetThreadCodecs();
+
+    ZDecompressorPtr pDecompressor;
+    if (!codecs.mDecompressors.empty())
+    {
+        pDecompressor.reset(codecs.mDecompressors.back().release());
+        codecs.mDecompressors.pop_back();
+    }
+    else
+    {
+        pDecompressor.reset(new ZDecompressor());
+    }
+
+    pDecompressor->Init();     // inflateReset on a pooled one
+    return pDecompressor;
+}
+
+ZCompressorPtr cZCodecPool::AcquireCompressor(int nCompressionLevel, int nStrategy)
+{
+    cThreadCodecs& codecs = GetThreadCodecs();
+
+    // deflate state depends on level and strategy so only a matching one can be reset and reused
+    for (size_t i = 0; i < codecs.mCompressors.size(); i++)
+    {
+        ZCompressor* pPooled = codecs.mCompressors[i].get();
+        if (pPooled->GetCompressionLevel() == nCompressionLevel && pPooled->GetStrategy() == nStrategy && pPooled->Reset() == Z_OK)
+        {
+            ZCompressorPtr pCompressor(codecs.mCompressors[i].release());
+            codecs.mCompressors.erase(codecs.mCompressors.begin() + i);
+            return pCompressor;
+        }
+    }
+
+    ZCompressorPtr pCompressor(new ZCompressor());
+    if (pCompressor->Init(nCompressionLevel, nStrategy) != Z_OK)
+        pCompressor.reset();
+    return pCompressor;
+}
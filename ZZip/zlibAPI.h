@@ -15,6 +15,7 @@
 
 #include <stdint.h>
 #include <zlib.h>
+#include <memory>
 
 class ZDecompressor
 {
@@ -22,7 +23,7 @@ public:
     ZDecompressor();
     ~ZDecompressor();
 
-    int32_t     Init();
+    int32_t     Init();             // also readies a used decompressor for a new stream
     int32_t     Shutdown();
 
     int32_t     InitStream(uint8_t* pInputBuf, int32_t nLength);
@@ -48,6 +49,7 @@ private:
     uint64_t    mTotalInputBytesProcessed;      // all the compressed data passed in
     uint64_t    mTotalOutputBytes;				// all of the decompressed data returned
     bool        mbFinalPass;                    // Input and output buffers may be exhausted but there may be more to inflate so another pass may be needed
+    bool        mbInflateInitted;               // inflate state is allocated and can be reset for the next stream
 };
 
 class ZCompressor
@@ -56,11 +58,12 @@ public:
     ZCompressor();
     ~ZCompressor();
 
-    int32_t     Init(int nCompressionLevel = Z_DEFAULT_COMPRESSION);
+    int32_t     Init(int nCompressionLevel = Z_DEFAULT_COMPRESSION, int nStrategy = Z_DEFAULT_STRATEGY);
+    int32_t     Reset();            // readies an initialized compressor for a new stream with the same level and strategy
     int32_t     Shutdown();
 
     int32_t     InitStream(uint8_t* pInputBuf, int32_t nLength);
-    int32_t     Compress(bool bFinalBlock = false);     // bFinalBlock flushes stream if no more data incoming.  
+    int32_t     Compress(bool bFinalBlock = false, bool bFullFlush = false);     // bFinalBlock flushes stream if no more data incoming. bFullFlush also resets the dictionary so inflating can start after this input.
 
     bool        HasMoreOutput();    // true if there is more output pending that didn't fit into the output buffer
     bool        NeedsMoreInput();   // true if the decompressor hasn't reached the end of the stream (Z_STREAM_END)
@@ -71,6 +74,8 @@ public:
     uint64_t    GetTotalInputBytesProcessed() { return mTotalInputBytesProcessed; }
     uint64_t	GetTotalOutputBytes() { return mTotalOutputBytes; }
 
+    int         GetCompressionLevel() { return mnCompressionLevel; }
+    int         GetStrategy() { return mnStrategy; }
 
 private:
     bool        mbInitted;
@@ -82,6 +87,29 @@ private:
     uint64_t    mnOutputAvailable;
     uint64_t    mTotalInputBytesProcessed;
     uint64_t    mTotalOutputBytes;
+    bool        mbPendingOutput;                // Output buffer was filled so deflate may be holding more even though all input was consumed
+    int         mnCompressionLevel;
+    int         mnStrategy;
+};
+
+// Per-thread pools of initialized codecs so that extracting or compressing many small files doesn't set up and tear down
+// zlib state and buffers for each one. Acquired codecs are ready for a new stream and go back to the pool of whichever
+// thread releases them.
+class ZCodecRelease
+{
+public:
+    void operator()(ZDecompressor* pDecompressor) const;
+    void operator()(ZCompressor* pCompressor) const;
+};
+
+typedef std::unique_ptr<ZDecompressor, ZCodecRelease>  ZDecompressorPtr;
+typedef std::unique_ptr<ZCompressor, ZCodecRelease>    ZCompressorPtr;
+
+class cZCodecPool
+{
+public:
+    static ZDecompressorPtr AcquireDecompressor();
+    static ZCompressorPtr   AcquireCompressor(int nCompressionLevel = Z_DEFAULT_COMPRESSION, int nStrategy = Z_DEFAULT_STRATEGY);   // empty if deflate couldn't be set up
 };
 
 
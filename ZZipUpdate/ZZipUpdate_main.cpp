@@ -23,6 +23,7 @@
 #include "zlibAPI.h"
 #include <filesystem>
 #include "ZipJob.h"
+#include "common/ZZFileOutput.h"
 #include "helpers/CommandLineParser.h"
 
 using namespace std;
@@ -30,6 +31,7 @@ using namespace std;
 // App Globals for reading command line
 ZipJob::eJobType    gCommand        = ZipJob::eJobType::kNone;
 string             gsPackageURL;	                            // source package URL
+string             gsOutputURL;                                // destination package for optimize
 string             gsAuthName;
 string             gsAuthPassword;
 string             gsBaseFolder;                               // base folder. (default is the folder of ZZipUpdate.exe)
@@ -41,6 +43,15 @@ string              gsOutputFormat;
 eToStringFormat     gOutputFormat	= kTabs;                    // For lists or diff operations, output in various formats
 bool                gbVerbose       = false;                    // Diagnostics. Forces single threaded operation and spits out a lot of logging data.
 bool                gbSkipCertCheck = false;
+int64_t             gnCompactThreshold = 25;                    // When adding to an archive, compact once superseded entries exceed this percentage
+string              gsLayout;                                   // create/optimize entry order: "dirs" or a file listing entries to place first
+bool                gbStreaming     = false;                    // When creating, write strictly sequentially (no seeks) so ZIPPATH can be a pipe or fifo
+bool                gbParanoid      = false;                    // When updating, ignore the sync index and re-CRC every local file
+int64_t             gnMemoryBudgetMB = 256;                     // Cap on file data buffered at once when updating or extracting
+bool                gbOutputMapped  = false;                    // When updating or extracting, write files through a shared mapping
+bool                gbOutputDirect  = false;                    // When updating or extracting, write large files with O_DIRECT
+bool                gbOutputSparse  = false;                    // When updating or extracting, leave holes for runs of zeros
+string              gsDuplicates;                               // How identical entries under different paths are produced: "copy" (default), "hardlink", "reflink" or "extract"
 
 
 using namespace CLP;
@@ -101,6 +112,18 @@ int _tmain(int argc, _TCHAR* argv[])
     parser.RegisterMode("create", "Creates a ZIP archive from a given folder or file.");
     parser.RegisterParam("create", ParamDesc("ZIPPATH", &gsPackageURL, CLP::kPositional | CLP::kRequired, "Path of the ZIP archive to create."));
     parser.RegisterParam("create", ParamDesc("FOLDER", &gsBaseFolder, CLP::kPositional | CLP::kRequired, "Base folder of files add to the archive"));
+    parser.RegisterParam("create", ParamDesc("layout", &gsLayout, CLP::kNamed | CLP::kOptional, "Order of entries in the archive. \"dirs\" groups files by directory. Otherwise a file listing entries (e.g. an access trace or startup list) to place first, one per line."));
+    parser.RegisterParam("create", ParamDesc("streaming", &gbStreaming, CLP::kNamed | CLP::kOptional, "Write the archive in a single sequential pass using data descriptors so ZIPPATH can be a pipe or fifo."));
+
+    parser.RegisterMode("add", "Adds or replaces files in an existing ZIP archive without rebuilding it. (Creates the archive if it doesn't exist.)");
+    parser.RegisterParam("add", ParamDesc("ZIPPATH", &gsPackageURL, CLP::kPositional | CLP::kRequired, "Path of the ZIP archive to modify."));
+    parser.RegisterParam("add", ParamDesc("FOLDER", &gsBaseFolder, CLP::kPositional | CLP::kRequired, "Base folder of files to add to the archive"));
+    parser.RegisterParam("add", ParamDesc("compact", &gnCompactThreshold, CLP::kNamed | CLP::kOptional | CLP::kRangeRestricted, "Compact the archive when superseded entries exceed this percentage of its size. Defaults to 25.", 0, 100));
+
+    parser.RegisterMode("optimize", "Recompresses every entry of a ZIP archive at maximum effort into a new, smaller archive readable by any unzip.");
+    parser.RegisterParam("optimize", ParamDesc("ZIPPATH", &gsPackageURL, CLP::kPositional | CLP::kRequired, "Path or URL to the ZIP archive to optimize"));
+    parser.RegisterParam("optimize", ParamDesc("OUTPUT", &gsOutputURL, CLP::kPositional | CLP::kRequired, "Path of the optimized ZIP archive to create"));
+    parser.RegisterParam("optimize", ParamDesc("layout", &gsLayout, CLP::kNamed | CLP::kOptional, "Reorder entries in the new archive. \"dirs\" groups files by directory. Otherwise a file listing entries to place first, one per line."));
 
     parser.RegisterMode("diff", "Compares the contents of a ZIP archive with a local folder and reports the differences." );
     parser.RegisterParam("diff", ParamDesc("ZIPPATH", &gsPackageURL, CLP::kPositional | CLP::kRequired, "Path or URL to a ZIP archive"));
@@ -110,6 +133,7 @@ int _tmain(int argc, _TCHAR* argv[])
     parser.RegisterParam("update", ParamDesc("ZIPPATH", &gsPackageURL, CLP::kPositional | CLP::kRequired, "Path or URL to a ZIP archive"));
     parser.RegisterParam("update", ParamDesc("FOLDER", &gsBaseFolder, CLP::kPositional | CLP::kRequired, "Base folder to update"));
     parser.RegisterParam("update", ParamDesc("skipcrc", &gbSkipCRC, CLP::kNamed | CLP::kOptional, "Skip CRC checks for matching files and overwrite everything when doing an update. (Same behavior as extract.)"));
+    parser.RegisterParam("update", ParamDesc("paranoid", &gbParanoid, CLP::kNamed | CLP::kOptional, "Ignore the sync index (.zzsync) and re-CRC every local file. Normally files whose size, time and inode are unchanged since they were last verified are not re-read."));
 
     parser.RegisterMode("extract", "Extracts files from a ZIP archive.");
     parser.RegisterParam("extract", ParamDesc("ZIPPATH", &gsPackageURL, CLP::kPositional | CLP::kRequired, "Path or URL to a ZIP archive"));
@@ -121,6 +145,11 @@ int _tmain(int argc, _TCHAR* argv[])
     parser.RegisterParam(ParamDesc("password", &gsAuthPassword, CLP::kNamed | CLP::kOptional, "Auth password"));
 
     parser.RegisterParam(ParamDesc("threads", &gNumThreads, CLP::kNamed | CLP::kOptional | CLP::kRangeRestricted, "Number of threads to use when updating or extracting. Defaults to number of CPU cores.", 1, 256));
+    parser.RegisterParam(ParamDesc("memory", &gnMemoryBudgetMB, CLP::kNamed | CLP::kOptional | CLP::kRangeRestricted, "Megabytes of file data to buffer at most when updating, extracting or optimizing. Threads wait for buffers once it's used up. Defaults to 256.", 16, 1024*1024));
+    parser.RegisterParam(ParamDesc("duplicates", &gsDuplicates, CLP::kNamed | CLP::kOptional, "When updating or extracting, how files identical to one already extracted (same CRC and size) are produced. \"copy\" (default) copies it, \"hardlink\" links to it (both paths are then the same file), \"reflink\" clones it where the filesystem supports that and \"extract\" extracts every one."));
+    parser.RegisterParam(ParamDesc("mapped", &gbOutputMapped, CLP::kNamed | CLP::kOptional, "When updating or extracting, write files through a shared memory mapping instead of write calls."));
+    parser.RegisterParam(ParamDesc("direct", &gbOutputDirect, CLP::kNamed | CLP::kOptional, "When updating or extracting, write large files with O_DIRECT so they bypass the page cache."));
+    parser.RegisterParam(ParamDesc("sparse", &gbOutputSparse, CLP::kNamed | CLP::kOptional, "When updating or extracting, leave holes in files for long runs of zeros (e.g. disk images) instead of writing them. Turns off -mapped."));
     parser.RegisterParam(ParamDesc("skip_cert_check", &gbSkipCertCheck, CLP::kNamed | CLP::kOptional, "If true, bypasses certificate verification on secure connetion. (Careful!)"));
 
     parser.RegisterParam(ParamDesc("verbose", &gbVerbose, CLP::kNamed | CLP::kOptional, "Noisy logging for diagnostic purposes. (note: can slow down operations significantly. Also forces single threaded operation.)"));
@@ -152,6 +181,19 @@ int _tmain(int argc, _TCHAR* argv[])
     else
         gOutputFormat = kUnknown;
 
+    ZipJob::eDuplicateMode duplicateMode = ZipJob::kDuplicateCopy;
+    if (gsDuplicates == "hardlink")
+        duplicateMode = ZipJob::kDuplicateHardlink;
+    else if (gsDuplicates == "reflink")
+        duplicateMode = ZipJob::kDuplicateReflink;
+    else if (gsDuplicates == "extract")
+        duplicateMode = ZipJob::kDuplicateExtract;
+    else if (!gsDuplicates.empty() && gsDuplicates != "copy")
+    {
+        cout << "ERROR: Unknown duplicates mode \"" << gsDuplicates << "\". Use copy, hardlink, reflink or extract.\n";
+        return -1;
+    }
+
 
     if (parser.GetAppMode() == "list")
         gCommand = ZipJob::kList;
@@ -159,6 +201,10 @@ int _tmain(int argc, _TCHAR* argv[])
         gCommand = ZipJob::kDiff;
     else if (parser.GetAppMode() == "create")
         gCommand = ZipJob::kCompress;
+    else if (parser.GetAppMode() == "add")
+        gCommand = ZipJob::kAdd;
+    else if (parser.GetAppMode() == "optimize")
+        gCommand = ZipJob::kOptimize;
     else if (parser.GetAppMode() == "update")
     {
         gCommand = ZipJob::kExtract;
@@ -180,6 +226,7 @@ int _tmain(int argc, _TCHAR* argv[])
     ZipJob newJob(gCommand);
     newJob.SetBaseFolder(gsBaseFolder);
     newJob.SetURL(gsPackageURL);
+    newJob.SetOutputURL(gsOutputURL);
     newJob.SetNamePassword(gsAuthName, gsAuthPassword);
     newJob.SetSkipCRC(gbSkipCRC);
     newJob.SetNumThreads((uint32_t) gNumThreads);
@@ -187,6 +234,21 @@ int _tmain(int argc, _TCHAR* argv[])
     newJob.SetPattern(gsPattern);
 //    newJob.SetKillHoldingProcess(gbKill);
     newJob.SetVerbose(gbVerbose);
+    newJob.SetCompactThreshold((uint32_t) gnCompactThreshold);
+    newJob.SetStreaming(gbStreaming);
+    newJob.SetLayout(gsLayout);
+    newJob.SetParanoid(gbParanoid);
+    newJob.SetMemoryBudget((uint64_t)gnMemoryBudgetMB * 1024 * 1024);
+    newJob.SetDuplicateMode(duplicateMode);
+
+    uint32_t nOutputFlags = 0;
+    if (gbOutputMapped)
+        nOutputFlags |= cZZFileOutput::kOutputMapped;
+    if (gbOutputDirect)
+        nOutputFlags |= cZZFileOutput::kOutputDirect;
+    if (gbOutputSparse)
+        nOutputFlags |= cZZFileOutput::kOutputSparse;
+    newJob.SetOutputFlags(nOutputFlags);
 
     newJob.Run();
     newJob.Join();  // will output progress to cout until completed
@@ -0,0 +1,72 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// BoundedQueue
+//
+// Purpose: Fixed capacity multi-producer/multi-consumer queue for handing work between pipeline stages.
+//          Push blocks while the queue is full. Pop blocks until an item arrives or the queue is closed and drained.
+//
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+template <typename T>
+class cBoundedQueue
+{
+public:
+    cBoundedQueue(size_t nCapacity) : mnCapacity(nCapacity ? nCapacity : 1), mbClosed(false) {}
+
+    bool Push(T&& item)     // false if the queue was closed
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mNotFull.wait(lock, [&] { return mbClosed || mItems.size() < mnCapacity; });
+        if (mbClosed)
+            return false;
+
+        mItems.push_back(std::move(item));
+        lock.unlock();
+        mNotEmpty.notify_one();
+        return true;
+    }
+
+    bool Pop(T& item)       // false once the queue is closed and empty
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mNotEmpty.wait(lock, [&] { return mbClosed || !mItems.empty(); });
+        if (mItems.empty())
+            return false;
+
+        item = std::move(mItems.front());
+        mItems.pop_front();
+        lock.unlock();
+        mNotFull.notify_one();
+        return true;
+    }
+
+    void Close()            // no more pushes. Consumers drain what's left.
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mbClosed = true;
+        }
+        mNotEmpty.notify_all();
+        mNotFull.notify_all();
+    }
+
+private:
+    size_t                  mnCapacity;
+    bool                    mbClosed;
+    std::deque<T>           mItems;
+    std::mutex              mMutex;
+    std::condition_variable mNotFull;
+    std::condition_variable mNotEmpty;
+};
@@ -0,0 +1,168 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// BufferPool
+//
+// Purpose: Aligned I/O buffers recycled through a per-thread free list so that per-file work (extracting,
+//          verifying, compressing) doesn't hit the heap for every file. A cPooledBuffer returns its memory
+//          to the pool of whichever thread destroys it.
+//
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+class cPooledBuffer
+{
+public:
+    static const size_t kAlignment = 4096;                  // page aligned so buffers suit unbuffered/direct I/O
+    static const size_t kMinSize = 64 * 1024;               // requests are rounded up to a power of two no smaller than this
+    static const size_t kMaxPooledSize = 16 * 1024 * 1024;  // larger buffers are freed rather than kept
+    static const size_t kMaxPooledBytes = 24 * 1024 * 1024; // most any one thread keeps around
+    static const size_t kMaxPooledBuffers = 8;
+
+    cPooledBuffer() : mpData(nullptr), mnSize(0) {}
+    explicit cPooledBuffer(size_t nMinSize) : mpData(nullptr), mnSize(0) { Acquire(nMinSize); }
+    ~cPooledBuffer() { Release(); }
+
+    cPooledBuffer(cPooledBuffer&& other) : mpData(other.mpData), mnSize(other.mnSize) { other.mpData = nullptr; other.mnSize = 0; }
+    cPooledBuffer& operator=(cPooledBuffer&& other)
+    {
+        if (this != &other)
+        {
+            Release();
+            mpData = other.mpData;
+            mnSize = other.mnSize;
+            other.mpData = nullptr;
+            other.mnSize = 0;
+        }
+        return *this;
+    }
+
+    cPooledBuffer(const cPooledBuffer&) = delete;
+    cPooledBuffer& operator=(const cPooledBuffer&) = delete;
+
+    uint8_t*    Get() const { return mpData; }
+    size_t      Size() const { return mnSize; }     // may be larger than requested
+
+    void Acquire(size_t nMinSize)
+    {
+        Release();
+
+        size_t nSize = kMinSize;
+        while (nSize < nMinSize)
+            nSize <<= 1;
+
+        // smallest cached buffer that fits
+        cFreeList& freeList = GetFreeList();
+        size_t nBest = freeList.mBuffers.size();
+        for (size_t i = 0; i < freeList.mBuffers.size(); i++)
+        {
+            if (freeList.mBuffers[i].mnSize >= nSize && (nBest == freeList.mBuffers.size() || freeList.mBuffers[i].mnSize < freeList.mBuffers[nBest].mnSize))
+                nBest = i;
+        }
+
+        if (nBest < freeList.mBuffers.size())
+        {
+            mpData = freeList.mBuffers[nBest].mpData;
+            mnSize = freeList.mBuffers[nBest].mnSize;
+            freeList.mnBytes -= mnSize;
+            freeList.mBuffers[nBest] = freeList.mBuffers.back();
+            freeList.mBuffers.pop_back();
+            return;
+        }
+
+        mpData = AlignedAlloc(nSize);
+        mnSize = nSize;
+    }
+
+    void Release()
+    {
+        if (!mpData)
+            return;
+
+        cFreeList& freeList = GetFreeList();
+        if (mnSize <= kMaxPooledSize && freeList.mnBytes + mnSize <= kMaxPooledBytes && freeList.mBuffers.size() < kMaxPooledBuffers)
+        {
+            freeList.mBuffers.push_back(cEntry{ mpData, mnSize });
+            freeList.mnBytes += mnSize;
+        }
+        else
+        {
+            AlignedFree(mpData);
+        }
+
+        mpData = nullptr;
+        mnSize = 0;
+    }
+
+    // Frees everything cached by the calling thread
+    static void FreeThreadCache()
+    {
+        cFreeList& freeList = GetFreeList();
+        for (auto& entry : freeList.mBuffers)
+            AlignedFree(entry.mpData);
+        freeList.mBuffers.clear();
+        freeList.mnBytes = 0;
+    }
+
+private:
+    struct cEntry
+    {
+        uint8_t*    mpData;
+        size_t      mnSize;
+    };
+
+    struct cFreeList
+    {
+        cFreeList() : mnBytes(0) {}
+        ~cFreeList() { for (auto& entry : mBuffers) AlignedFree(entry.mpData); }
+        std::vector<cEntry> mBuffers;
+        size_t              mnBytes;
+    };
+
+    static cFreeList& GetFreeList()
+    {
+        static thread_local cFreeList freeList;
+        return freeList;
+    }
+
+    static uint8_t* AlignedAlloc(size_t nSize)
+    {
+#ifdef _WIN32
+        void* p = _aligned_malloc(nSize, kAlignment);
+#else
+        void* p = nullptr;
+        if (posix_memalign(&p, kAlignment, nSize) != 0)
+            p = nullptr;
+#endif
+        if (!p)
+            throw std::bad_alloc();
+        return (uint8_t*)p;
+    }
+
+    static void AlignedFree(uint8_t* p)
+    {
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+
+    uint8_t*    mpData;
+    size_t      mnSize;
+};
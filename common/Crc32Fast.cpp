@@ -201,6 +201,255 @@ uint32_t crc32_16bytes_prefetch(const void* data, size_t length, uint32_t previo
 
 
 
+// //////////////////////////////////////////////////////////
+// hardware accelerated CRC32 with runtime dispatch
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+  #define CRC32_HAS_PCLMUL
+  #include <wmmintrin.h>
+  #include <smmintrin.h>
+  #ifdef _MSC_VER
+    #include <intrin.h>
+    #define CRC32_TARGET_PCLMUL
+  #else
+    #include <cpuid.h>
+    #define CRC32_TARGET_PCLMUL __attribute__((target("pclmul,sse4.1")))
+  #endif
+#endif
+
+#if defined(__aarch64__) && defined(__linux__) && defined(__GNUC__)
+  #define CRC32_HAS_ARMV8
+  #include <arm_acle.h>
+  #include <sys/auxv.h>
+  #include <asm/hwcap.h>
+#endif
+
+
+#ifdef CRC32_HAS_PCLMUL
+/// fold 16-byte lanes with carry-less multiplies, then Barrett reduce (Intel "Fast CRC Computation Using PCLMULQDQ")
+/// length must be at least 64 and a multiple of 16. crc is the raw (non-inverted) register.
+CRC32_TARGET_PCLMUL static uint32_t crc32_pclmul_fold(const uint8_t* current, size_t length, uint32_t crc)
+{
+  // bit-reflected x^n mod P constants for the zip polynomial, followed by P' and P for the reduction
+  alignas(16) static const uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+  alignas(16) static const uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+  alignas(16) static const uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+  alignas(16) static const uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+  x1 = _mm_loadu_si128((const __m128i*)(current + 0x00));
+  x2 = _mm_loadu_si128((const __m128i*)(current + 0x10));
+  x3 = _mm_loadu_si128((const __m128i*)(current + 0x20));
+  x4 = _mm_loadu_si128((const __m128i*)(current + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+  x0 = _mm_load_si128((const __m128i*)k1k2);
+
+  current += 64;
+  length  -= 64;
+
+  // four lanes in parallel, 64 bytes per iteration
+  while (length >= 64)
+  {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+    y5 = _mm_loadu_si128((const __m128i*)(current + 0x00));
+    y6 = _mm_loadu_si128((const __m128i*)(current + 0x10));
+    y7 = _mm_loadu_si128((const __m128i*)(current + 0x20));
+    y8 = _mm_loadu_si128((const __m128i*)(current + 0x30));
+
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+    current += 64;
+    length  -= 64;
+  }
+
+  // fold the four lanes into one
+  x0 = _mm_load_si128((const __m128i*)k3k4);
+
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  // remaining 16 byte blocks
+  while (length >= 16)
+  {
+    x2 = _mm_loadu_si128((const __m128i*)current);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    current += 16;
+    length  -= 16;
+  }
+
+  // 128 bits => 64 bits
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x1 = _mm_srli_si128(x1, 8);
+  x1 = _mm_xor_si128(x1, x2);
+
+  x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, x3);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction to 32 bits
+  x0 = _mm_load_si128((const __m128i*)poly);
+
+  x2 = _mm_and_si128(x1, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+  x2 = _mm_and_si128(x2, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+/// compute CRC32 (PCLMULQDQ folding, slicing-by-16 for short buffers and the tail)
+static uint32_t crc32_pclmul(const void* data, size_t length, uint32_t previousCrc32)
+{
+  const uint8_t* current = (const uint8_t*) data;
+
+  if (length >= 64)
+  {
+    size_t blocks = length & ~(size_t)15;
+    previousCrc32 = ~crc32_pclmul_fold(current, blocks, ~previousCrc32);
+    current += blocks;
+    length  -= blocks;
+  }
+
+  return crc32_16bytes(current, length, previousCrc32);
+}
+
+static bool cpu_has_pclmul()
+{
+  // CPUID leaf 1: ECX bit 1 = PCLMULQDQ, bit 19 = SSE4.1
+#ifdef _MSC_VER
+  int regs[4];
+  __cpuid(regs, 1);
+  unsigned int ecx = (unsigned int) regs[2];
+#else
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return false;
+#endif
+  return (ecx & (1 << 1)) && (ecx & (1 << 19));
+}
+#endif // CRC32_HAS_PCLMUL
+
+
+#ifdef CRC32_HAS_ARMV8
+/// compute CRC32 (ARMv8 CRC32 instructions, 8 bytes per step)
+__attribute__((target("+crc"))) static uint32_t crc32_armv8(const void* data, size_t length, uint32_t previousCrc32)
+{
+  uint32_t crc = ~previousCrc32;
+  const uint8_t* current = (const uint8_t*) data;
+
+  // align to 8 bytes
+  while (length != 0 && ((uintptr_t) current & 7) != 0)
+  {
+    crc = __crc32b(crc, *current++);
+    length--;
+  }
+
+  const uint64_t* current64 = (const uint64_t*) current;
+  while (length >= 32)
+  {
+    crc = __crc32d(crc, current64[0]);
+    crc = __crc32d(crc, current64[1]);
+    crc = __crc32d(crc, current64[2]);
+    crc = __crc32d(crc, current64[3]);
+    current64 += 4;
+    length    -= 32;
+  }
+  while (length >= 8)
+  {
+    crc = __crc32d(crc, *current64++);
+    length -= 8;
+  }
+
+  current = (const uint8_t*) current64;
+  while (length-- != 0)
+    crc = __crc32b(crc, *current++);
+
+  return ~crc;
+}
+
+static bool cpu_has_armv8_crc()
+{
+  return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#endif // CRC32_HAS_ARMV8
+
+
+typedef uint32_t (*Crc32Function)(const void* data, size_t length, uint32_t previousCrc32);
+
+static Crc32Function select_crc32(const char** name)
+{
+#ifdef CRC32_HAS_PCLMUL
+  if (cpu_has_pclmul())
+  {
+    *name = "pclmul";
+    return crc32_pclmul;
+  }
+#endif
+#ifdef CRC32_HAS_ARMV8
+  if (cpu_has_armv8_crc())
+  {
+    *name = "armv8";
+    return crc32_armv8;
+  }
+#endif
+  *name = "slicing-by-16";
+  return crc32_16bytes;
+}
+
+static const char* crc32_kernel_name = "slicing-by-16";
+
+/// picked on first use so it is safe to call from other static initializers
+static Crc32Function crc32_kernel()
+{
+  static const Crc32Function kernel = select_crc32(&crc32_kernel_name);
+  return kernel;
+}
+
+/// compute CRC32 (fastest kernel available on this CPU)
+uint32_t crc32_fast(const void* data, size_t length, uint32_t previousCrc32)
+{
+  return crc32_kernel()(data, length, previousCrc32);
+}
+
+/// name of the kernel crc32_fast dispatches to
+const char* crc32_fast_kernel()
+{
+  crc32_kernel();
+  return crc32_kernel_name;
+}
+
+
 // //////////////////////////////////////////////////////////
 // constants
 
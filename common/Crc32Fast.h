@@ -6,6 +6,8 @@
 // see http://create.stephan-brumme.com/disclaimer.html
 //
 
+#pragma once
+
 #include <stdint.h>
 #include <stddef.h>
 
@@ -13,3 +15,7 @@
 uint32_t crc32_16bytes (const void* data, size_t length, uint32_t previousCrc32 = 0);
 /// compute CRC32 (Slicing-by-16 algorithm, prefetch upcoming data blocks)
 uint32_t crc32_16bytes_prefetch(const void* data, size_t length, uint32_t previousCrc32 = 0, size_t prefetchAhead = 256);
+/// compute CRC32 (PCLMULQDQ or ARMv8 CRC32 instructions when the CPU has them, otherwise Slicing-by-16)
+uint32_t crc32_fast(const void* data, size_t length, uint32_t previousCrc32 = 0);
+/// name of the kernel picked by crc32_fast at startup
+const char* crc32_fast_kernel();
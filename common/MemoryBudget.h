@@ -0,0 +1,70 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// MemoryBudget
+//
+// Purpose: Caps the bytes held in flight by a job's buffers. Acquire blocks while the budget is used up
+//          so that producers (e.g. network fetches) slow down to the pace of consumers (e.g. disk writes).
+//
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+#include <condition_variable>
+
+class cMemoryBudget
+{
+public:
+    cMemoryBudget(uint64_t nLimit) : mnLimit(nLimit), mnInFlight(0), mnPeak(0) {}
+
+    // Blocks until nBytes fit in the budget. A request larger than the whole budget is let through once nothing else is in flight.
+    void Acquire(uint64_t nBytes)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [&] { return mnInFlight == 0 || mnInFlight + nBytes <= mnLimit; });
+        mnInFlight += nBytes;
+        if (mnInFlight > mnPeak)
+            mnPeak = mnInFlight;
+    }
+
+    void Release(uint64_t nBytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mnInFlight -= nBytes;
+        }
+        mCondition.notify_all();
+    }
+
+    uint64_t GetLimit() const { return mnLimit; }
+    uint64_t GetPeak() { std::lock_guard<std::mutex> lock(mMutex); return mnPeak; }
+
+private:
+    uint64_t                mnLimit;
+    uint64_t                mnInFlight;
+    uint64_t                mnPeak;
+    std::mutex              mMutex;
+    std::condition_variable mCondition;
+};
+
+// Holds nBytes of a budget for its lifetime. A null budget reserves nothing.
+class cBudgetReservation
+{
+public:
+    cBudgetReservation(cMemoryBudget* pBudget, uint64_t nBytes) : mpBudget(pBudget), mnBytes(nBytes) { if (mpBudget) mpBudget->Acquire(mnBytes); }
+    ~cBudgetReservation() { if (mpBudget) mpBudget->Release(mnBytes); }
+
+    cBudgetReservation(const cBudgetReservation&) = delete;
+    cBudgetReservation& operator=(const cBudgetReservation&) = delete;
+
+private:
+    cMemoryBudget*  mpBudget;
+    uint64_t        mnBytes;
+};
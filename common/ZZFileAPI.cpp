@@ -34,7 +34,7 @@ enum
 
 
 // Factory
-bool cZZFile::Open(const string& sURL, bool bWrite, shared_ptr<cZZFile>& pFile, const string& sName, const string& sPassword, bool bVerbose)
+bool cZZFile::Open(const string& sURL, uint32_t nOpenMode, shared_ptr<cZZFile>& pFile, const string& sName, const string& sPassword, bool bVerbose)
 {
     // 2022/9/17 - temp setting verbose
     //bVerbose = true;
@@ -51,13 +51,13 @@ bool cZZFile::Open(const string& sURL, bool bWrite, shared_ptr<cZZFile>& pFile,
     }
 
     pFile.reset(pNewFile);
-    return pNewFile->OpenInternal(sURL, bWrite, sName, sPassword, bVerbose);   // call protected virtualized Open
+    return pNewFile->OpenInternal(sURL, nOpenMode, sName, sPassword, bVerbose);   // call protected virtualized Open
 }
 
-bool cZZFile::Open(const wstring& sURL, bool bWrite, shared_ptr<cZZFile>& pFile, const wstring& sName, const wstring& sPassword, bool bVerbose)
+bool cZZFile::Open(const wstring& sURL, uint32_t nOpenMode, shared_ptr<cZZFile>& pFile, const wstring& sName, const wstring& sPassword, bool bVerbose)
 {
 //    return Open(string(sURL.begin(), sURL.end()), bWrite, pFile, bVerbose);
-    return Open(StringHelpers::wstring_to_string(sURL), bWrite, pFile, StringHelpers::wstring_to_string(sName), StringHelpers::wstring_to_string(sPassword), bVerbose);
+    return Open(StringHelpers::wstring_to_string(sURL), nOpenMode, pFile, StringHelpers::wstring_to_string(sName), StringHelpers::wstring_to_string(sPassword), bVerbose);
 }
 
 
@@ -65,7 +65,7 @@ cZZFile::cZZFile() : mnFileSize(0), mnLastError(kZZfileError_None)
 {
 }
 
-cZZFileLocal::cZZFileLocal() : cZZFile()
+cZZFileLocal::cZZFileLocal() : cZZFile(), mbStreaming(false)
 {
 }
 
@@ -74,13 +74,31 @@ cZZFileLocal::~cZZFileLocal()
     cZZFileLocal::Close();
 }
 
-bool cZZFileLocal::OpenInternal(string sURL, bool bWrite, string sName, string sPassword, bool bVerbose)
+bool cZZFileLocal::OpenInternal(string sURL, uint32_t nOpenMode, string sName, string sPassword, bool bVerbose)
 {
     mnLastError = kZZfileError_None;
     mbVerbose = bVerbose;
+    mbStreaming = (nOpenMode == ZZFILE_WRITE_STREAM);
+    msPath = sURL;
 
-    if (bWrite)
+    if (mbStreaming)
+    {
+        // Output only so that pipes and fifos can be opened. Nothing can be queried about the stream so just count what gets written.
+        mFileStream.open(sURL, ios_base::out | ios_base::binary | ios_base::trunc);
+        if (mFileStream.fail())
+        {
+            mnLastError = errno;
+            return false;
+        }
+
+        mnFileSize = 0;
+        return true;
+    }
+
+    if (nOpenMode == ZZFILE_WRITE)
         mFileStream.open(sURL, ios_base::in | ios_base::out | ios_base::binary | ios_base::trunc);
+    else if (nOpenMode == ZZFILE_MODIFY)
+        mFileStream.open(sURL, ios_base::in | ios_base::out | ios_base::binary);
     else
         mFileStream.open(sURL, ios_base::in | ios_base::binary);
 
@@ -113,6 +131,15 @@ bool cZZFileLocal::Read(int64_t nOffset, uint32_t nBytes, uint8_t* pDestination,
 
     mnLastError = kZZfileError_None;
 
+    if (mbStreaming)
+    {
+        mnLastError = kZZFileError_Unsupported;
+        cerr << "Cannot read from a write stream.\n";
+        return false;
+    }
+
+    mFileStream.clear();    // a short read at the end of the file leaves eof/fail set, which would fail every later seek
+
     if (nOffset != ZZFILE_NO_SEEK)
     {
         mFileStream.seekg(nOffset, ios::beg);
@@ -143,6 +170,31 @@ bool cZZFileLocal::Write(int64_t nOffset, uint32_t nBytes, uint8_t* pSource, uin
 
     mnLastError = kZZfileError_None;
 
+    if (mbStreaming)
+    {
+        // The only permitted "seek" is to where the stream already is
+        if (nOffset >= 0 && (uint64_t)nOffset != mnFileSize)
+        {
+            mnLastError = kZZFileError_Unsupported;
+            cerr << "Cannot seek to " << nOffset << " on a write stream at offset " << mnFileSize << "\n";
+            return false;
+        }
+
+        mFileStream.write((char*)pSource, nBytes);
+        if (mFileStream.fail())
+        {
+            mnLastError = errno;
+            cerr << "Failed to write:" << nBytes << " bytes! Reason: " << mnLastError << "\n";
+            return false;
+        }
+
+        nBytesWritten = nBytes;
+        mnFileSize += nBytes;
+        return true;
+    }
+
+    mFileStream.clear();
+
     if (nOffset == ZZFILE_SEEK_END)
     {
         mFileStream.seekg(0, ios::end);
@@ -227,11 +279,11 @@ void cHTTPFile::unlock_cb(CURL* handle, curl_lock_data data, void* userp)
 }
 
 
-bool cHTTPFile::OpenInternal(string sURL, bool bWrite, string sName, string sPassword, bool bVerbose)       // todo maybe someday use real URI class
+bool cHTTPFile::OpenInternal(string sURL, uint32_t nOpenMode, string sName, string sPassword, bool bVerbose)       // todo maybe someday use real URI class
 {
     mnLastError = kZZfileError_None;
     mbVerbose = bVerbose;
-    if (bWrite)
+    if (nOpenMode != ZZFILE_READ)
     {
         mnLastError = kZZFileError_Unsupported;
         std::cerr << "cHTTPFile does not support writing.....yet........maybe ever." << std::endl;
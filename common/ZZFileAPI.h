@@ -39,14 +39,16 @@ public:
 
     const static int64_t ZZFILE_NO_SEEK = -1;
     const static int64_t ZZFILE_SEEK_END = -2;
-    const static bool    ZZFILE_READ = false;
-    const static bool    ZZFILE_WRITE = true;
+    const static uint32_t ZZFILE_READ = 0;
+    const static uint32_t ZZFILE_WRITE = 1;         // creates or truncates
+    const static uint32_t ZZFILE_MODIFY = 2;        // read/write access to an existing file without truncating
+    const static uint32_t ZZFILE_WRITE_STREAM = 3;  // strictly sequential writes (pipes, fifos, sockets). No reads and no seeks.
 
 
     // Factory Construction
     // returns either a cZZFileLocal, cHTTPFile* or a cHTTPSFile* depending on the url needs
-    static bool         Open(const std::string& sURL, bool bWrite, std::shared_ptr<cZZFile>& pFile, const std::string& sName = "", const std::string& sPassword = "", bool bVerbose = false);
-    static bool         Open(const std::wstring& sURL, bool bWrite, std::shared_ptr<cZZFile>& pFile, const std::wstring& sName = L"", const std::wstring& sPassword = L"", bool bVerbose = false);	    // wstring version for convenience
+    static bool         Open(const std::string& sURL, uint32_t nOpenMode, std::shared_ptr<cZZFile>& pFile, const std::string& sName = "", const std::string& sPassword = "", bool bVerbose = false);
+    static bool         Open(const std::wstring& sURL, uint32_t nOpenMode, std::shared_ptr<cZZFile>& pFile, const std::wstring& sName = L"", const std::wstring& sPassword = L"", bool bVerbose = false);	    // wstring version for convenience
 
     virtual             ~cZZFile() {};
 
@@ -60,7 +62,7 @@ public:
 protected:
     cZZFile();          // private constructor.... use cZZFile::Open factory function for construction
 
-    virtual bool	    OpenInternal(std::string sURL, bool bWrite, std::string sName, std::string sPassword, bool bVerbose) = 0;
+    virtual bool	    OpenInternal(std::string sURL, uint32_t nOpenMode, std::string sName, std::string sPassword, bool bVerbose) = 0;
     std::string         msPath;
     bool                mbVerbose;
     uint64_t		    mnFileSize;
@@ -79,14 +81,17 @@ public:
 	virtual bool    Read(int64_t nOffset, uint32_t nBytes, uint8_t* pDestination, uint32_t& nBytesRead);
     virtual bool    Write(int64_t nOffset, uint32_t nBytes, uint8_t* pSource, uint32_t& nBytesWritten);
 
+    const std::string&  GetPath() const { return msPath; }     // for handing the file to OS calls that want a path
+
 protected:
     cZZFileLocal(); // private constructor.... use cZZFile::Open factory function for construction
 
-    virtual bool    OpenInternal(std::string sURL, bool bWrite, std::string sName, std::string sPassword, bool bVerbose);
+    virtual bool    OpenInternal(std::string sURL, uint32_t nOpenMode, std::string sName, std::string sPassword, bool bVerbose);
 
 protected:
     std::fstream    mFileStream;
     std::mutex      mMutex;
+    bool            mbStreaming;    // opened with ZZFILE_WRITE_STREAM. mnFileSize tracks bytes written.
 };
 
 
@@ -105,7 +110,7 @@ public:
 protected:
     cHTTPFile();    // private constructor.... use cZZFile::Open factory function for construction
 
-    virtual bool	OpenInternal(std::string sURL, bool bWrite, std::string sName, std::string sPassword, bool bVerbose);
+    virtual bool	OpenInternal(std::string sURL, uint32_t nOpenMode, std::string sName, std::string sPassword, bool bVerbose);
 
     static size_t   write_data(char* buffer, size_t size, size_t nitems, void* userp);
 
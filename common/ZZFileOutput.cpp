@@ -0,0 +1,328 @@
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "ZZFileOutput.h"
+#include <iostream>
+#include <algorithm>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+const uint64_t kMaxWriteCall = 1024 * 1024 * 1024;     // pwrite may write less than asked beyond this anyway
+
+bool cZZFileOutput::Open(const string& sPath, uint64_t nFinalSize, shared_ptr<cZZFile>& pFile, uint32_t nFlags)
+{
+#ifdef _WIN32
+    return cZZFile::Open(sPath, ZZFILE_WRITE, pFile);
+#else
+    cZZFileOutput* pNewFile = new cZZFileOutput();
+    pFile.reset(pNewFile);
+    return pNewFile->Create(sPath, nFinalSize, nFlags);
+#endif
+}
+
+#ifdef _WIN32
+
+cZZFileOutput::cZZFileOutput() : cZZFile()
+{
+}
+
+cZZFileOutput::~cZZFileOutput()
+{
+}
+
+bool cZZFileOutput::Close()
+{
+    return true;
+}
+
+bool cZZFileOutput::Write(int64_t, uint32_t, uint8_t*, uint32_t&)
+{
+    return false;
+}
+
+#else
+
+cZZFileOutput::cZZFileOutput() : cZZFile(), mnFD(-1), mnDirectFD(-1), mpMapped(nullptr), mnMappedSize(0), mbSparse(false), mnBlockOffset(0), mnBlockBytes(0), mnPosition(0)
+{
+    mbVerbose = false;
+}
+
+cZZFileOutput::~cZZFileOutput()
+{
+    cZZFileOutput::Close();
+}
+
+bool cZZFileOutput::Create(const string& sPath, uint64_t nFinalSize, uint32_t nFlags)
+{
+    msPath = sPath;
+    mnLastError = 0;
+    mnFileSize = 0;             // grows with what's written. The reservation doesn't count.
+
+    mnFD = open(sPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);     // read access is needed to map it
+    if (mnFD < 0)
+    {
+        mnLastError = errno;
+        return false;
+    }
+
+    mbSparse = (nFlags & kOutputSparse) != 0;
+
+    // Reserve every block now. Writes then fill them in rather than growing the file as they go.
+    bool bReserved = false;
+#ifdef __linux__
+    if (nFinalSize > 0 && !mbSparse)
+        bReserved = fallocate(mnFD, 0, 0, (off_t)nFinalSize) == 0;
+#endif
+
+    // A mapping over blocks that were never reserved would fault (SIGBUS) instead of failing a write if the disk fills
+    if ((nFlags & kOutputMapped) && bReserved)
+    {
+        void* pMapped = mmap(nullptr, (size_t)nFinalSize, PROT_READ | PROT_WRITE, MAP_SHARED, mnFD, 0);
+        if (pMapped != MAP_FAILED)
+        {
+            mpMapped = (uint8_t*)pMapped;
+            mnMappedSize = nFinalSize;
+        }
+    }
+
+#ifdef O_DIRECT
+    if ((nFlags & kOutputDirect) && !mpMapped && nFinalSize >= kDirectMinSize)
+        mnDirectFD = open(sPath.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);      // some filesystems refuse. Then everything goes through mnFD.
+#endif
+
+    if (!mpMapped)
+        mBlock.Acquire((size_t)std::min<uint64_t>(kWriteBlockSize, std::max<uint64_t>(nFinalSize, 1)));
+
+    return true;
+}
+
+bool cZZFileOutput::Close()
+{
+    std::unique_lock<mutex> lock(mMutex);
+    if (mnFD < 0)
+        return true;
+
+    bool bSuccess = Flush();
+
+    if (mpMapped)
+    {
+        munmap(mpMapped, (size_t)mnMappedSize);
+        mpMapped = nullptr;
+        mnMappedSize = 0;
+    }
+
+    if (mnDirectFD >= 0)
+    {
+        close(mnDirectFD);
+        mnDirectFD = -1;
+    }
+
+    // Drop whatever was reserved but never written (a failed extraction or a CD that overstated the size)
+    if (ftruncate(mnFD, (off_t)mnFileSize) != 0)
+    {
+        mnLastError = errno;
+        bSuccess = false;
+    }
+
+    if (close(mnFD) != 0)
+    {
+        mnLastError = errno;
+        bSuccess = false;
+    }
+
+    mnFD = -1;
+    mBlock.Release();
+    return bSuccess;
+}
+
+bool cZZFileOutput::Write(int64_t nOffset, uint32_t nBytes, uint8_t* pSource, uint32_t& nBytesWritten)
+{
+    std::unique_lock<mutex> lock(mMutex);
+    nBytesWritten = 0;
+
+    if (mnFD < 0)
+        return false;
+
+    uint64_t nPosition = (nOffset == ZZFILE_NO_SEEK) ? mnPosition : (uint64_t)nOffset;
+    const uint8_t* pRemaining = pSource;
+    uint64_t nRemaining = nBytes;
+
+    if (mpMapped && nPosition < mnMappedSize)
+    {
+        uint64_t nMapped = std::min<uint64_t>(nRemaining, mnMappedSize - nPosition);
+        memcpy(mpMapped + nPosition, pRemaining, (size_t)nMapped);
+        pRemaining += nMapped;
+        nRemaining -= nMapped;
+    }
+
+    uint64_t nWritePosition = nPosition + (nBytes - nRemaining);
+    while (nRemaining > 0)
+    {
+        if (mpMapped)
+        {
+            // Past the end of the mapping. Only if the CD understated the size.
+            if (!WriteOut(nWritePosition, pRemaining, nRemaining))
+                return false;
+            break;
+        }
+
+        // Gather contiguous writes. Anything else sends out what's gathered first.
+        if (mnBlockBytes > 0 && nWritePosition != mnBlockOffset + mnBlockBytes)
+        {
+            if (!Flush())
+                return false;
+        }
+
+        if (mnBlockBytes == 0)
+        {
+            mnBlockOffset = nWritePosition;
+            if (nRemaining >= mBlock.Size())
+            {
+                // Already a whole block's worth. No point copying it.
+                uint64_t nDirect = nRemaining - (nRemaining % mBlock.Size());
+                if (!WriteOut(nWritePosition, pRemaining, nDirect))
+                    return false;
+                pRemaining += nDirect;
+                nRemaining -= nDirect;
+                nWritePosition += nDirect;
+                continue;
+            }
+        }
+
+        uint64_t nCopy = std::min<uint64_t>(nRemaining, mBlock.Size() - mnBlockBytes);
+        memcpy(mBlock.Get() + mnBlockBytes, pRemaining, (size_t)nCopy);
+        mnBlockBytes += nCopy;
+        pRemaining += nCopy;
+        nRemaining -= nCopy;
+        nWritePosition += nCopy;
+
+        if (mnBlockBytes == mBlock.Size() && !Flush())
+            return false;
+    }
+
+    mnPosition = nPosition + nBytes;
+    mnFileSize = std::max<uint64_t>(mnFileSize, mnPosition);
+    nBytesWritten = nBytes;
+    return true;
+}
+
+bool cZZFileOutput::Flush()
+{
+    if (mnBlockBytes == 0)
+        return true;
+
+    bool bSuccess = WriteOut(mnBlockOffset, mBlock.Get(), mnBlockBytes);
+    mnBlockBytes = 0;
+    return bSuccess;
+}
+
+// True if every byte is zero. Checks a cache line at a time with plain word ORs, which the compiler vectorizes.
+static bool IsZero(const uint8_t* pData, uint64_t nBytes)
+{
+    uint64_t i = 0;
+    if ((uintptr_t)pData % sizeof(uint64_t) == 0)
+    {
+        const uint64_t* pWords = (const uint64_t*)pData;
+        for (; i + 64 <= nBytes; i += 64, pWords += 8)
+        {
+            if (pWords[0] | pWords[1] | pWords[2] | pWords[3] | pWords[4] | pWords[5] | pWords[6] | pWords[7])
+                return false;
+        }
+    }
+
+    for (; i < nBytes; i++)
+    {
+        if (pData[i])
+            return false;
+    }
+    return true;
+}
+
+bool cZZFileOutput::WriteOut(uint64_t nOffset, const uint8_t* pSource, uint64_t nBytes)
+{
+    if (!mbSparse)
+        return WriteRange(nOffset, pSource, nBytes);
+
+    // Walk the file's pages. Whole zero pages adding up to at least kSparseMinRun are skipped. The fresh file reads them back as zeros.
+    uint64_t nDataStart = 0;        // start of what's still to be written
+    uint64_t nIndex = 0;
+    while (nIndex < nBytes)
+    {
+        uint64_t nPageBytes = std::min<uint64_t>(nBytes - nIndex, kSparsePageSize - (nOffset + nIndex) % kSparsePageSize);
+        if (nPageBytes < kSparsePageSize || !IsZero(pSource + nIndex, nPageBytes))
+        {
+            nIndex += nPageBytes;
+            continue;
+        }
+
+        uint64_t nRunStart = nIndex;
+        while (nIndex + kSparsePageSize <= nBytes && IsZero(pSource + nIndex, kSparsePageSize))
+            nIndex += kSparsePageSize;
+
+        if (nIndex - nRunStart >= kSparseMinRun)
+        {
+            if (!WriteRange(nOffset + nDataStart, pSource + nDataStart, nRunStart - nDataStart))
+                return false;
+            nDataStart = nIndex;
+        }
+    }
+
+    return WriteRange(nOffset + nDataStart, pSource + nDataStart, nBytes - nDataStart);
+}
+
+bool cZZFileOutput::WriteRange(uint64_t nOffset, const uint8_t* pSource, uint64_t nBytes)
+{
+    // O_DIRECT only takes whole aligned pages from aligned memory. The tail of the file goes the normal way.
+    const uint64_t kAlignment = cPooledBuffer::kAlignment;
+    int nFD = mnFD;
+    if (mnDirectFD >= 0 && nOffset % kAlignment == 0 && nBytes % kAlignment == 0 && (uintptr_t)pSource % kAlignment == 0)
+        nFD = mnDirectFD;
+
+    while (nBytes > 0)
+    {
+        ssize_t nWritten = pwrite(nFD, pSource, (size_t)std::min<uint64_t>(nBytes, kMaxWriteCall), (off_t)nOffset);
+        if (nWritten < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            mnLastError = errno;
+            cerr << "Failed to write " << nBytes << " bytes at offset " << nOffset << " to \"" << msPath << "\". Reason: " << mnLastError << "\n";
+            return false;
+        }
+
+        pSource += nWritten;
+        nOffset += (uint64_t)nWritten;
+        nBytes -= (uint64_t)nWritten;
+    }
+
+    return true;
+}
+
+#endif
+
+bool cZZFileOutput::Read(int64_t, uint32_t, uint8_t*, uint32_t&)
+{
+    std::cerr << "cZZFileOutput does not support reading." << std::endl;
+    return false;
+}
+
+bool cZZFileOutput::OpenInternal(string, uint32_t, string, string, bool)
+{
+    std::cerr << "cZZFileOutput is opened with cZZFileOutput::Open." << std::endl;
+    return false;
+}
@@ -0,0 +1,76 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// ZZFileOutput
+// Purpose: Write only cZZFile for extraction output whose final size is known up front (from the CD).
+//          The file's blocks are reserved in one go (fallocate) so a large file isn't grown and fragmented
+//          a piece at a time. Small writes are gathered into large page aligned blocks before they go out.
+//          Optionally the output is written through an mmap of the file, or with O_DIRECT for huge files
+//          so extraction doesn't push everything else out of the page cache.
+//          In sparse mode runs of zero pages are skipped rather than written, leaving holes in the (fresh)
+//          file, and the size is set on Close. Mostly empty disk images then take the space of their data.
+//          On Windows cZZFileOutput::Open returns an ordinary cZZFileLocal.
+//
+// Usage:   shared_ptr<cZZFile> pOutFile;
+//          bool bSuccess = cZZFileOutput::Open(sPath, nUncompressedSize, pOutFile);
+//          ...writes...
+//          bSuccess = pOutFile->Close();     // last block is written here so check the result
+//
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#pragma once
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include "ZZFileAPI.h"
+#include "BufferPool.h"
+
+class cZZFileOutput : public cZZFile
+{
+public:
+    const static uint32_t kOutputMapped = 1;        // write through a shared mapping of the file (only once its blocks are reserved)
+    const static uint32_t kOutputDirect = 2;        // O_DIRECT for files of at least kDirectMinSize
+    const static uint32_t kOutputSparse = 4;        // leave holes for zero runs. Turns off the reservation and mapping.
+
+    const static uint64_t kWriteBlockSize = 4 * 1024 * 1024;
+    const static uint64_t kDirectMinSize = 256 * 1024 * 1024;
+    const static uint64_t kSparsePageSize = 4096;
+    const static uint64_t kSparseMinRun = 64 * 1024;    // shorter zero runs are written. Not worth the extent.
+
+    // Factory Construction. Creates or truncates sPath.
+    static bool     Open(const std::string& sPath, uint64_t nFinalSize, std::shared_ptr<cZZFile>& pFile, uint32_t nFlags = 0);
+
+    ~cZZFileOutput();
+
+    virtual bool    Close();        // writes what's still buffered and trims the file to what was written
+    virtual bool    Read(int64_t, uint32_t, uint8_t*, uint32_t&);    // not permitted
+    virtual bool    Write(int64_t nOffset, uint32_t nBytes, uint8_t* pSource, uint32_t& nBytesWritten);
+
+protected:
+    cZZFileOutput();    // private constructor.... use cZZFileOutput::Open factory function for construction
+
+    virtual bool    OpenInternal(std::string sURL, uint32_t nOpenMode, std::string sName, std::string sPassword, bool bVerbose);    // not permitted. Needs the final size.
+
+#ifndef _WIN32
+    bool            Create(const std::string& sPath, uint64_t nFinalSize, uint32_t nFlags);
+    bool            Flush();                                                        // writes the gathered block
+    bool            WriteOut(uint64_t nOffset, const uint8_t* pSource, uint64_t nBytes);    // straight to the file, skipping zero runs when sparse
+    bool            WriteRange(uint64_t nOffset, const uint8_t* pSource, uint64_t nBytes);
+
+    int             mnFD;
+    int             mnDirectFD;         // O_DIRECT descriptor when kOutputDirect applies. Aligned blocks go here, everything else to mnFD.
+    uint8_t*        mpMapped;
+    uint64_t        mnMappedSize;
+    bool            mbSparse;
+    cPooledBuffer   mBlock;
+    uint64_t        mnBlockOffset;      // file offset of mBlock's first byte
+    uint64_t        mnBlockBytes;
+    uint64_t        mnPosition;         // for ZZFILE_NO_SEEK writes
+    std::mutex      mMutex;
+#endif
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+
+// Pool for running many small, independent tasks (e.g. one per CD entry).
+// parallel_for() deals index ranges round robin onto per-worker deques so no single lock is shared by every task.
+// A worker runs its own ranges front to back (in index order) and when it runs dry steals from the back of another's.
+// Callers that want largest-first (LPT) scheduling sort their work by descending cost before calling parallel_for.
+class WorkStealingPool {
+public:
+	WorkStealingPool(size_t threads = std::thread::hardware_concurrency());
+	~WorkStealingPool();
+
+	// calls f(i) for every i in [0, count). Indices are handed out in chunks of grain. Blocks until all have run.
+	template<class F>
+	void parallel_for(size_t count, size_t grain, F&& f);
+
+	size_t size() const { return workers.size(); }
+
+private:
+	struct Job
+	{
+		std::function<void(size_t, size_t)> body;
+		std::atomic<size_t> remaining;
+		std::mutex done_mutex;
+		std::condition_variable done_condition;
+	};
+
+	struct Range
+	{
+		Job* job;
+		size_t begin;
+		size_t end;
+	};
+
+	struct WorkerQueue
+	{
+		std::mutex mutex;
+		std::deque<Range> ranges;
+	};
+
+	bool pop_local(size_t index, Range& range);
+	bool steal(size_t index, Range& range);
+	void run(const Range& range);
+
+	std::vector< std::thread > workers;
+	std::vector< std::unique_ptr<WorkerQueue> > queues;
+
+	// sleeping workers wait here until something is queued
+	std::atomic<size_t> pending;
+	std::mutex sleep_mutex;
+	std::condition_variable condition;
+	bool stop;
+};
+
+inline WorkStealingPool::WorkStealingPool(size_t threads)
+	: pending(0), stop(false)
+{
+	if (threads == 0)
+		threads = 1;
+
+	for (size_t i = 0; i < threads; ++i)
+		queues.emplace_back(new WorkerQueue());
+
+	for (size_t i = 0; i < threads; ++i)
+		workers.emplace_back(
+			[this, i]
+	{
+		for (;;)
+		{
+			Range range;
+			if (pop_local(i, range) || steal(i, range))
+			{
+				run(range);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(this->sleep_mutex);
+			this->condition.wait(lock,
+				[this] { return this->stop || this->pending > 0; });
+			if (this->stop && this->pending == 0)
+				return;
+		}
+	}
+	);
+}
+
+inline bool WorkStealingPool::pop_local(size_t index, Range& range)
+{
+	WorkerQueue& queue = *queues[index];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.ranges.empty())
+		return false;
+
+	range = queue.ranges.front();
+	queue.ranges.pop_front();
+	--pending;
+	return true;
+}
+
+inline bool WorkStealingPool::steal(size_t index, Range& range)
+{
+	for (size_t offset = 1; offset < queues.size(); ++offset)
+	{
+		WorkerQueue& victim = *queues[(index + offset) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (victim.ranges.empty())
+			continue;
+
+		range = victim.ranges.back();
+		victim.ranges.pop_back();
+		--pending;
+		return true;
+	}
+	return false;
+}
+
+inline void WorkStealingPool::run(const Range& range)
+{
+	Job* job = range.job;
+	job->body(range.begin, range.end);
+
+	// decrement under the lock so the waiter can't see zero and destroy the job before we're done with it
+	std::lock_guard<std::mutex> lock(job->done_mutex);
+	if (--job->remaining == 0)
+		job->done_condition.notify_all();
+}
+
+template<class F>
+void WorkStealingPool::parallel_for(size_t count, size_t grain, F&& f)
+{
+	if (count == 0)
+		return;
+	if (grain == 0)
+		grain = 1;
+
+	Job job;
+	job.body = [&f](size_t begin, size_t end) { for (size_t i = begin; i < end; ++i) f(i); };
+
+	size_t chunks = (count + grain - 1) / grain;
+	job.remaining = chunks;
+
+	// count before queueing so pending never goes below the number of queued ranges
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		pending += chunks;
+	}
+
+	for (size_t chunk = 0; chunk < chunks; ++chunk)
+	{
+		WorkerQueue& queue = *queues[chunk % queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.ranges.push_back(Range{ &job, chunk * grain, std::min(count, (chunk + 1) * grain) });
+	}
+	condition.notify_all();
+
+	std::unique_lock<std::mutex> lock(job.done_mutex);
+	job.done_condition.wait(lock, [&job] { return job.remaining == 0; });
+}
+
+// the destructor joins all threads
+inline WorkStealingPool::~WorkStealingPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		stop = true;
+	}
+	condition.notify_all();
+	for (std::thread &worker : workers)
+		worker.join();
+}
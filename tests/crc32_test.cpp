@@ -0,0 +1,147 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// crc32_test
+// Purpose: Checks that crc32_fast (whichever kernel the CPU dispatches to) and the slicing-by-16 kernels
+//          are bit exact with zlib's crc32 across buffer alignments, lengths and chained calls.
+//          Exits with 0 when everything matches.
+//
+// Build:   crc32_test.vcxproj, or on Linux from the repo root
+//          gcc -O2 -c common/zlib-1.2.11/{adler32,crc32,zutil}.c
+//          g++ -std=c++17 -O2 -Icommon -Icommon/zlib-1.2.11 tests/crc32_test.cpp common/Crc32Fast.cpp adler32.o crc32.o zutil.o -o crc32_test
+//          Run it on every CPU family the kernels target (x86 with PCLMULQDQ, ARMv8 with the CRC extension).
+//
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <stdint.h>
+#include <iostream>
+#include <vector>
+#include <random>
+#include "Crc32Fast.h"
+#include "zlib.h"
+
+using namespace std;
+
+typedef uint32_t (*Crc32Function)(const void* data, size_t length, uint32_t previousCrc32);
+
+const size_t kMaxOffset = 16;
+const size_t kMaxShortLength = 700;         // every length below this at every offset. Covers all the kernels' head and tail handling.
+const size_t kLargeBufferSize = 4 * 1024 * 1024;
+const size_t kRandomLargeCases = 200;
+const size_t kChainedCases = 200;
+
+uint64_t gnChecks = 0;
+uint64_t gnFailures = 0;
+
+static uint32_t ZlibCRC(const uint8_t* pData, size_t nLength, uint32_t nPreviousCRC)
+{
+    // zlib takes 32 bit lengths
+    uLong nCRC = nPreviousCRC;
+    while (nLength > 0)
+    {
+        uInt nChunk = (uInt)std::min<size_t>(nLength, 1024 * 1024 * 1024);
+        nCRC = crc32(nCRC, pData, nChunk);
+        pData += nChunk;
+        nLength -= nChunk;
+    }
+    return (uint32_t)nCRC;
+}
+
+static void Check(const char* pKernelName, const char* pCase, uint32_t nGot, uint32_t nExpected, size_t nOffset, size_t nLength, uint32_t nSeed)
+{
+    gnChecks++;
+    if (nGot == nExpected)
+        return;
+
+    gnFailures++;
+    if (gnFailures <= 20)
+        cerr << pKernelName << " " << pCase << " mismatch. Offset:" << nOffset << " Length:" << nLength << " Seed:0x" << hex << nSeed << " Got:0x" << nGot << " Expected:0x" << nExpected << dec << "\n";
+}
+
+static void TestKernel(const char* pKernelName, Crc32Function pCRC, const vector<uint8_t>& data, mt19937_64& random)
+{
+    const uint8_t* pData = data.data();
+    const uint32_t kSeeds[] = { 0, 0xffffffff, 0x12345678 };
+
+    // every short length at every alignment, starting fresh and continuing a previous CRC
+    for (uint32_t nSeed : kSeeds)
+    {
+        for (size_t nOffset = 0; nOffset <= kMaxOffset; nOffset++)
+        {
+            for (size_t nLength = 0; nLength < kMaxShortLength; nLength++)
+                Check(pKernelName, "short", pCRC(pData + nOffset, nLength, nSeed), ZlibCRC(pData + nOffset, nLength, nSeed), nOffset, nLength, nSeed);
+        }
+    }
+
+    // large buffers at random alignments and lengths
+    for (size_t i = 0; i < kRandomLargeCases; i++)
+    {
+        size_t nOffset = random() % (kMaxOffset + 1);
+        size_t nLength = random() % (data.size() - nOffset + 1);
+        uint32_t nSeed = (uint32_t)random();
+        Check(pKernelName, "large", pCRC(pData + nOffset, nLength, nSeed), ZlibCRC(pData + nOffset, nLength, nSeed), nOffset, nLength, nSeed);
+    }
+
+    // the whole buffer in one go
+    Check(pKernelName, "whole", pCRC(pData, data.size(), 0), ZlibCRC(pData, data.size(), 0), 0, data.size(), 0);
+
+    // a buffer fed through in random pieces must give the same CRC as in one call
+    for (size_t i = 0; i < kChainedCases; i++)
+    {
+        size_t nOffset = random() % (kMaxOffset + 1);
+        size_t nLength = random() % (data.size() - nOffset + 1);
+
+        uint32_t nCRC = 0;
+        size_t nDone = 0;
+        while (nDone < nLength)
+        {
+            size_t nPiece = (random() % 4 == 0) ? random() % 64 : random() % 100000;       // mix tiny pieces in with large ones
+            nPiece = std::min<size_t>(nPiece, nLength - nDone);
+            nCRC = pCRC(pData + nOffset + nDone, nPiece, nCRC);
+            nDone += nPiece;
+        }
+
+        Check(pKernelName, "chained", nCRC, ZlibCRC(pData + nOffset, nLength, 0), nOffset, nLength, 0);
+    }
+}
+
+static uint32_t crc32_16bytes_prefetch_default(const void* data, size_t length, uint32_t previousCrc32)
+{
+    return crc32_16bytes_prefetch(data, length, previousCrc32);
+}
+
+int main()
+{
+    mt19937_64 random(20190101);        // fixed so a failure can be reproduced
+
+    vector<uint8_t> data(kLargeBufferSize + kMaxOffset);
+    for (uint8_t& nByte : data)
+        nByte = (uint8_t)random();
+
+    cout << "crc32_fast kernel: " << crc32_fast_kernel() << "\n";
+
+    TestKernel("crc32_fast", crc32_fast, data, random);
+    TestKernel("crc32_16bytes", crc32_16bytes, data, random);
+    TestKernel("crc32_16bytes_prefetch", crc32_16bytes_prefetch_default, data, random);
+
+    // all zeros and all ones exercise the folding constants differently than random data
+    vector<uint8_t> zeros(kLargeBufferSize, 0);
+    vector<uint8_t> ones(kLargeBufferSize, 0xff);
+    Check("crc32_fast", "zeros", crc32_fast(zeros.data(), zeros.size(), 0), ZlibCRC(zeros.data(), zeros.size(), 0), 0, zeros.size(), 0);
+    Check("crc32_fast", "ones", crc32_fast(ones.data(), ones.size(), 0), ZlibCRC(ones.data(), ones.size(), 0), 0, ones.size(), 0);
+
+    cout << "Checks: " << gnChecks << " Failures: " << gnFailures << "\n";
+    if (gnFailures > 0)
+    {
+        cout << "FAILED\n";
+        return 1;
+    }
+
+    cout << "PASSED\n";
+    return 0;
+}
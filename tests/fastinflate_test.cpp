@@ -0,0 +1,232 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// fastinflate_test
+// Purpose: Checks FastInflate against zlib's inflate. Random data is deflated with deflateInit2 across levels,
+//          strategies, memory levels and flush patterns. FastInflate must accept every one of those streams and
+//          reproduce the input exactly. Corrupted and truncated copies must never be accepted unless zlib accepts
+//          them too with identical output (FastInflate may turn down what zlib accepts, callers then fall back
+//          to zlib). Streams asked for the wrong output size must be rejected.
+//          Exits with 0 when everything matches.
+//
+// Build:   fastinflate_test.vcxproj, or on Linux from the repo root
+//          gcc -O2 -c common/zlib-1.2.11/{adler32,crc32,deflate,inffast,inflate,inftrees,trees,zutil}.c
+//          g++ -std=c++17 -O2 -IZZip -Icommon/zlib-1.2.11 tests/fastinflate_test.cpp ZZip/FastInflate.cpp *.o -o fastinflate_test
+//
+// MIT License
+// Copyright 2019 Alex Zvenigorodsky
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <stdint.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+#include <random>
+#include "FastInflate.h"
+#include "zlib.h"
+
+using namespace std;
+
+const int kIterations = 3000;
+const size_t kMaxSmallInput = 70000;
+const size_t kMaxLargeInput = 1000000;      // every tenth input. Long enough for many blocks and far matches.
+
+uint64_t gnChecks = 0;
+uint64_t gnFailures = 0;
+uint64_t gnZlibOnlyAccepts = 0;             // corrupted streams zlib takes and FastInflate turns down. Allowed.
+
+enum eDataKind
+{
+    kRandom = 0,            // incompressible. Mostly stored blocks.
+    kSmallAlphabet = 1,     // literals only, skewed codes
+    kShortMatches = 2,
+    kRunsOfZeros = 3,       // long matches at distance 1
+    kText = 4,
+    kNumDataKinds = 5
+};
+
+static void MakeInput(eDataKind kind, size_t nSize, mt19937& random, vector<uint8_t>& data)
+{
+    const char* kWords = "the quick brown fox ";
+    data.resize(nSize);
+    for (size_t i = 0; i < nSize; i++)
+    {
+        switch (kind)
+        {
+        case kRandom:           data[i] = (uint8_t)random(); break;
+        case kSmallAlphabet:    data[i] = (uint8_t)('a' + random() % 4); break;
+        case kShortMatches:     data[i] = (i > 20 && random() % 4) ? data[i - 1 - random() % 20] : (uint8_t)random(); break;
+        case kRunsOfZeros:      data[i] = ((i / 1000) % 3) ? 0 : (uint8_t)(random() % 7); break;
+        default:                data[i] = (i > 300 && random() % 10) ? data[i - 1 - random() % 300] : (uint8_t)kWords[random() % 20]; break;
+        }
+    }
+}
+
+// Raw deflate (no zlib header), as stored in zip entries. bFlushes mixes sync and full flushes in to produce empty stored blocks and dictionary resets.
+static bool Deflate(const vector<uint8_t>& input, int nLevel, int nStrategy, int nMemLevel, bool bFlushes, mt19937& random, vector<uint8_t>& output)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, nLevel, Z_DEFLATED, -15, nMemLevel, nStrategy) != Z_OK)
+        return false;
+
+    output.resize(deflateBound(&stream, (uLong)input.size()) + 1024 + input.size() / 100);     // flushes add a few bytes each
+    stream.next_out = output.data();
+    stream.avail_out = (uInt)output.size();
+
+    size_t nOffset = 0;
+    while (bFlushes && nOffset < input.size())
+    {
+        size_t nPiece = std::min<size_t>(input.size() - nOffset, 1 + random() % 5000);
+        stream.next_in = (Bytef*)input.data() + nOffset;
+        stream.avail_in = (uInt)nPiece;
+        int nFlush = (random() % 3 == 0) ? Z_FULL_FLUSH : ((random() % 2) ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+        deflate(&stream, nFlush);
+        nOffset += nPiece;
+    }
+
+    stream.next_in = (Bytef*)input.data() + nOffset;
+    stream.avail_in = (uInt)(input.size() - nOffset);
+    int nStatus = deflate(&stream, Z_FINISH);
+
+    output.resize(stream.total_out);
+    deflateEnd(&stream);
+    return nStatus == Z_STREAM_END;
+}
+
+// Same acceptance rule as FastInflate: the stream must end and produce exactly nOutSize bytes
+static bool ZlibInflate(const vector<uint8_t>& input, size_t nOutSize, vector<uint8_t>& output)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -15) != Z_OK)
+        return false;
+
+    output.assign(nOutSize + 1, 0);        // one spare byte so overlong output shows up
+    stream.next_in = (Bytef*)input.data();
+    stream.avail_in = (uInt)input.size();
+    stream.next_out = output.data();
+    stream.avail_out = (uInt)output.size();
+
+    int nStatus = inflate(&stream, Z_FINISH);
+    size_t nProduced = stream.total_out;
+    inflateEnd(&stream);
+
+    output.resize(nOutSize);
+    return nStatus == Z_STREAM_END && nProduced == nOutSize;
+}
+
+static void Fail(int nIteration, const char* pReason, size_t nSize, eDataKind kind, int nLevel, int nStrategy)
+{
+    gnFailures++;
+    if (gnFailures <= 20)
+        cerr << "Iteration:" << nIteration << " " << pReason << ". Size:" << nSize << " Kind:" << kind << " Level:" << nLevel << " Strategy:" << nStrategy << "\n";
+}
+
+int main()
+{
+    mt19937 random(7);      // fixed so a failure can be reproduced
+    const int kStrategies[] = { Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED };
+
+    cout << "FastInflate kernel: " << FastInflateKernel() << "\n";
+
+    vector<uint8_t> input;
+    vector<uint8_t> compressed;
+    vector<uint8_t> output;
+    vector<uint8_t> zlibOutput;
+
+    for (int nIteration = 0; nIteration < kIterations; nIteration++)
+    {
+        size_t nSize = (nIteration % 10 == 0) ? random() % kMaxLargeInput : random() % kMaxSmallInput;
+        eDataKind kind = (eDataKind)(random() % kNumDataKinds);
+        int nLevel = (int)(random() % 10);
+        int nStrategy = kStrategies[random() % (sizeof(kStrategies) / sizeof(kStrategies[0]))];
+        int nMemLevel = 1 + (int)(random() % 9);
+        bool bFlushes = (random() % 3 == 0);
+
+        MakeInput(kind, nSize, random, input);
+        if (!Deflate(input, nLevel, nStrategy, nMemLevel, bFlushes, random, compressed))
+        {
+            Fail(nIteration, "deflate failed", nSize, kind, nLevel, nStrategy);
+            continue;
+        }
+
+        // a valid stream must be accepted and reproduce the input, as zlib does
+        output.assign(nSize, 0);
+        gnChecks++;
+        if (!FastInflate(compressed.data(), compressed.size(), output.data(), nSize))
+            Fail(nIteration, "valid stream rejected", nSize, kind, nLevel, nStrategy);
+        else if (output != input)
+            Fail(nIteration, "output differs from the input", nSize, kind, nLevel, nStrategy);
+
+        gnChecks++;
+        if (!ZlibInflate(compressed, nSize, zlibOutput) || zlibOutput != input)
+            Fail(nIteration, "zlib disagrees with the input", nSize, kind, nLevel, nStrategy);
+
+        // the wrong expected size must be rejected either way
+        output.assign(nSize + 1, 0);
+        gnChecks++;
+        if (FastInflate(compressed.data(), compressed.size(), output.data(), nSize + 1))
+            Fail(nIteration, "accepted with an output size one too large", nSize, kind, nLevel, nStrategy);
+
+        if (nSize > 0)
+        {
+            gnChecks++;
+            if (FastInflate(compressed.data(), compressed.size(), output.data(), nSize - 1))
+                Fail(nIteration, "accepted with an output size one too small", nSize, kind, nLevel, nStrategy);
+        }
+
+        // flip a few bits and sometimes truncate. Accepting is only allowed where zlib accepts with the same output.
+        if (compressed.size() > 2)
+        {
+            vector<uint8_t> corrupted(compressed);
+            int nFlips = 1 + (int)(random() % 3);
+            for (int i = 0; i < nFlips; i++)
+                corrupted[random() % corrupted.size()] ^= (uint8_t)(1 << (random() % 8));
+            if (random() % 4 == 0)
+                corrupted.resize(random() % corrupted.size());
+
+            output.assign(nSize, 0);
+            bool bFastAccepted = FastInflate(corrupted.data(), corrupted.size(), output.data(), nSize);
+            bool bZlibAccepted = ZlibInflate(corrupted, nSize, zlibOutput);
+
+            gnChecks++;
+            if (bFastAccepted && !bZlibAccepted)
+                Fail(nIteration, "corrupted stream accepted that zlib rejects", nSize, kind, nLevel, nStrategy);
+            else if (bFastAccepted && output != zlibOutput)
+                Fail(nIteration, "corrupted stream decoded differently than zlib", nSize, kind, nLevel, nStrategy);
+            else if (!bFastAccepted && bZlibAccepted)
+                gnZlibOnlyAccepts++;
+        }
+    }
+
+    // garbage that was never deflate must not crash or be accepted where zlib rejects
+    for (int nIteration = 0; nIteration < kIterations; nIteration++)
+    {
+        vector<uint8_t> garbage(random() % 512);
+        for (uint8_t& nByte : garbage)
+            nByte = (uint8_t)random();
+        size_t nSize = random() % 4096;
+
+        output.assign(nSize, 0);
+        bool bFastAccepted = FastInflate(garbage.data(), garbage.size(), output.data(), nSize);
+        bool bZlibAccepted = ZlibInflate(garbage, nSize, zlibOutput);
+
+        gnChecks++;
+        if (bFastAccepted && (!bZlibAccepted || output != zlibOutput))
+            Fail(nIteration, "garbage accepted that zlib rejects", nSize, kRandom, -1, -1);
+    }
+
+    cout << "Checks: " << gnChecks << " Failures: " << gnFailures << " Corrupted streams only zlib accepted: " << gnZlibOnlyAccepts << "\n";
+    if (gnFailures > 0)
+    {
+        cout << "FAILED\n";
+        return 1;
+    }
+
+    cout << "PASSED\n";
+    return 0;
+}